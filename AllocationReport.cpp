@@ -0,0 +1,194 @@
+#include "AllocationReport.h"
+
+#include <atomic>
+
+// the malloc family is only interposed by builds that define ALLOCATION_HOOKS, like the one of
+// make alloc, so the compiler and the benchmarks don't pay for it on every allocation.
+#if defined(__GLIBC__) && defined(ALLOCATION_HOOKS)
+#define INTERPOSE_MALLOC
+#include <malloc.h>
+#endif
+
+namespace
+{
+    const int PhasesCount = static_cast<int>(CompilePhase::Count);
+
+    // the last slot collects allocations made outside of any phase.
+    struct PhaseAllocations
+    {
+        std::atomic<uint64_t> Allocations;
+        std::atomic<uint64_t> Bytes;
+        std::atomic<int64_t>  PeakLive;
+    };
+
+    std::atomic<bool>    Enabled{ false };
+    std::atomic<int64_t> PeakLiveBytes{ 0 };
+    PhaseAllocations     Phases[PhasesCount + 1];
+
+    thread_local int ActivePhase = PhasesCount;
+
+    // the phases a phase was begun in, so ending it makes the enclosing one active again.
+    const int MaxPhaseDepth = 16;
+    thread_local int EnclosingPhases[MaxPhaseDepth];
+    thread_local int PhaseDepth = 0;
+}
+
+#if defined(INTERPOSE_MALLOC)
+namespace
+{
+    std::atomic<int64_t> LiveBytes{ 0 };
+
+    void UpdatePeak(std::atomic<int64_t>& peak, const int64_t value)
+    {
+        int64_t current = peak.load(std::memory_order_relaxed);
+        while (value > current && peak.compare_exchange_weak(current, value, std::memory_order_relaxed) == false)
+        {
+        }
+    }
+
+    void RecordAllocation(const size_t size)
+    {
+        PhaseAllocations& phase = Phases[ActivePhase];
+        phase.Allocations.fetch_add(1, std::memory_order_relaxed);
+        phase.Bytes.fetch_add(size, std::memory_order_relaxed);
+
+        const int64_t live = LiveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+        UpdatePeak(phase.PeakLive, live);
+        UpdatePeak(PeakLiveBytes, live);
+    }
+
+    void RecordFree(const size_t size)
+    {
+        LiveBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+}
+
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void  __libc_free(void* ptr);
+
+    void* malloc(size_t size)
+    {
+        void* ptr = __libc_malloc(size);
+        if (ptr != nullptr && Enabled.load(std::memory_order_relaxed))
+            RecordAllocation(malloc_usable_size(ptr));
+
+        return ptr;
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        void* ptr = __libc_calloc(count, size);
+        if (ptr != nullptr && Enabled.load(std::memory_order_relaxed))
+            RecordAllocation(malloc_usable_size(ptr));
+
+        return ptr;
+    }
+
+    void* realloc(void* ptr, size_t size)
+    {
+        if (Enabled.load(std::memory_order_relaxed) == false)
+            return __libc_realloc(ptr, size);
+
+        const size_t oldSize = ptr != nullptr ? malloc_usable_size(ptr) : 0;
+        void* newPtr = __libc_realloc(ptr, size);
+        if (newPtr != nullptr)
+        {
+            RecordFree(oldSize);
+            RecordAllocation(malloc_usable_size(newPtr));
+        }
+
+        return newPtr;
+    }
+
+    void free(void* ptr)
+    {
+        if (ptr != nullptr && Enabled.load(std::memory_order_relaxed))
+            RecordFree(malloc_usable_size(ptr));
+
+        __libc_free(ptr);
+    }
+}
+#endif
+
+AllocationReport::AllocationReport()
+    : SourceLines(0)
+{
+    Enabled.store(true);
+}
+
+AllocationReport::~AllocationReport()
+{
+    Enabled.store(false);
+}
+
+void AllocationReport::Begin(const CompilePhase phase)
+{
+    if (PhaseDepth < MaxPhaseDepth)
+        EnclosingPhases[PhaseDepth] = ActivePhase;
+    ++PhaseDepth;
+
+    ActivePhase = static_cast<int>(phase);
+}
+
+void AllocationReport::End(const CompilePhase phase)
+{
+    // the phases are begun and ended by scopes, so they nest.
+    --PhaseDepth;
+    if (PhaseDepth < MaxPhaseDepth)
+        ActivePhase = EnclosingPhases[PhaseDepth];
+}
+
+void AllocationReport::AddSourceLines(const uint64_t lines)
+{
+    SourceLines += lines;
+}
+
+uint64_t AllocationReport::GetAllocations() const
+{
+    uint64_t allocations = 0;
+    for (int p = 0; p < PhasesCount; ++p)
+        allocations += Phases[p].Allocations.load();
+
+    return allocations;
+}
+
+double AllocationReport::GetAllocationsPerLine() const
+{
+    return SourceLines != 0 ? static_cast<double>(GetAllocations()) / SourceLines : 0.0;
+}
+
+bool AllocationReport::IsSupported() const
+{
+#if defined(INTERPOSE_MALLOC)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AllocationReport::Print(FILE* f) const
+{
+    if (IsSupported() == false)
+    {
+        std::fprintf(f, "allocation accounting needs a build with the allocation hooks, like the one of make alloc.\n");
+        return;
+    }
+
+    std::fprintf(f, "%-18s %12s %14s %14s\n", "phase", "allocations", "bytes", "peak live");
+    for (int p = 0; p <= PhasesCount; ++p)
+    {
+        const PhaseAllocations& phase = Phases[p];
+        std::fprintf(f, "%-18s %12llu %14llu %14lld\n",
+                     p == PhasesCount ? "other" : GetPhaseName(static_cast<CompilePhase>(p)),
+                     static_cast<unsigned long long>(phase.Allocations.load()),
+                     static_cast<unsigned long long>(phase.Bytes.load()),
+                     static_cast<long long>(phase.PeakLive.load()));
+    }
+
+    std::fprintf(f, "%-18s %12llu %14s %14lld\n", "total", static_cast<unsigned long long>(GetAllocations()), "", static_cast<long long>(PeakLiveBytes.load()));
+    std::fprintf(f, "source lines: %llu, allocations per line: %.2f\n", static_cast<unsigned long long>(SourceLines), GetAllocationsPerLine());
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Instrumentation.h"
+
+#include <cstdint>
+#include <cstdio>
+
+// Counts heap allocations while enabled and attributes them to the compile phase that is
+// active on the allocating thread. Builds with ALLOCATION_HOOKS on glibc interpose the malloc
+// family, so strdup in the scanner and every operator new are seen as well; other builds count
+// nothing.
+class AllocationReport
+{
+public:
+    AllocationReport();
+    ~AllocationReport();
+
+    void Begin(const CompilePhase phase);
+    void End(const CompilePhase phase);
+    void AddSourceLines(const uint64_t lines);
+
+    uint64_t GetAllocations() const;
+    double GetAllocationsPerLine() const;
+    bool IsSupported() const;
+
+    void Print(FILE* f) const;
+
+private:
+    uint64_t SourceLines;
+};
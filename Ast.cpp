@@ -1,5 +1,7 @@
 #include "Ast.h"
 
+#include <cstring>
+
 namespace AST
 {
 
@@ -25,12 +27,14 @@ namespace AST
         visitor->Visit(this);
     }
 
-    OperandNode::OperandNode(const OperandType optype, const int value, const AddressingType addrType, const char* labelName, const int indexedOffset)
+    OperandNode::OperandNode(const OperandType optype, const int value, const AddressingType addrType, const char* labelName, const int indexedOffset, const int fixup)
         : OpType(optype)
-        , Value(value)
         , AddrType(addrType)
+        , Value(value)
         , IndexedOffset(indexedOffset)
+        , Fixup(fixup)
         , LabelName(labelName)
+        , Target(nullptr)
     {
     }
 
@@ -39,9 +43,18 @@ namespace AST
         visitor->Visit(this);
     }
 
-    CommandNode::CommandNode(const int opcode, const int line)
-        : Opcode(opcode)
-        , Line(line)
+    CommandNode::CommandNode(const int opcode, const SourceLocation location)
+        : CommandNode(opcode, location, CommandKind::Command)
+    {
+    }
+
+    CommandNode::CommandNode(const int opcode, const SourceLocation location, const CommandKind kind)
+        : Kind(kind)
+        , Opcode(opcode)
+        , Location(location)
+        , InstructionNumber(0)
+        , Form(JumpForm::Short)
+        , EncoderKey(0)
         , Next(nullptr)
         , Labels(nullptr)
     {
@@ -57,8 +70,8 @@ namespace AST
         visitor->Visit(this);
     }
 
-    OneOperandCommandNode::OneOperandCommandNode(const int opcode, OperandNode* first, const int line)
-        : CommandNode(opcode, line)
+    OneOperandCommandNode::OneOperandCommandNode(const int opcode, OperandNode* first, const SourceLocation location)
+        : CommandNode(opcode, location, CommandKind::OneOperand)
         , First(first)
     {
     }
@@ -73,8 +86,8 @@ namespace AST
         visitor->Visit(this);
     }
 
-    DoubleOperandCommandNode::DoubleOperandCommandNode(const int opcode, OperandNode* first, OperandNode* second, const int line)
-        : CommandNode(opcode, line)
+    DoubleOperandCommandNode::DoubleOperandCommandNode(const int opcode, OperandNode* first, OperandNode* second, const SourceLocation location)
+        : CommandNode(opcode, location, CommandKind::DoubleOperand)
         , First(first)
         , Second(second)
     {
@@ -91,6 +104,68 @@ namespace AST
         visitor->Visit(this);
     }
 
+    // data has no opcode.
+    DataNode::DataNode(const SourceLocation location)
+        : CommandNode(-1, location, CommandKind::Data)
+        , Size(0)
+    {
+    }
+
+    void DataNode::Accept(AstVisitor* visitor)
+    {
+        visitor->Visit(this);
+    }
+
+    void DataNode::AddWord(const int value, const int fixup)
+    {
+        // as in MACRO-11, a word starts on a word boundary.
+        Align();
+        Store();
+
+        if (fixup >= 0)
+            Fixups.push_back(DataFixup{ Size, fixup, false });
+
+        Bytes.push_back(static_cast<Byte>(value));
+        Bytes.push_back(static_cast<Byte>(value >> 8));
+        Size += sizeof(Word);
+    }
+
+    void DataNode::AddByte(const int value, const int fixup)
+    {
+        Store();
+
+        if (fixup >= 0)
+            Fixups.push_back(DataFixup{ Size, fixup, true });
+
+        Bytes.push_back(static_cast<Byte>(value));
+        Size += 1;
+    }
+
+    void DataNode::AddText(const char* text, const bool terminated)
+    {
+        Store();
+
+        const size_t length = strlen(text) + (terminated ? 1 : 0);
+        Bytes.insert(Bytes.end(), text, text + length);
+        Size += static_cast<uint32_t>(length);
+    }
+
+    void DataNode::Reserve(const unsigned int size)
+    {
+        Size += size;
+    }
+
+    void DataNode::Align()
+    {
+        Size += Size % sizeof(Word);
+    }
+
+    void DataNode::Store()
+    {
+        // reserved space followed by stored bytes is stored as zeros.
+        Bytes.resize(Size, 0);
+    }
+
     void ProgramNode::Accept(AstVisitor* visitor)
     {
         visitor->Visit(this);
@@ -99,14 +174,22 @@ namespace AST
             n->Accept(visitor);
     }
 
-    ProgramNode::ProgramNode(CommandNode* commands)
+    ProgramNode::ProgramNode(CommandNode* commands, ExpressionTable&& expressions)
         : Commands(commands)
+        , Expressions(std::move(expressions))
     {
     }
 
     ProgramNode::~ProgramNode()
     {
-        delete Commands;
+        // one by one: deleting through CommandNode::Next recurses once per command.
+        while (Commands != nullptr)
+        {
+            CommandNode* next = Commands->Next;
+            Commands->Next = nullptr;
+            delete Commands;
+            Commands = next;
+        }
     }
 
     AbstractSyntaxTree::AbstractSyntaxTree()
@@ -114,6 +197,32 @@ namespace AST
     {
     }
 
+    AbstractSyntaxTree::AbstractSyntaxTree(AbstractSyntaxTree&& other)
+        : Program(other.Program)
+        , Expressions(std::move(other.Expressions))
+        , Globals(std::move(other.Globals))
+    {
+        other.Program = nullptr;
+    }
+
+    AbstractSyntaxTree& AbstractSyntaxTree::operator=(AbstractSyntaxTree&& other)
+    {
+        if (this != &other)
+        {
+            SetProgram(other.Program);
+            other.Program = nullptr;
+            Expressions = std::move(other.Expressions);
+            Globals = std::move(other.Globals);
+        }
+
+        return *this;
+    }
+
+    AbstractSyntaxTree::~AbstractSyntaxTree()
+    {
+        delete Program;
+    }
+
     void AbstractSyntaxTree::SetProgram(ProgramNode* node)
     {
         if (Program)
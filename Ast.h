@@ -1,11 +1,23 @@
 #pragma once
 
+#include "Expression.h"
 #include "Macro11Common.h"
+#include "SourceLocation.h"
+#include <string>
 #include <vector>
 
 namespace AST
 {
     class AstVisitor;
+    class CommandNode;
+
+    enum class CommandKind : unsigned char
+    {
+        Command,
+        OneOperand,
+        DoubleOperand,
+        Data,
+    };
 
     class Node
     {
@@ -30,21 +42,27 @@ namespace AST
     class OperandNode : public Node
     {
     public:
-        OperandNode(const OperandType optype, const int value, const AddressingType addrType, const char* labelName = nullptr, const int indexedOffset = 0);
+        OperandNode(const OperandType optype, const int value, const AddressingType addrType, const char* labelName = nullptr, const int indexedOffset = 0, const int fixup = -1);
         virtual void Accept(AstVisitor* visitor) override;
         
     public:
         OperandType    OpType;
-        int            Value;
         AddressingType AddrType;
+        int            Value;
         int            IndexedOffset;
+        // the expression of the program's table that gives the extension word after layout, -1 if
+        // Value, IndexedOffset or LabelName give it. A label operand with a fixup has no LabelName.
+        int            Fixup;
         const char*    LabelName;
+        // the command a local label operand refers to, set by the parser once the scope of the
+        // label ends; local labels are in no labels table.
+        const CommandNode* Target;
     };
 
     class CommandNode : public Node
     {
     public:
-        CommandNode(const int opcode, const int line);
+        CommandNode(const int opcode, const SourceLocation location);
         virtual ~CommandNode() override;
         virtual void Accept(AstVisitor* visitor) override;
 
@@ -53,18 +71,35 @@ namespace AST
             InstructionNumber = number;
         }
 
+        inline void SetJumpForm(const JumpForm form) const
+        {
+            Form = form;
+        }
+
+        inline void SetEncoderKey(const unsigned char key) const
+        {
+            EncoderKey = key;
+        }
+
+    protected:
+        CommandNode(const int opcode, const SourceLocation location, const CommandKind kind);
+
     public:
-        const int    Opcode;
-        const int    Line;
-        mutable int  InstructionNumber;
-        CommandNode* Next;
-        LabelNode*   Labels;
+        const CommandKind Kind;
+        const int         Opcode;
+        const SourceLocation Location;
+        mutable int       InstructionNumber;
+        mutable JumpForm  Form;
+        // picks the encoder of the second pass, set by the first pass.
+        mutable unsigned char EncoderKey;
+        CommandNode*      Next;
+        LabelNode*        Labels;
     };
 
     class OneOperandCommandNode : public CommandNode
     {
     public:
-        OneOperandCommandNode(const int opcode, OperandNode* first, const int line);
+        OneOperandCommandNode(const int opcode, OperandNode* first, const SourceLocation location);
         virtual ~OneOperandCommandNode() override;
         virtual void Accept(AstVisitor* visitor) override;
 
@@ -75,7 +110,7 @@ namespace AST
     class DoubleOperandCommandNode : public CommandNode
     {
     public:
-        DoubleOperandCommandNode(const int opcide, OperandNode* first, OperandNode* second, const int line);
+        DoubleOperandCommandNode(const int opcide, OperandNode* first, OperandNode* second, const SourceLocation location);
         virtual ~DoubleOperandCommandNode() override;
         virtual void Accept(AstVisitor* visitor) override;
 
@@ -84,15 +119,55 @@ namespace AST
         OperandNode* Second;
     };
 
+    // A run of .WORD, .BYTE, .ASCII, .ASCIZ, .BLKW, .BLKB and .EVEN directives without a label
+    // between them, kept as the bytes they assemble to so they are emitted in one copy. Space
+    // reserved at the end of the run isn't stored; if it ends the program, it isn't stored in the
+    // image either.
+    class DataNode : public CommandNode
+    {
+    public:
+        // an expression the value of which is only known after layout, at Offset in the bytes.
+        struct DataFixup
+        {
+            uint32_t Offset;
+            int      Fixup;
+            bool     IsByte;
+        };
+
+        DataNode(const SourceLocation location);
+        virtual void Accept(AstVisitor* visitor) override;
+
+        void AddWord(const int value, const int fixup = -1);
+        void AddByte(const int value, const int fixup = -1);
+        void AddText(const char* text, const bool terminated);
+        void Reserve(const unsigned int size);
+        void Align();
+
+        inline unsigned int GetWords() const;
+        inline unsigned int GetStoredWords() const;
+
+    private:
+        void Store();
+
+    public:
+        // the bytes up to the last one stored; the rest of Size is zero.
+        std::vector<Byte>      Bytes;
+        std::vector<DataFixup> Fixups;
+        uint32_t               Size;
+    };
+
     class ProgramNode : public Node
     {
     public:
-        ProgramNode(CommandNode* commands);
+        ProgramNode(CommandNode* commands, ExpressionTable&& expressions = ExpressionTable());
         virtual ~ProgramNode() override;
         virtual void Accept(AstVisitor* visitor) override;
 
     public:
-        CommandNode* Commands;
+        CommandNode*    Commands;
+        ExpressionTable Expressions;
+        // the names of .GLOBL: labels the program exports, or uses from another module.
+        std::vector<std::string> Globals;
     };
 
     class AstVisitor
@@ -104,6 +179,7 @@ namespace AST
         virtual void Visit(CommandNode* node)                             {}
         virtual void Visit(OneOperandCommandNode* node)                   {}
         virtual void Visit(DoubleOperandCommandNode* node)                {}
+        virtual void Visit(DataNode* node)                                {}
         virtual void Visit(ProgramNode* node)                             {}
     };
 
@@ -111,11 +187,91 @@ namespace AST
     {
     public:
         AbstractSyntaxTree();
+        AbstractSyntaxTree(AbstractSyntaxTree&& other);
+        AbstractSyntaxTree& operator=(AbstractSyntaxTree&& other);
+        ~AbstractSyntaxTree();
+
+        AbstractSyntaxTree(const AbstractSyntaxTree&) = delete;
+        AbstractSyntaxTree& operator=(const AbstractSyntaxTree&) = delete;
 
         void SetProgram(ProgramNode* node);
+        inline ProgramNode* GetProgram() const;
         void Accept(AstVisitor* visitor);
 
+        // filled by the parser and handed over to the program node once the program is parsed.
+        inline ExpressionTable& GetExpressions();
+        inline std::vector<std::string>& GetGlobals();
+
+        template <typename Visitor>
+        inline void Traverse(Visitor& visitor);
+
     private:
-        ProgramNode* Program;
+        ProgramNode*             Program;
+        ExpressionTable          Expressions;
+        std::vector<std::string> Globals;
     };
+
+    // Calls the Visit overload of the command's own type, dispatched on CommandNode::Kind instead of
+    // the virtual Accept. With a final visitor class the call is resolved statically and can be inlined.
+    template <typename Visitor>
+    inline void Dispatch(CommandNode* node, Visitor& visitor)
+    {
+        switch (node->Kind)
+        {
+        case CommandKind::Command:
+            visitor.Visit(node);
+            break;
+        case CommandKind::OneOperand:
+            visitor.Visit(static_cast<OneOperandCommandNode*>(node));
+            break;
+        case CommandKind::DoubleOperand:
+            visitor.Visit(static_cast<DoubleOperandCommandNode*>(node));
+            break;
+        case CommandKind::Data:
+            visitor.Visit(static_cast<DataNode*>(node));
+            break;
+        }
+    }
+
+    // Same walk as ProgramNode::Accept, with every command dispatched statically.
+    template <typename Visitor>
+    void Traverse(ProgramNode* program, Visitor& visitor)
+    {
+        // through the base class, since passes that only override the command overloads hide this one.
+        static_cast<AstVisitor&>(visitor).Visit(program);
+
+        for (CommandNode* n = program->Commands; n != nullptr; n = n->Next)
+            Dispatch(n, visitor);
+    }
+
+    unsigned int DataNode::GetWords() const
+    {
+        return (Size + 1) / sizeof(Word);
+    }
+
+    unsigned int DataNode::GetStoredWords() const
+    {
+        return static_cast<unsigned int>((Bytes.size() + 1) / sizeof(Word));
+    }
+
+    ProgramNode* AbstractSyntaxTree::GetProgram() const
+    {
+        return Program;
+    }
+
+    ExpressionTable& AbstractSyntaxTree::GetExpressions()
+    {
+        return Expressions;
+    }
+
+    std::vector<std::string>& AbstractSyntaxTree::GetGlobals()
+    {
+        return Globals;
+    }
+
+    template <typename Visitor>
+    void AbstractSyntaxTree::Traverse(Visitor& visitor)
+    {
+        AST::Traverse(Program, visitor);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,396 @@
+#include "Ast.h"
+#include "CodeGenerator.h"
+#include "EncoderCheck.h"
+#include "PassManager.h"
+#include "PerformanceGate.h"
+#include "PicCheck.h"
+#include "Pipeline.h"
+#include "RomFillCheck.h"
+#include "SemanticAnalyzer.h"
+#include "SourceCheck.h"
+#include "TimeReport.h"
+#include "WorkloadGenerator.h"
+#include "macro11.tab.h"
+
+#include "optparse.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern int yylex();
+extern int yyparse(AST::AbstractSyntaxTree* ast);
+extern void yyrestart(FILE* f);
+extern int yylineno;
+extern YYSTYPE ScannerValue;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct Workload
+    {
+        FILE*    File;
+        uint64_t Lines;
+        uint64_t Bytes;
+    };
+
+    double GetSeconds(const Clock::time_point begin)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(Clock::now() - begin).count();
+    }
+
+    void Rewind(const Workload& workload)
+    {
+        std::rewind(workload.File);
+        yyrestart(workload.File);
+        yylineno = 1;
+    }
+
+    AST::AbstractSyntaxTree ParseWorkload(const Workload& workload)
+    {
+        Rewind(workload);
+
+        AST::AbstractSyntaxTree ast;
+        yyparse(&ast);
+
+        return ast;
+    }
+
+    void PrintResult(const char* name, const Workload& workload, const double seconds)
+    {
+        std::printf("%-18s %10llu %12llu %12.6f %14.0f %10.2f\n", name,
+                    static_cast<unsigned long long>(workload.Lines), static_cast<unsigned long long>(workload.Bytes),
+                    seconds, workload.Lines / seconds, workload.Bytes / seconds / (1024.0 * 1024.0));
+    }
+
+    double BenchmarkLexer(const Workload& workload)
+    {
+        Rewind(workload);
+        const Clock::time_point begin = Clock::now();
+
+        while (const int token = yylex())
+        {
+            if (token == STRING || token == LABEL)
+                free(ScannerValue.sval);
+        }
+
+        return GetSeconds(begin);
+    }
+
+    double BenchmarkParser(const Workload& workload)
+    {
+        Rewind(workload);
+        const Clock::time_point begin = Clock::now();
+
+        AST::AbstractSyntaxTree ast;
+        yyparse(&ast);
+
+        const double seconds = GetSeconds(begin);
+        ast.SetProgram(nullptr);
+
+        return seconds;
+    }
+
+    // the cheapest possible pass, so the two traversals differ only in their dispatch cost.
+    class OpcodeSum final : public AST::AstVisitor
+    {
+    public:
+        virtual void Visit(AST::CommandNode* node) override                { Sum += node->Opcode; }
+        virtual void Visit(AST::OneOperandCommandNode* node) override      { Sum += node->Opcode + node->First->Value; }
+        virtual void Visit(AST::DoubleOperandCommandNode* node) override   { Sum += node->Opcode + node->First->Value + node->Second->Value; }
+
+        uint64_t Sum = 0;
+    };
+
+    volatile uint64_t Sink;
+
+    template <typename Visitor>
+    double BenchmarkPass(AST::AbstractSyntaxTree& ast, const bool staticDispatch)
+    {
+        const Clock::time_point begin = Clock::now();
+
+        Visitor visitor;
+        if (staticDispatch)
+            ast.Traverse(visitor);
+        else
+            ast.Accept(&visitor);
+
+        const double seconds = GetSeconds(begin);
+        Sink = visitor.GetErrors().size();
+
+        return seconds;
+    }
+
+    template <>
+    double BenchmarkPass<OpcodeSum>(AST::AbstractSyntaxTree& ast, const bool staticDispatch)
+    {
+        const Clock::time_point begin = Clock::now();
+
+        OpcodeSum visitor;
+        if (staticDispatch)
+            ast.Traverse(visitor);
+        else
+            ast.Accept(&visitor);
+
+        const double seconds = GetSeconds(begin);
+        Sink = visitor.Sum;
+
+        return seconds;
+    }
+
+    void BenchmarkCodeGenerator(const Workload& workload, double* firstPass, double* secondPass)
+    {
+        // every run starts from a fresh parse, as code generation rewrites the jump forms in the tree.
+        AST::AbstractSyntaxTree ast = ParseWorkload(workload);
+
+        TimeReport timeReport;
+        Instrumentation instrumentation{ &timeReport, nullptr, nullptr };
+
+        AST::CodeGenerator codeGen;
+        codeGen.SetInstrumentation(&instrumentation);
+        codeGen.Generate(&ast);
+
+        *firstPass = timeReport.GetSeconds(CompilePhase::FirstPass);
+        *secondPass = timeReport.GetSeconds(CompilePhase::SecondPass);
+    }
+
+    double BenchmarkEndToEnd(const Workload& workload)
+    {
+        const Clock::time_point begin = Clock::now();
+
+        AST::AbstractSyntaxTree ast = ParseWorkload(workload);
+
+        AST::SemanticAnalyzer sa;
+        ast.Traverse(sa);
+
+        AST::CodeGenerator codeGen;
+        const std::vector<Word> program = codeGen.Generate(&ast);
+
+        // the segment size check is left out: the large workloads don't fit into ROM.
+        FILE* f = std::tmpfile();
+        const uint64_t dataSize = 0;
+        std::fwrite(&dataSize, sizeof(uint64_t), 1, f);
+        std::fwrite(program.data(), sizeof(Word), program.size(), f);
+        std::fclose(f);
+
+        return GetSeconds(begin);
+    }
+
+    // the compiler's passes without the reports, with the parse either before them or overlapped
+    // with their first walk.
+    double BenchmarkCompile(const Workload& workload, const bool pipelined)
+    {
+        const Clock::time_point begin = Clock::now();
+
+        AST::SemanticAnalyzer sa;
+        AST::VisitorPass semantic{ "semantic analysis", CompilePhase::SemanticAnalysis, &sa };
+        AST::CodeGenerator codeGen;
+
+        AST::PassManager passes;
+        passes.Add(&semantic);
+        codeGen.AddPasses(passes);
+
+        Rewind(workload);
+        AST::AbstractSyntaxTree ast;
+        if (pipelined)
+        {
+            MacroExpander macros;
+            Pipeline{ passes, macros }.Parse(workload.File, &ast);
+            passes.FinishStream(&ast);
+        }
+        else
+        {
+            yyparse(&ast);
+            passes.Run(&ast);
+        }
+
+        Sink = codeGen.TakeProgram().size();
+
+        return GetSeconds(begin);
+    }
+
+    void RunBenchmarks(const WorkloadOptions& options, const unsigned int repeat)
+    {
+        Workload workload;
+        workload.File = std::tmpfile();
+        workload.Lines = options.Lines;
+
+        WorkloadGenerator(options).Generate(workload.File);
+        workload.Bytes = std::ftell(workload.File);
+
+        double lexer = 1e300, parser = 1e300, firstPass = 1e300, secondPass = 1e300, endToEnd = 1e300;
+
+        for (unsigned int r = 0; r < repeat; ++r)
+        {
+            lexer = std::min(lexer, BenchmarkLexer(workload));
+            parser = std::min(parser, BenchmarkParser(workload));
+        }
+
+        // index 0 is the virtual AstVisitor walk, index 1 the walk dispatched on the node kind.
+        double dispatch[2] = { 1e300, 1e300 }, semantic[2] = { 1e300, 1e300 };
+
+        AST::AbstractSyntaxTree ast = ParseWorkload(workload);
+        for (unsigned int r = 0; r < repeat; ++r)
+        {
+            for (int s = 0; s < 2; ++s)
+            {
+                dispatch[s] = std::min(dispatch[s], BenchmarkPass<OpcodeSum>(ast, s == 1));
+                semantic[s] = std::min(semantic[s], BenchmarkPass<AST::SemanticAnalyzer>(ast, s == 1));
+            }
+        }
+        ast.SetProgram(nullptr);
+
+        for (unsigned int r = 0; r < repeat; ++r)
+        {
+            double fp = 0.0, sp = 0.0;
+            BenchmarkCodeGenerator(workload, &fp, &sp);
+            firstPass = std::min(firstPass, fp);
+            secondPass = std::min(secondPass, sp);
+
+            endToEnd = std::min(endToEnd, BenchmarkEndToEnd(workload));
+        }
+
+        double compile[2] = { 1e300, 1e300 };
+        for (unsigned int r = 0; r < repeat; ++r)
+        {
+            for (int p = 0; p < 2; ++p)
+                compile[p] = std::min(compile[p], BenchmarkCompile(workload, p == 1));
+        }
+
+        PrintResult("lexer", workload, lexer);
+        PrintResult("parser", workload, parser);
+        PrintResult("dispatch virtual", workload, dispatch[0]);
+        PrintResult("dispatch static", workload, dispatch[1]);
+        PrintResult("semantic virtual", workload, semantic[0]);
+        PrintResult("semantic static", workload, semantic[1]);
+        PrintResult("first pass", workload, firstPass);
+        PrintResult("second pass", workload, secondPass);
+        PrintResult("end to end", workload, endToEnd);
+        PrintResult("compile serial", workload, compile[0]);
+        PrintResult("compile pipelined", workload, compile[1]);
+
+        std::fclose(workload.File);
+    }
+
+    std::vector<uint64_t> ParseList(const std::string& list)
+    {
+        std::vector<uint64_t> values;
+        std::istringstream in{ list };
+        std::string item;
+
+        while (std::getline(in, item, ','))
+            values.push_back(std::strtoull(item.c_str(), nullptr, 10));
+
+        return values;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    optparse::OptionParser parser = optparse::OptionParser().description("MACRO11 compiler benchmarks");
+
+    parser.add_option("--sizes").help("comma separated program sizes in lines.").set_default("1000,10000,100000,1000000,10000000").dest("sizes");
+    parser.add_option("--repeat").type("int").help("runs per benchmark, the fastest one is reported.").set_default("3").dest("repeat");
+    parser.add_option("--label-density").type("double").help("share of lines that carry a label.").set_default("0.1").dest("label_density");
+    parser.add_option("--forward-ratio").type("double").help("share of label references that point forward.").set_default("0.5").dest("forward_ratio");
+    parser.add_option("--comment-ratio").type("double").help("share of lines that are comments.").set_default("0.1").dest("comment_ratio");
+    parser.add_option("--branch-ratio").type("double").help("share of instructions that branch.").set_default("0.15").dest("branch_ratio");
+    parser.add_option("--branch-distance").type("int").help("mean branch distance in lines.").set_default("16").dest("branch_distance");
+    const char* const distributions[] = { "uniform", "geometric" };
+    parser.add_option("--branch-distribution").choices(&distributions[0], &distributions[2]).help("distribution of branch distances.").set_default("geometric").dest("distribution");
+    parser.add_option("--mode-mix").help("weights of register, deferred, autoincrement, autodecrement, index, immediate, absolute and label operands.").set_default("8,2,2,2,2,3,1,1").dest("mode_mix");
+    parser.add_option("--seed").help("workload seed.").set_default("1").dest("seed");
+    parser.add_option("--gate").help("compile the regression corpus and compare it with a baseline file.").dest("gate");
+    parser.add_option("--write-baseline").help("compile the regression corpus and write a baseline file of this machine.").dest("write_baseline");
+    parser.add_option("--compiler").help("compiler the gate runs on the corpus.").set_default("./macro11").dest("compiler");
+    parser.add_option("--gate-repeat").type("int").help("runs per workload for the gate.").set_default("5").dest("gate_repeat");
+    parser.add_option("--time-tolerance").type("double").help("allowed relative slowdown for the gate.").set_default("0.15").dest("time_tolerance");
+    parser.add_option("--rss-tolerance").type("double").help("allowed relative peak RSS growth for the gate.").set_default("0.10").dest("rss_tolerance");
+    parser.add_option("--check-encoders").action("store_true").help("compare the encoder with the reference encoder on every opcode and operand form.").dest("check_encoders");
+    parser.add_option("--check-rom-fill").action("store_true").help("fill ROM with label references and check the address of every one.").dest("check_rom_fill");
+    parser.add_option("--check-pic").action("store_true").help("load an image built with --pic at two addresses and check every jump, call and branch of it.").dest("check_pic");
+    parser.add_option("--check-sources").action("store_true").help("compile small programs, from the file and from macro bodies, and check the words of every one.").dest("check_sources");
+    parser.add_option("--generate").help("write the workload of the first size to a file instead of running the benchmarks.").dest("generate");
+
+    const optparse::Values options = parser.parse_args(argc, argv);
+
+    if (options.is_set("check_encoders") || options.is_set("check_rom_fill") || options.is_set("check_pic") || options.is_set("check_sources"))
+    {
+        bool passed = true;
+        if (options.is_set("check_encoders"))
+            passed = EncoderCheck().Run(stdout) && passed;
+        if (options.is_set("check_rom_fill"))
+            passed = RomFillCheck().Run(stdout) && passed;
+        if (options.is_set("check_pic"))
+            passed = PicCheck().Run(stdout) && passed;
+        if (options.is_set("check_sources"))
+            passed = SourceCheck().Run(stdout) && passed;
+
+        return passed ? 0 : 1;
+    }
+
+    if (options.is_set("gate") || options.is_set("write_baseline"))
+    {
+        GateOptions gateOptions;
+        gateOptions.Compiler = options["compiler"];
+        gateOptions.Repeat = std::max(1, std::atoi(options["gate_repeat"].c_str()));
+        gateOptions.TimeTolerance = std::atof(options["time_tolerance"].c_str());
+        gateOptions.RssTolerance = std::atof(options["rss_tolerance"].c_str());
+
+        PerformanceGate gate(gateOptions);
+        gate.Measure();
+
+        if (options.is_set("write_baseline") && !gate.WriteBaseline(options["write_baseline"]))
+            return -1;
+
+        if (options.is_set("gate") && !gate.Check(options["gate"], stdout))
+            return 1;
+
+        return 0;
+    }
+
+    WorkloadOptions workload;
+    workload.LabelDensity = std::atof(options["label_density"].c_str());
+    workload.ForwardRatio = std::atof(options["forward_ratio"].c_str());
+    workload.CommentRatio = std::atof(options["comment_ratio"].c_str());
+    workload.BranchRatio = std::atof(options["branch_ratio"].c_str());
+    workload.BranchDistance = std::atoi(options["branch_distance"].c_str());
+    workload.Distribution = options["distribution"] == "uniform" ? BranchDistribution::Uniform : BranchDistribution::Geometric;
+    workload.Seed = std::strtoull(options["seed"].c_str(), nullptr, 10);
+
+    const std::vector<uint64_t> weights = ParseList(options["mode_mix"]);
+    for (size_t i = 0; i < weights.size() && i < static_cast<size_t>(OperandMode::Count); ++i)
+        workload.ModeWeights[i] = static_cast<unsigned int>(weights[i]);
+
+    const std::vector<uint64_t> sizes = ParseList(options["sizes"]);
+
+    if (options.is_set("generate"))
+    {
+        FILE* f = std::fopen(options["generate"].c_str(), "w");
+        if (!f)
+        {
+            std::fprintf(stderr, "can't open a file %s", options["generate"].c_str());
+            return -1;
+        }
+
+        workload.Lines = sizes.empty() ? workload.Lines : sizes[0];
+        WorkloadGenerator(workload).Generate(f);
+        std::fclose(f);
+
+        return 0;
+    }
+
+    std::printf("%-18s %10s %12s %12s %14s %10s\n", "benchmark", "lines", "bytes", "seconds", "lines/s", "MB/s");
+    for (const uint64_t size : sizes)
+    {
+        workload.Lines = size;
+        RunBenchmarks(workload, std::max(1, std::atoi(options["repeat"].c_str())));
+    }
+
+    return 0;
+}
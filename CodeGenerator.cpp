@@ -1,54 +1,156 @@
 #include "CodeGenerator.h"
 #include "Utils.h"
 #include "ErrorHandling.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <assert.h>
 
 namespace AST
 {
     namespace
     {
-        class FirstPass : public AstVisitor
+        // The second pass has one encoder per instruction shape, instantiated from templates and
+        // picked through a table. The first pass knows the shape of every command, so it stores
+        // the index into that table on the command, and encoding needs no decisions of its own.
+        enum class EncoderGroup : unsigned char
+        {
+            Opcode,
+            SingleOperand,
+            ShortBranch,
+            ShortJump,
+            LongBranch,
+            LongJump,
+            DoubleOperand,
+            OneAndHalf,
+        };
+
+        enum class OperandClass : unsigned char
+        {
+            Register,
+            Indexed,
+            Number,
+            Label,
+        };
+
+        // the key is the group in the high bits and the class of each operand in two bits each.
+        const unsigned int EncoderKeys = 8 << 4;
+
+        constexpr unsigned char GetEncoderKey(const EncoderGroup g, const OperandClass first = OperandClass::Register,
+                                              const OperandClass second = OperandClass::Register)
+        {
+            return static_cast<unsigned char>(static_cast<int>(g) << 4 | static_cast<int>(first) << 2 | static_cast<int>(second));
+        }
+
+        constexpr EncoderGroup GetEncoderGroup(const unsigned int key)
+        {
+            return static_cast<EncoderGroup>(key >> 4);
+        }
+
+        constexpr OperandClass GetFirstOperandClass(const unsigned int key)
+        {
+            return static_cast<OperandClass>(key >> 2 & 3);
+        }
+
+        constexpr OperandClass GetSecondOperandClass(const unsigned int key)
+        {
+            return static_cast<OperandClass>(key & 3);
+        }
+
+        OperandClass GetOperandClass(const OperandNode* node)
+        {
+            if (node->AddrType == AddressingType::Label)
+                return OperandClass::Label;
+
+            if (node->OpType == OperandType::Number)
+                return OperandClass::Number;
+
+            if (node->AddrType == AddressingType::Index || node->AddrType == AddressingType::IndexDeferred)
+                return OperandClass::Indexed;
+
+            return OperandClass::Register;
+        }
+
+        unsigned char GetJumpEncoderKey(const CommandNode* node)
+        {
+            const bool isBranch = node->Opcode != OPCODE_JMP;
+            if (node->Form == JumpForm::Short)
+                return GetEncoderKey(isBranch ? EncoderGroup::ShortBranch : EncoderGroup::ShortJump, OperandClass::Label);
+
+            const bool isConditional = isBranch && node->Opcode != OPCODE_BR;
+            return GetEncoderKey(isConditional ? EncoderGroup::LongBranch : EncoderGroup::LongJump, OperandClass::Label);
+        }
+
+        class FirstPass final : public AstVisitor
         {
         public:
-            FirstPass();
-            ~FirstPass();
+            FirstPass(const bool overlays, const bool relocatable);
 
             virtual void Visit(CommandNode* node) override;
             virtual void Visit(OneOperandCommandNode* node) override;
             virtual void Visit(DoubleOperandCommandNode* node) override;
+            virtual void Visit(DataNode* node) override;
+
+            void Layout();
 
-            ProgramNode* GetProgram();
+            inline unsigned int GetProgramSize() const;
+            inline unsigned int GetBssSize() const;
+            std::vector<SizeEntry> GetSizeBreakdown() const;
             inline const std::map<std::string, int>& GetLabelsTable() const;
+            inline const std::vector<unsigned int>& GetSegments() const;
+            inline const RelaxationStats& GetRelaxationStats() const;
 
         private:
+            void LayoutCommands();
+            void SplitSegments();
+            bool RelaxBranches();
+            size_t GetSegment(const int instructionNumber) const;
             void AddInstructionLabels(const CommandNode* node, const int instructionNumber);
             void AddLabel(const char* name, const int instructionNumber);
-            unsigned int GetOperandSize(const OperandNode* node, const InstructionGroup g);
+            unsigned int GetJumpSize(const CommandNode* node) const;
 
         private:
-            ProgramNode *              Program;
+            const bool                 Overlays;
+            const bool                 Relocatable;
             unsigned int               CurrentProgramSize;
+            unsigned int               StoredProgramSize;
             std::vector<CommandNode*>  Commands;
+            std::vector<unsigned int>  CommandSizes;
+            std::vector<size_t>        Jumps;
             std::map<std::string, int> LabelsTable;
+            // the word every segment starts at.
+            std::vector<unsigned int>  Segments;
             std::queue<Word>           AdditionalInstructionWords;
+            RelaxationStats            Relaxation;
         };
 
-        ProgramNode* FirstPass::GetProgram()
+        std::vector<SizeEntry> FirstPass::GetSizeBreakdown() const
         {
-            if (Commands.empty() == false)
+            // every word belongs to the closest label above it.
+            std::vector<SizeEntry> entries;
+
+            for (size_t i = 0; i < Commands.size(); ++i)
             {
-                CommandNode* n = Commands[0];
-                for (size_t i = 1; i < Commands.size(); ++i)
-                {
-                    n->Next = Commands[i];
-                    n = n->Next;
-                }
+                const LabelNode* label = Commands[i]->Labels;
+                if (label != nullptr || entries.empty())
+                    entries.push_back(SizeEntry{ label != nullptr ? label->Name : "$entry", 0, 0 });
 
-                Program->Commands = Commands[0];
+                entries.back().Words += CommandSizes[i];
+                entries.back().Instructions += 1;
             }
 
-            return Program;
+            return entries;
+        }
+
+        unsigned int FirstPass::GetProgramSize() const
+        {
+            return CurrentProgramSize;
+        }
+
+        unsigned int FirstPass::GetBssSize() const
+        {
+            return CurrentProgramSize - StoredProgramSize;
         }
 
         const std::map<std::string, int>& FirstPass::GetLabelsTable() const
@@ -56,16 +158,22 @@ namespace AST
             return LabelsTable;
         }
 
+        const std::vector<unsigned int>& FirstPass::GetSegments() const
+        {
+            return Segments;
+        }
 
-        FirstPass::FirstPass()
-            : Program(new ProgramNode(nullptr))
-            , CurrentProgramSize(0)
+        const RelaxationStats& FirstPass::GetRelaxationStats() const
         {
+            return Relaxation;
         }
 
-        FirstPass::~FirstPass()
+        FirstPass::FirstPass(const bool overlays, const bool relocatable)
+            : Overlays(overlays)
+            , Relocatable(relocatable)
+            , CurrentProgramSize(0)
+            , StoredProgramSize(0)
         {
-            delete Program;
         }
 
         void FirstPass::AddInstructionLabels(const CommandNode* node, const int instructionNumber)
@@ -82,221 +190,1013 @@ namespace AST
 
         void FirstPass::Visit(CommandNode* node)
         {
-            const int instructionNumber = CurrentProgramSize++;
-            
-            AddInstructionLabels(node, instructionNumber);
-            
+            node->SetEncoderKey(GetEncoderKey(EncoderGroup::Opcode));
+
             Commands.push_back(node);
+            CommandSizes.push_back(1);
         }
 
         void FirstPass::Visit(OneOperandCommandNode* node)
         {
-            const int instructionNumber = CurrentProgramSize;
             const InstructionGroup g = GetInstructionGroup(node->Opcode);
+            // a jump to an expression has no label to relax towards and is encoded like any other operand.
+            const bool isJump = node->First->AddrType == AddressingType::Label && node->First->LabelName != nullptr
+                                && (g == InstructionGroup::Branch || node->Opcode == OPCODE_JMP);
 
-            CurrentProgramSize += 1 + GetOperandSize(node->First, g);
+            if (isJump)
+            {
+                // every jump starts in the short form and is only ever lengthened by RelaxBranches,
+                // so the layout grows monotonically and the relaxation always converges.
+                node->SetJumpForm(JumpForm::Short);
+                node->SetEncoderKey(GetJumpEncoderKey(node));
+                Jumps.push_back(Commands.size());
+            }
+            else
+            {
+                node->SetEncoderKey(GetEncoderKey(EncoderGroup::SingleOperand, GetOperandClass(node->First)));
+            }
 
             Commands.push_back(node);
-            AddInstructionLabels(node, instructionNumber);
+            CommandSizes.push_back(isJump ? GetJumpSize(node) : 1 + GetOperandSize(node->First, g));
         }
 
         void FirstPass::Visit(DoubleOperandCommandNode* node)
         {
-            const unsigned int instructionNumber = CurrentProgramSize;
             const InstructionGroup g = GetInstructionGroup(node->Opcode);
+            const EncoderGroup encoder = g == InstructionGroup::OneAndHalf ? EncoderGroup::OneAndHalf : EncoderGroup::DoubleOperand;
+            node->SetEncoderKey(GetEncoderKey(encoder, GetOperandClass(node->First), GetOperandClass(node->Second)));
 
-            CurrentProgramSize += 1 + GetOperandSize(node->First, g) + GetOperandSize(node->Second, g);
+            Commands.push_back(node);
+            CommandSizes.push_back(1 + GetOperandSize(node->First, g) + GetOperandSize(node->Second, g));
+        }
 
+        void FirstPass::Visit(DataNode* node)
+        {
             Commands.push_back(node);
-            AddInstructionLabels(node, instructionNumber);
+            CommandSizes.push_back(node->GetWords());
         }
 
-        unsigned int FirstPass::GetOperandSize(const OperandNode* node, const InstructionGroup g)
+        void FirstPass::Layout()
         {
-            unsigned int size = 0;
+            do
+            {
+                LayoutCommands();
+                SplitSegments();
+            } while (RelaxBranches());
 
-            if (   node->OpType   == OperandType::Number
-                || node->AddrType == AddressingType::Index
-                || node->AddrType == AddressingType::IndexDeferred
-                || (node->AddrType == AddressingType::Label && g != InstructionGroup::Branch)
-               )
+            for (const size_t i : Jumps)
             {
-                size = 1;
+                const CommandNode* node = Commands[i];
+                if (node->Opcode == OPCODE_JMP && node->Form == JumpForm::Short)
+                    ++Relaxation.Shortened;
+                else if (node->Opcode != OPCODE_JMP && node->Form == JumpForm::Long)
+                    ++Relaxation.Lengthened;
             }
-            else
+        }
+
+        void FirstPass::LayoutCommands()
+        {
+            CurrentProgramSize = 0;
+            StoredProgramSize = 0;
+            LabelsTable.clear();
+
+            for (size_t i = 0; i < Commands.size(); ++i)
+            {
+                const int instructionNumber = CurrentProgramSize;
+
+                Commands[i]->SetInstructionNumber(instructionNumber);
+                AddInstructionLabels(Commands[i], instructionNumber);
+                CurrentProgramSize += CommandSizes[i];
+
+                // the program is stored up to the last word that isn't only reserved.
+                const unsigned int stored = Commands[i]->Kind == CommandKind::Data ? static_cast<DataNode*>(Commands[i])->GetStoredWords() : CommandSizes[i];
+                if (stored != 0)
+                    StoredProgramSize = instructionNumber + stored;
+            }
+        }
+
+        void FirstPass::SplitSegments()
+        {
+            Segments.assign(1, 0);
+            if (Overlays == false)
+                return;
+
+            // a segment is ended before the last label in it, so a routine is only split when it
+            // doesn't fit into a segment on its own. A command is never split.
+            const unsigned int segmentWords = static_cast<unsigned int>(GetROMSize() / sizeof(Word));
+            size_t first = 0;
+            size_t labelled = 0;
+
+            for (size_t i = 0; i < Commands.size(); ++i)
+            {
+                // a labelled command starts a routine of its own, so it's the one moved on.
+                if (Commands[i]->Labels != nullptr)
+                    labelled = i;
+
+                while (i > first && Commands[i]->InstructionNumber + CommandSizes[i] - Segments.back() > segmentWords)
+                {
+                    first = labelled > first && Commands[labelled]->InstructionNumber > static_cast<int>(Segments.back()) ? labelled : i;
+                    labelled = first;
+                    Segments.push_back(Commands[first]->InstructionNumber);
+                }
+            }
+        }
+
+        size_t FirstPass::GetSegment(const int instructionNumber) const
+        {
+            return std::upper_bound(Segments.begin(), Segments.end(), static_cast<unsigned int>(instructionNumber)) - Segments.begin() - 1;
+        }
+
+        bool FirstPass::RelaxBranches()
+        {
+            bool changed = false;
+
+            for (const size_t i : Jumps)
             {
-                size = 0;
+                CommandNode* node = Commands[i];
+                if (node->Form == JumpForm::Long)
+                    continue;
+
+                const OneOperandCommandNode* jump = static_cast<const OneOperandCommandNode*>(node);
+                int target = 0;
+                if (jump->First->Target != nullptr)
+                {
+                    target = jump->First->Target->InstructionNumber;
+                }
+                else
+                {
+                    auto it = LabelsTable.find(jump->First->LabelName);
+                    if (it == LabelsTable.end())
+                    {
+                        // a label of another module is only known to the linker, so it's reached by a long jump.
+                        if (Relocatable)
+                        {
+                            node->SetJumpForm(JumpForm::Long);
+                            node->SetEncoderKey(GetJumpEncoderKey(node));
+                            CommandSizes[i] = GetJumpSize(node);
+                            changed = true;
+                        }
+                        continue;
+                    }
+
+                    target = it->second;
+                }
+
+                // a short branch can't leave its segment, which is mapped on its own.
+                const int offset = target - node->InstructionNumber - 1;
+                if (offset < -128 || offset > 127 || GetSegment(target) != GetSegment(node->InstructionNumber))
+                {
+                    node->SetJumpForm(JumpForm::Long);
+                    node->SetEncoderKey(GetJumpEncoderKey(node));
+                    CommandSizes[i] = GetJumpSize(node);
+                    changed = true;
+                }
             }
 
-            return size;
+            return changed;
+        }
+
+        unsigned int FirstPass::GetJumpSize(const CommandNode* node) const
+        {
+            if (node->Form == JumpForm::Short)
+                return 1;
+
+            // JMP (PC)+ with the target address, preceded by an inverted branch over it for conditional branches.
+            const bool isConditional = node->Opcode != OPCODE_BR && node->Opcode != OPCODE_JMP;
+            return isConditional ? 3 : 2;
         }
 
-        class SecondPass : public AstVisitor
+        // an instruction has at most two extension words, one per operand.
+        struct ExtensionWords
+        {
+            Word         Words[2];
+            unsigned int Count = 0;
+
+            void Push(const Word w)
+            {
+                assert(Count < 2);
+                Words[Count++] = w;
+            }
+        };
+
+        class SecondPass final : public AstVisitor
         {
         public:
-            SecondPass(const std::map<std::string, int>& labelsTable, std::vector<Error>& errors);
+            SecondPass(const std::map<std::string, int>& labelsTable, const std::vector<unsigned int>& segments, const unsigned int programSize,
+                       const CodeGeneratorOptions& options, std::vector<Error>& errors, const Variant* variant = nullptr);
 
+            virtual void Visit(ProgramNode* node) override;
             virtual void Visit(CommandNode* node) override;
             virtual void Visit(OneOperandCommandNode* node) override;
             virtual void Visit(DoubleOperandCommandNode* node) override;
+            virtual void Visit(DataNode* node) override;
 
-            inline const std::vector<Word>&& GetProgram() const;
+            inline std::vector<Word> TakeProgram();
+            // the exports, imports and relocations of a relocatable program.
+            void TakeLinkage(ObjectFile* object);
             inline const std::vector<Error>& GetErrors() const;
+            // the program node of the walk, so the other variants can walk the same tree.
+            inline ProgramNode* GetProgramNode() const;
 
         private:
-            Word GetRawOperand(const OperandNode* node, std::vector<Word>* additionalWords) const;
-            Word GetRawLabel(const std::string& labelName, CommandNode* node) const;
-            Word ConstructLabelOperand(const Word rawLabel, std::vector<Word>* additionalWords) const;
-            Word ConstructDoubleOperand(const OperandNode* opNode, std::vector<Word>* additionalWords, DoubleOperandCommandNode* node) const;
+            typedef void (SecondPass::*Encoder)(CommandNode* node);
+
+            // what a fixup of a relocatable program depends on besides constants.
+            struct FixupLinkage
+            {
+                int  Import = -1;
+                bool Moves  = false;
+            };
+
+            // a fixup that refers to an import is evaluated with the import at 0, at a word, and
+            // with the module moved by a word.
+            struct ImportProbes
+            {
+                std::unique_ptr<ExpressionEvaluator> Value;
+                std::unique_ptr<ExpressionEvaluator> Shifted;
+                std::unique_ptr<ExpressionEvaluator> Moved;
+            };
+
+            template <bool Pic, unsigned int Key>
+            struct EncoderTable;
+
+            template <bool Pic>
+            static const Encoder* GetEncoders();
+
+            inline void Emit(const Word w);
+            void Emit(const Word raw, const ExtensionWords& additionalWords);
+
+            template <bool Pic, unsigned int Key>
+            void Encode(CommandNode* node);
+
+            template <bool Pic, EncoderGroup G>
+            void EncodeJump(OneOperandCommandNode* node);
+
+            template <bool Pic, OperandClass C, bool Masked>
+            Word EncodeOperand(const OperandNode* opNode, CommandNode* node, const unsigned int instructionNumber, ExtensionWords* additionalWords) const;
+
+            template <bool Pic>
+            Word ConstructLabelOperand(const Word address, const unsigned int instructionNumber, ExtensionWords* additionalWords,
+                                       const bool moves = true, const int import = -1) const;
+
+            Word GetRawLabel(const OperandNode* opNode, CommandNode* node, int* import = nullptr) const;
+            void CheckSegment(const Word rawLabel, const OperandNode* opNode, CommandNode* node) const;
+            Word GetFixupValue(const int fixup, CommandNode* node, FixupLinkage* linkage = nullptr) const;
+            bool MovesWithModule(ExpressionEvaluator& probe, const int fixup, const int value, CommandNode* node) const;
+            ExpressionEvaluator* MakeProbe(const int moved, const int import, const int importAddress) const;
+            void Relocate(const unsigned int byteOffset, const int import, const int baseFactor) const;
+            inline Word GetAddress(const unsigned int wordNumber) const;
+            inline size_t GetSegment(const unsigned int wordNumber) const;
+
         private:
-            const std::map<std::string, int>& LabelsTable;
-            std::vector<Word> Program;
-            std::vector<Error>& Errors;
+            const std::map<std::string, int>&    LabelsTable;
+            const std::vector<unsigned int>&     Segments;
+            const Variant*                       EncodedVariant;
+            ProgramNode*                         Node;
+            std::unique_ptr<ExpressionEvaluator> Expressions;
+            const Encoder*                       Encoders;
+            const bool                           Relocatable;
+            // evaluates the fixups with the module moved by a word, to tell which of them move with it.
+            std::unique_ptr<ExpressionEvaluator> Probe;
+            mutable std::vector<ImportProbes>    ImportEvaluators;
+            std::map<std::string, int>           Imports;
+            std::vector<std::string>             ImportNames;
+            std::vector<ExportedSymbol>          Exports;
+            mutable std::vector<Relocation>      Relocations;
+            std::vector<Word>                 Program;
+            unsigned int                      Position;
+            std::vector<Error>&               Errors;
+        };
+
+        // fills the table from Key down to 0 with the encoder of every key.
+        template <bool Pic, unsigned int Key>
+        struct SecondPass::EncoderTable
+        {
+            static void Fill(Encoder* table)
+            {
+                table[Key] = &SecondPass::Encode<Pic, Key>;
+                EncoderTable<Pic, Key - 1>::Fill(table);
+            }
+        };
+
+        template <bool Pic>
+        struct SecondPass::EncoderTable<Pic, 0>
+        {
+            static void Fill(Encoder* table)
+            {
+                table[0] = &SecondPass::Encode<Pic, 0>;
+            }
         };
 
-        const std::vector<Word>&& SecondPass::GetProgram() const
+        template <bool Pic>
+        const SecondPass::Encoder* SecondPass::GetEncoders()
         {
+            static Encoder table[EncoderKeys];
+            static const bool filled = (EncoderTable<Pic, EncoderKeys - 1>::Fill(table), true);
+            (void)filled;
+
+            return table;
+        }
+
+        std::vector<Word> SecondPass::TakeProgram()
+        {
+            // the first pass layout and the emitted words must agree, or labels point to the wrong words.
+            assert(Position == Program.size());
             return std::move(Program);
         }
 
+        void SecondPass::TakeLinkage(ObjectFile* object)
+        {
+            object->Exports = std::move(Exports);
+            object->Imports = std::move(ImportNames);
+            object->Relocations = std::move(Relocations);
+        }
+
+        void SecondPass::Emit(const Word w)
+        {
+            assert(Position < Program.size());
+            Program[Position++] = w;
+        }
+
+        void SecondPass::Emit(const Word raw, const ExtensionWords& additionalWords)
+        {
+            Emit(raw);
+            for (unsigned int i = 0; i < additionalWords.Count; ++i)
+                Emit(additionalWords.Words[i]);
+        }
+
         const std::vector<Error>& SecondPass::GetErrors() const
         {
             return Errors;
         }
 
-        SecondPass::SecondPass(const std::map<std::string, int>& labelsTable, std::vector<Error>& errors)
+        ProgramNode* SecondPass::GetProgramNode() const
+        {
+            return Node;
+        }
+
+        SecondPass::SecondPass(const std::map<std::string, int>& labelsTable, const std::vector<unsigned int>& segments, const unsigned int programSize,
+                               const CodeGeneratorOptions& options, std::vector<Error>& errors, const Variant* variant)
             : LabelsTable(labelsTable)
+            , Segments(segments)
+            , EncodedVariant(variant)
+            , Node(nullptr)
+            , Encoders(options.PositionIndependent ? GetEncoders<true>() : GetEncoders<false>())
+            , Relocatable(options.Relocatable)
+            , Program(programSize)
+            , Position(0)
             , Errors(errors)
         {
         }
 
-        Word SecondPass::GetRawOperand(const OperandNode* node, std::vector<Word>* additionalWords) const
+        Word SecondPass::GetAddress(const unsigned int wordNumber) const
         {
-            Word op = 0;
+            // every segment is mapped at the start of ROM.
+            const unsigned int begin = Segments.size() > 1 ? Segments[GetSegment(wordNumber)] : 0;
+            return static_cast<Word>((wordNumber - begin) * sizeof(Word) + GetROMBegining());
+        }
 
-            if (node->OpType == OperandType::Number)
+        size_t SecondPass::GetSegment(const unsigned int wordNumber) const
+        {
+            return std::upper_bound(Segments.begin(), Segments.end(), wordNumber) - Segments.begin() - 1;
+        }
+
+        void SecondPass::Visit(ProgramNode* node)
+        {
+            Node = node;
+
+            // labels evaluate to their address in ROM, the symbols of a variant to their value.
+            auto addressOf = [this](const std::string& label, int* address)
             {
-                additionalWords->push_back(node->Value);
-                op = RegisterNumber::PC;
+                if (EncodedVariant != nullptr)
+                {
+                    auto symbol = EncodedVariant->Symbols.find(label);
+                    if (symbol != EncodedVariant->Symbols.end())
+                    {
+                        *address = symbol->second;
+                        return true;
+                    }
+                }
+
+                auto it = LabelsTable.find(label);
+                if (it == LabelsTable.end())
+                    return false;
+
+                *address = GetAddress(it->second);
+                return true;
+            };
+
+            // the parser resolved local labels in expressions to the commands they label.
+            auto addressOfCommand = [this](const CommandNode* command)
+            {
+                return static_cast<int>(GetAddress(command->InstructionNumber));
+            };
+
+            Expressions.reset(new ExpressionEvaluator{ node->Expressions, addressOf, addressOfCommand });
+
+            if (Relocatable == false)
+                return;
+
+            // a .GLOBL label the module defines is exported, any other one is imported.
+            for (const std::string& name : node->Globals)
+            {
+                auto it = LabelsTable.find(name);
+                if (it != LabelsTable.end())
+                {
+                    Exports.push_back(ExportedSymbol{ name, static_cast<uint32_t>(it->second) });
+                }
+                else if (Imports.count(name) == 0)
+                {
+                    Imports[name] = static_cast<int>(ImportNames.size());
+                    ImportNames.push_back(name);
+                }
             }
-            else
+
+            Probe.reset(MakeProbe(sizeof(Word), -1, 0));
+            ImportEvaluators.resize(ImportNames.size());
+        }
+
+        ExpressionEvaluator* SecondPass::MakeProbe(const int moved, const int import, const int importAddress) const
+        {
+            // the labels of the module are moved by `moved` bytes, the import, if any, is at importAddress.
+            auto addressOf = [this, moved, import, importAddress](const std::string& label, int* address)
+            {
+                auto it = LabelsTable.find(label);
+                if (it != LabelsTable.end())
+                {
+                    *address = GetAddress(it->second) + moved;
+                    return true;
+                }
+
+                if (import < 0 || label != ImportNames[import])
+                    return false;
+
+                *address = importAddress;
+                return true;
+            };
+
+            auto addressOfCommand = [this, moved](const CommandNode* command)
+            {
+                return GetAddress(command->InstructionNumber) + moved;
+            };
+
+            return new ExpressionEvaluator{ Node->Expressions, addressOf, addressOfCommand };
+        }
+
+        Word SecondPass::GetFixupValue(const int fixup, CommandNode* node, FixupLinkage* linkage) const
+        {
+            int value = 0;
+            std::string error;
+            if (Expressions->Evaluate(fixup, &value, &error))
             {
-                if (node->AddrType == AddressingType::Index || node->AddrType == AddressingType::IndexDeferred)
-                    additionalWords->push_back(node->IndexedOffset);
+                if (Relocatable && linkage != nullptr)
+                    linkage->Moves = MovesWithModule(*Probe, fixup, value, node);
 
-                op = node->Value;
+                return static_cast<Word>(value);
             }
 
-            op |= (static_cast<int>(node->AddrType) << 3);
-            return op;
+            // a fixup of a relocatable program may refer to one import, which is 0 until it's linked.
+            // The probes of an import are only built once a fixup needs them.
+            for (size_t i = 0; Relocatable && linkage != nullptr && i < ImportNames.size(); ++i)
+            {
+                ImportProbes& probes = ImportEvaluators[i];
+                if (probes.Value == nullptr)
+                {
+                    probes.Value.reset(MakeProbe(0, static_cast<int>(i), 0));
+                    probes.Shifted.reset(MakeProbe(0, static_cast<int>(i), sizeof(Word)));
+                    probes.Moved.reset(MakeProbe(sizeof(Word), static_cast<int>(i), 0));
+                }
+
+                int shifted = 0;
+                std::string ignored;
+                if (probes.Value->Evaluate(fixup, &value, &ignored) == false)
+                    continue;
+
+                probes.Shifted->Evaluate(fixup, &shifted, &ignored);
+                if (shifted - value != static_cast<int>(sizeof(Word)))
+                    Errors.push_back(Error{ node->Location, MessageId::ExpressionNotRelocatable });
+
+                linkage->Import = static_cast<int>(i);
+                linkage->Moves = MovesWithModule(*probes.Moved, fixup, value, node);
+                return static_cast<Word>(value);
+            }
+
+            Errors.push_back(Error{ node->Location, MessageId::ExpressionError, { error } });
+            return static_cast<Word>(value);
         }
 
-        Word SecondPass::GetRawLabel(const std::string& labelName, CommandNode* node) const
+        bool SecondPass::MovesWithModule(ExpressionEvaluator& probe, const int fixup, const int value, CommandNode* node) const
         {
-            auto it = LabelsTable.find(labelName);
+            // an address of the module follows it by exactly the word the probe moved it by, a
+            // constant doesn't move at all.
+            int moved = 0;
+            std::string error;
+            probe.Evaluate(fixup, &moved, &error);
+
+            if (moved != value && moved - value != static_cast<int>(sizeof(Word)))
+                Errors.push_back(Error{ node->Location, MessageId::ExpressionNotRelocatable });
+
+            return moved - value == static_cast<int>(sizeof(Word));
+        }
+
+        void SecondPass::Relocate(const unsigned int byteOffset, const int import, const int baseFactor) const
+        {
+            if (Relocatable && (import >= 0 || baseFactor != 0))
+                Relocations.push_back(Relocation{ byteOffset, import, static_cast<int8_t>(baseFactor) });
+        }
+
+        Word SecondPass::GetRawLabel(const OperandNode* opNode, CommandNode* node, int* import) const
+        {
+            if (import != nullptr)
+                *import = -1;
+
+            // the parser resolved a local label to the command it labels.
+            if (opNode->Target != nullptr)
+                return static_cast<Word>(opNode->Target->InstructionNumber);
+
+            auto it = LabelsTable.find(opNode->LabelName);
             if (it != LabelsTable.end())
             {
-                return static_cast<uint8_t>(it->second);
+                return static_cast<Word>(it->second);
+            }
+
+            auto imported = Imports.find(opNode->LabelName);
+            if (import != nullptr && imported != Imports.end())
+            {
+                *import = imported->second;
+                return 0;
             }
             else
             {
-                Errors.push_back(Error{ node, std::string("Label doesn't exist:") + labelName });
+                Errors.push_back(Error{ node->Location, MessageId::UndefinedLabel, { opNode->LabelName } });
                 return 0;
             }
         }
 
-        Word SecondPass::ConstructLabelOperand(const Word rawLabel, std::vector<Word>* additionalWords) const
+        void SecondPass::CheckSegment(const Word rawLabel, const OperandNode* opNode, CommandNode* node) const
+        {
+            // only one segment is mapped at a time, at the start of ROM, so a label of another
+            // segment has an address that holds its words only once that segment is mapped.
+            if (Segments.size() <= 1)
+                return;
+
+            const size_t target = GetSegment(rawLabel);
+            if (target != GetSegment(node->InstructionNumber))
+                Errors.push_back(Error{ node->Location, MessageId::CrossSegmentReference, { opNode->LabelName, std::to_string(target) } });
+        }
+
+        template <bool Pic>
+        Word SecondPass::ConstructLabelOperand(const Word address, const unsigned int instructionNumber, ExtensionWords* additionalWords,
+                                               const bool moves, const int import) const
         {
             Word op = RegisterNumber::PC;
-            op |= (static_cast<int>(AddressingType::AutoIncrement) << 3);
-            additionalWords->push_back(rawLabel * sizeof(Word) + GetROMBegining());
+
+            // a displacement to an address of the module doesn't change when the module moves.
+            const unsigned int word = instructionNumber + 1 + additionalWords->Count;
+            Relocate(word * sizeof(Word), import, (moves ? 1 : 0) - (Pic ? 1 : 0));
+
+            if (Pic)
+            {
+                // X(PC): the displacement is relative to the word following this extension word.
+                const Word pc = GetAddress(instructionNumber + 1 + additionalWords->Count) + sizeof(Word);
+                op |= (static_cast<int>(AddressingType::Index) << 3);
+                additionalWords->Push(address - pc);
+            }
+            else
+            {
+                op |= (static_cast<int>(AddressingType::AutoIncrement) << 3);
+                additionalWords->Push(address);
+            }
 
             return op;
         }
 
-        Word SecondPass::ConstructDoubleOperand(const OperandNode* opNode, std::vector<Word>* additionalWords, DoubleOperandCommandNode* node) const
+        template <bool Pic, OperandClass C, bool Masked>
+        Word SecondPass::EncodeOperand(const OperandNode* opNode, CommandNode* node, const unsigned int instructionNumber, ExtensionWords* additionalWords) const
         {
             Word op = 0;
-            if (opNode->AddrType == AddressingType::Label)
+
+            // C is a constant, so every instantiation keeps one case of the switch.
+            switch (C)
             {
-                const Word rawLabel = GetRawLabel(opNode->LabelName, node);
-                op = ConstructLabelOperand(rawLabel, additionalWords);
+            case OperandClass::Register:
+                op = opNode->Value;
+                break;
+
+            case OperandClass::Indexed:
+                if (opNode->Fixup < 0)
+                {
+                    additionalWords->Push(opNode->IndexedOffset);
+                }
+                else
+                {
+                    FixupLinkage linkage;
+                    const Word offset = GetFixupValue(opNode->Fixup, node, &linkage);
+                    Relocate((instructionNumber + 1 + additionalWords->Count) * sizeof(Word), linkage.Import, linkage.Moves ? 1 : 0);
+                    additionalWords->Push(offset);
+                }
+                op = opNode->Value;
+                break;
+
+            case OperandClass::Number:
+                if (opNode->Fixup < 0)
+                {
+                    additionalWords->Push(opNode->Value);
+                }
+                else if (opNode->AddrType == AddressingType::IndexDeferred)
+                {
+                    // @EXPR of an address refers to it relative to PC, like a label operand does.
+                    FixupLinkage linkage;
+                    const unsigned int word = instructionNumber + 1 + additionalWords->Count;
+                    const Word pc = GetAddress(word) + sizeof(Word);
+                    const Word address = GetFixupValue(opNode->Fixup, node, &linkage);
+                    Relocate(word * sizeof(Word), linkage.Import, (linkage.Moves ? 1 : 0) - 1);
+                    additionalWords->Push(address - pc);
+                }
+                else
+                {
+                    FixupLinkage linkage;
+                    const Word value = GetFixupValue(opNode->Fixup, node, &linkage);
+                    Relocate((instructionNumber + 1 + additionalWords->Count) * sizeof(Word), linkage.Import, linkage.Moves ? 1 : 0);
+                    additionalWords->Push(value);
+                }
+                op = RegisterNumber::PC;
+                break;
+
+            case OperandClass::Label:
+            {
+                // X(PC) refers to the word at the label where (PC)+ holds its address; only an operand
+                // that is jumped to means the same in both.
+                if (Pic && TransfersToOperand(node->Opcode) == false)
+                    Errors.push_back(Error{ node->Location, MessageId::PicLabelOperand, { opNode->LabelName != nullptr ? opNode->LabelName : "an expression" } });
+
+                // the register field of a label operand is PC, so the OneAndHalf mask doesn't apply.
+                if (opNode->Fixup >= 0)
+                {
+                    FixupLinkage linkage;
+                    const Word address = GetFixupValue(opNode->Fixup, node, &linkage);
+                    return ConstructLabelOperand<Pic>(address, instructionNumber, additionalWords, linkage.Moves, linkage.Import);
+                }
+
+                // an imported label is 0 until the linker adds its address.
+                int import = -1;
+                const Word rawLabel = GetRawLabel(opNode, node, &import);
+                if (import < 0)
+                    CheckSegment(rawLabel, opNode, node);
+
+                const Word address = import < 0 ? GetAddress(rawLabel) : 0;
+                return ConstructLabelOperand<Pic>(address, instructionNumber, additionalWords, import < 0, import);
             }
-            else
+            }
+
+            op |= (static_cast<int>(opNode->AddrType) << 3);
+            return Masked ? op & 07 : op;
+        }
+
+        template <bool Pic, EncoderGroup G>
+        void SecondPass::EncodeJump(OneOperandCommandNode* node)
+        {
+            ExtensionWords additionalWords;
+            int import = -1;
+            const Word rawLabel = GetRawLabel(node->First, node, &import);
+
+            if (G == EncoderGroup::ShortBranch || G == EncoderGroup::ShortJump)
             {
-                InstructionGroup g = GetInstructionGroup(node->Opcode);
-                op = g == InstructionGroup::OneAndHalf ? GetRawOperand(opNode, additionalWords) & 07 : GetRawOperand(opNode, additionalWords);
+                const Byte offset = static_cast<Byte>(rawLabel - Position) - 1;
+                Emit((G == EncoderGroup::ShortBranch ? node->Opcode : OPCODE_BR) | offset);
+                return;
             }
 
-            return op;
+            // JMP (PC)+ with the target address, preceded by an inverted branch over it for conditional branches.
+            if (import < 0)
+                CheckSegment(rawLabel, node->First, node);
+
+            if (G == EncoderGroup::LongBranch)
+                Emit(GetInvertedBranchOpcode(node->Opcode) | 2);
+
+            const Word address = import < 0 ? GetAddress(rawLabel) : 0;
+            const Word raw = OPCODE_JMP | ConstructLabelOperand<Pic>(address, Position, &additionalWords, import < 0, import);
+            Emit(raw, additionalWords);
+        }
+
+        template <bool Pic, unsigned int Key>
+        void SecondPass::Encode(CommandNode* node)
+        {
+            constexpr EncoderGroup G = GetEncoderGroup(Key);
+            constexpr OperandClass FirstClass = GetFirstOperandClass(Key);
+            constexpr OperandClass SecondClass = GetSecondOperandClass(Key);
+
+            switch (G)
+            {
+            case EncoderGroup::Opcode:
+                Emit(node->Opcode);
+                break;
+
+            case EncoderGroup::SingleOperand:
+            {
+                const OneOperandCommandNode* n = static_cast<const OneOperandCommandNode*>(node);
+                ExtensionWords additionalWords;
+
+                const Word raw = node->Opcode | EncodeOperand<Pic, FirstClass, false>(n->First, node, Position, &additionalWords);
+                Emit(raw, additionalWords);
+                break;
+            }
+
+            case EncoderGroup::ShortBranch:
+            case EncoderGroup::ShortJump:
+            case EncoderGroup::LongBranch:
+            case EncoderGroup::LongJump:
+                EncodeJump<Pic, G>(static_cast<OneOperandCommandNode*>(node));
+                break;
+
+            case EncoderGroup::DoubleOperand:
+            case EncoderGroup::OneAndHalf:
+            {
+                const DoubleOperandCommandNode* n = static_cast<const DoubleOperandCommandNode*>(node);
+                constexpr bool masked = G == EncoderGroup::OneAndHalf;
+                ExtensionWords additionalWords;
+
+                // the second operand goes into bits 11-6 and takes the first extension word.
+                Word raw = node->Opcode;
+                raw |= EncodeOperand<Pic, SecondClass, masked>(n->Second, node, Position, &additionalWords) << 6;
+                raw |= EncodeOperand<Pic, FirstClass, masked>(n->First, node, Position, &additionalWords);
+
+                Emit(raw, additionalWords);
+                break;
+            }
+            }
         }
 
         void SecondPass::Visit(CommandNode* node)
         {
-            Program.push_back(node->Opcode);
+            (this->*Encoders[node->EncoderKey])(node);
         }
 
         void SecondPass::Visit(OneOperandCommandNode* node)
         {
-            std::vector<Word> additionalWords;
-            const unsigned int instructionNumber = Program.size();
-            Word raw = node->Opcode;
+            (this->*Encoders[node->EncoderKey])(node);
+        }
+
+        void SecondPass::Visit(DoubleOperandCommandNode* node)
+        {
+            (this->*Encoders[node->EncoderKey])(node);
+        }
+
+        void SecondPass::Visit(DataNode* node)
+        {
+            assert(Position + node->GetWords() <= Program.size());
 
-            const OperandNode* first = node->First;
-            if (first->AddrType == AddressingType::Label)
+            // the words are zero already, so reserved space is left as it is.
+            Byte* data = reinterpret_cast<Byte*>(Program.data() + Position);
+            if (node->Bytes.empty() == false)
+                std::memcpy(data, node->Bytes.data(), node->Bytes.size());
+
+            for (const DataNode::DataFixup& f : node->Fixups)
             {
-                const Word rawLabel = GetRawLabel(first->LabelName, node);
-                
-                if (GetInstructionGroup(node->Opcode) == InstructionGroup::Branch)
-                {
-                    const Byte offset = static_cast<Byte>(rawLabel - instructionNumber) - 1;
-                    raw |= offset;
-                }
+                FixupLinkage linkage;
+                const Word value = GetFixupValue(f.Fixup, node, &linkage);
+                if (f.IsByte && (linkage.Import >= 0 || linkage.Moves))
+                    Errors.push_back(Error{ node->Location, MessageId::ByteNotRelocatable });
                 else
+                    Relocate(Position * sizeof(Word) + f.Offset, linkage.Import, linkage.Moves ? 1 : 0);
+
+                data[f.Offset] = static_cast<Byte>(value);
+                if (f.IsByte == false)
+                    data[f.Offset + 1] = static_cast<Byte>(value >> 8);
+            }
+
+            Position += node->GetWords();
+        }
+    }
+
+    namespace
+    {
+        class EliminationPass final : public TypedPass<UnreachableCodeEliminator>
+        {
+        public:
+            EliminationPass(const std::vector<std::string>& exportedLabels, EliminationStats& stats)
+                : TypedPass("unreachable code", CompilePhase::FirstPass)
+                , Eliminator(exportedLabels)
+                , Stats(stats)
+            {
+            }
+
+            virtual AstVisitor* Begin() override
+            {
+                return &Eliminator;
+            }
+
+            virtual bool End() override
+            {
+                Eliminator.Eliminate();
+                Stats = Eliminator.GetStats();
+                return true;
+            }
+
+        private:
+            UnreachableCodeEliminator Eliminator;
+            EliminationStats&         Stats;
+        };
+
+        class LayoutPass final : public TypedPass<FirstPass>
+        {
+        public:
+            LayoutPass(const CodeGeneratorOptions& options, RelaxationStats& relaxation, std::vector<SizeEntry>& sizeBreakdown,
+                       unsigned int& bssWords, std::vector<unsigned int>& segments, Instrumentation* instrumentation)
+                : TypedPass("first pass", CompilePhase::FirstPass)
+                , Layout(options.Overlays, options.Relocatable)
+                , Options(options)
+                , Relaxation(relaxation)
+                , SizeBreakdown(sizeBreakdown)
+                , BssWords(bssWords)
+                , Segments(segments)
+                , Instr(instrumentation)
+            {
+            }
+
+            virtual AstVisitor* Begin() override
+            {
+                return &Layout;
+            }
+
+            virtual bool End() override
+            {
+                Layout.Layout();
+                Relaxation = Layout.GetRelaxationStats();
+                BssWords = Layout.GetBssSize();
+                Segments = Layout.GetSegments();
+
+                if (Options.CollectSizeBreakdown)
+                    SizeBreakdown = Layout.GetSizeBreakdown();
+
+                if (Instr != nullptr)
                 {
-                    Word op = ConstructLabelOperand(rawLabel, &additionalWords);
-                    raw |= op;
+                    Instr->Counter("labels", Layout.GetLabelsTable().size());
+                    Instr->Counter("segments", Segments.size());
                 }
+
+                return true;
             }
-            else
+
+            inline const FirstPass& GetLayout() const
             {
-                const Word op = GetRawOperand(first, &additionalWords);
-                raw |= op;
+                return Layout;
             }
-            
-            Program.push_back(raw);
-            if(additionalWords.empty() == false)
-                Program.push_back(additionalWords[0]);
-        }
+
+        private:
+            FirstPass                   Layout;
+            const CodeGeneratorOptions& Options;
+            RelaxationStats&            Relaxation;
+            std::vector<SizeEntry>&     SizeBreakdown;
+            unsigned int&               BssWords;
+            std::vector<unsigned int>&  Segments;
+            Instrumentation*            Instr;
+        };
+
+        class EncodingPass final : public TypedPass<SecondPass>
+        {
+        public:
+            EncodingPass(const LayoutPass* layout, const CodeGeneratorOptions& options, std::vector<Error>& errors,
+                         std::vector<Word>& program, std::vector<std::vector<Word>>& programs, ObjectFile& object, Instrumentation* instrumentation)
+                : TypedPass("second pass", CompilePhase::SecondPass)
+                , Layout(layout)
+                , Options(options)
+                , Errors(errors)
+                , Program(program)
+                , Programs(programs)
+                , Object(object)
+                , Instr(instrumentation)
+            {
+                DependsOn(layout);
+            }
+
+            virtual AstVisitor* Begin() override
+            {
+                // the labels table and the program size are only known once the layout is done.
+                const FirstPass& fp = Layout->GetLayout();
+                const Variant* first = Options.Variants.empty() ? nullptr : &Options.Variants[0];
+
+                VariantErrors.assign(Options.Variants.size(), std::vector<Error>());
+                Encoder.reset(new SecondPass{ fp.GetLabelsTable(), fp.GetSegments(), fp.GetProgramSize(), Options, first ? VariantErrors[0] : Errors, first });
+                return Encoder.get();
+            }
+
+            virtual bool End() override
+            {
+                Program = Encoder->TakeProgram();
+                if (Options.Relocatable)
+                    Encoder->TakeLinkage(&Object);
+
+                if (Instr != nullptr)
+                    Instr->Counter("emitted words", Program.size() * std::max<size_t>(Options.Variants.size(), 1));
+
+                if (Options.Variants.empty() == false)
+                    EncodeVariants();
+
+                Encoder.reset();
+
+                return Errors.empty();
+            }
+
+        private:
+            void EncodeVariants()
+            {
+                // the first variant was encoded by the walk, the others walk the same tree at once;
+                // encoding only reads the tree and the layout.
+                const FirstPass& fp = Layout->GetLayout();
+                ProgramNode* program = Encoder->GetProgramNode();
+
+                Programs.assign(Options.Variants.size(), std::vector<Word>());
+                Programs[0] = std::move(Program);
+
+                std::vector<std::thread> threads;
+                for (size_t i = 1; i < Options.Variants.size(); ++i)
+                {
+                    threads.emplace_back([this, &fp, program, i]()
+                    {
+                        SecondPass encoder{ fp.GetLabelsTable(), fp.GetSegments(), fp.GetProgramSize(), Options, VariantErrors[i], &Options.Variants[i] };
+                        Traverse(program, encoder);
+                        Programs[i] = encoder.TakeProgram();
+                    });
+                }
+
+                for (std::thread& t : threads)
+                    t.join();
+
+                for (size_t i = 0; i < Options.Variants.size(); ++i)
+                {
+                    for (Error& e : VariantErrors[i])
+                    {
+                        e.Variant = Options.Variants[i].Name;
+                        Errors.push_back(std::move(e));
+                    }
+                }
+            }
+
+        private:
+            const LayoutPass*               Layout;
+            const CodeGeneratorOptions&     Options;
+            std::vector<Error>&             Errors;
+            std::vector<Word>&              Program;
+            std::vector<std::vector<Word>>& Programs;
+            ObjectFile&                     Object;
+            Instrumentation*                Instr;
+            std::unique_ptr<SecondPass>     Encoder;
+            std::vector<std::vector<Error>> VariantErrors;
+        };
     }
 
-    void SecondPass::Visit(DoubleOperandCommandNode* node)
+    CodeGenerator::CodeGenerator(const CodeGeneratorOptions& options)
+        : Options(options)
+        , BssWords(0)
+        , Instr(nullptr)
     {
-        std::vector<Word> additionalWords;
-        const unsigned int instructionNumber = Program.size();
-        Word raw = node->Opcode;
+    }
+
+    void CodeGenerator::AddPasses(PassManager& passes)
+    {
+        Passes.clear();
+
+        Pass* elimination = nullptr;
+        if (Options.StripUnreachable)
+        {
+            elimination = new EliminationPass{ Options.ExportedLabels, Elimination };
+            Passes.emplace_back(elimination);
+            passes.Add(elimination);
+        }
 
-        const Word secondOp = ConstructDoubleOperand(node->Second, &additionalWords, node);
-        raw |= (secondOp << 6);
+        LayoutPass* layout = new LayoutPass{ Options, Relaxation, SizeBreakdown, BssWords, Segments, Instr };
+        if (elimination != nullptr)
+            layout->DependsOn(elimination);
+        Passes.emplace_back(layout);
+        passes.Add(layout);
 
-        const Word firstOp = ConstructDoubleOperand(node->First, &additionalWords, node);
-        raw |= firstOp;
+        EncodingPass* encoding = new EncodingPass{ layout, Options, Errors, Program, Programs, Object, Instr };
+        Passes.emplace_back(encoding);
+        passes.Add(encoding);
+    }
 
-        Program.push_back(raw);
-        for (const Word w : additionalWords)
-            Program.push_back(w);
+    std::vector<Word> CodeGenerator::TakeProgram()
+    {
+        return std::move(Program);
     }
 
-    std::vector<Word> CodeGenerator::Generate(AST::AbstractSyntaxTree* ast)
+    std::vector<std::vector<Word>> CodeGenerator::TakePrograms()
     {
-        FirstPass fp;
-        ast->Accept(&fp);
+        return std::move(Programs);
+    }
 
-        ProgramNode* pn = fp.GetProgram();
-        SecondPass sp{ fp.GetLabelsTable(), Errors };
-        pn->Accept(&sp);
-        std::vector<Word> program = std::move(sp.GetProgram());
+    ObjectFile CodeGenerator::TakeObject()
+    {
+        return std::move(Object);
+    }
+
+    std::vector<Word> CodeGenerator::Generate(AST::AbstractSyntaxTree* ast)
+    {
+        PassManager passes{ Instr };
+        AddPasses(passes);
+        passes.Run(ast);
 
-        return program;
+        return TakeProgram();
     }
 }
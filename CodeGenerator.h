@@ -2,26 +2,141 @@
 
 #include "Ast.h"
 #include "ErrorHandling.h"
+#include "UnreachableCodeEliminator.h"
+#include "SizeReport.h"
+#include "Instrumentation.h"
+#include "PassManager.h"
+#include "ObjectFile.h"
 
+#include <map>
+#include <memory>
 #include <vector>
 #include <queue>
 #include <string>
 
 namespace AST
 {
+    struct RelaxationStats
+    {
+        unsigned int Lengthened = 0;
+        unsigned int Shortened  = 0;
+    };
+
+    // a configuration the program is built for, told apart from the others by symbol values.
+    struct Variant
+    {
+        std::string                Name;
+        std::map<std::string, int> Symbols;
+    };
+
+    struct CodeGeneratorOptions
+    {
+        // encode label operands as X(PC) instead of absolute (PC)+ addresses. X(PC) is the word at
+        // the label rather than its address, so only JMP and JSR may have a label operand.
+        bool PositionIndependent = false;
+
+        // remove commands that can't be reached from the entry point or an exported label.
+        bool                     StripUnreachable = false;
+        std::vector<std::string> ExportedLabels;
+
+        bool CollectSizeBreakdown = false;
+
+        // split a program that doesn't fit into ROM into segments, each mapped at the start of ROM.
+        // Only one segment is mapped at a time, so a label referred to from another segment is an error.
+        bool Overlays = false;
+
+        // encode the program as a module placed at the start of ROM, and record the words the
+        // linker has to change to place it anywhere else and to resolve its imported labels.
+        bool Relocatable = false;
+
+        // with variants, the program is laid out once and encoded once per variant, in parallel.
+        // Their symbols are only resolved after layout, so they can't change the size of anything.
+        std::vector<Variant> Variants;
+    };
+
     class CodeGenerator
     {
     public:
+        explicit CodeGenerator(const CodeGeneratorOptions& options = CodeGeneratorOptions());
+
         std::vector<Word> Generate(AST::AbstractSyntaxTree* ast);
-       
+
+        // Adds the code generation passes, so other passes can share their walks. Once the manager
+        // has run them, TakeProgram returns the image.
+        void AddPasses(PassManager& passes);
+        std::vector<Word> TakeProgram();
+        // with variants, the image of every variant, in the order of the variants.
+        std::vector<std::vector<Word>> TakePrograms();
+        // when relocatable, the exports, imports and relocations of the program; the caller adds the words.
+        ObjectFile TakeObject();
+
+        // the variants may be chosen until the passes encode the program.
+        inline void SetVariants(const std::vector<Variant>& variants);
+
+        inline void SetInstrumentation(Instrumentation* instrumentation);
+
         inline const std::vector<Error>& GetErrors() const;
+        inline const RelaxationStats& GetRelaxationStats() const;
+        inline const EliminationStats& GetEliminationStats() const;
+        inline const std::vector<SizeEntry>& GetSizeBreakdown() const;
+        // the words at the end of the program that are only reserved, so the image doesn't store them.
+        inline unsigned int GetBssWords() const;
+        // the word every segment of the program starts at; one segment unless overlays split it.
+        inline const std::vector<unsigned int>& GetSegments() const;
 
     private:
-        std::vector<Error> Errors;
+        CodeGeneratorOptions   Options;
+        std::vector<Error>     Errors;
+        RelaxationStats        Relaxation;
+        EliminationStats       Elimination;
+        std::vector<SizeEntry> SizeBreakdown;
+        unsigned int           BssWords;
+        std::vector<unsigned int> Segments;
+        Instrumentation*       Instr;
+        std::vector<Word>      Program;
+        std::vector<std::vector<Word>> Programs;
+        ObjectFile             Object;
+
+        std::vector<std::unique_ptr<Pass>> Passes;
     };
 
+    void CodeGenerator::SetInstrumentation(Instrumentation* instrumentation)
+    {
+        Instr = instrumentation;
+    }
+
+    void CodeGenerator::SetVariants(const std::vector<Variant>& variants)
+    {
+        Options.Variants = variants;
+    }
+
     const std::vector<Error>& CodeGenerator::GetErrors() const
     {
         return Errors;
     }
+
+    const RelaxationStats& CodeGenerator::GetRelaxationStats() const
+    {
+        return Relaxation;
+    }
+
+    const EliminationStats& CodeGenerator::GetEliminationStats() const
+    {
+        return Elimination;
+    }
+
+    const std::vector<SizeEntry>& CodeGenerator::GetSizeBreakdown() const
+    {
+        return SizeBreakdown;
+    }
+
+    unsigned int CodeGenerator::GetBssWords() const
+    {
+        return BssWords;
+    }
+
+    const std::vector<unsigned int>& CodeGenerator::GetSegments() const
+    {
+        return Segments;
+    }
 }
\ No newline at end of file
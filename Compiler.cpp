@@ -2,25 +2,92 @@
 #include "SemanticAnalyzer.h"
 #include "ErrorHandling.h"
 #include "CodeGenerator.h"
+#include "ControlFlowAnalyzer.h"
+#include "SizeReport.h"
+#include "AllocationReport.h"
+#include "TimeReport.h"
+#include "Trace.h"
+#include "Pipeline.h"
 
 #include "optparse.h"
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
+#include <set>
 #include <cstdio>
 #include <cstdlib>
 extern int yylex();
 extern int yyparse(AST::AbstractSyntaxTree* ast);
 extern FILE *yyin;
+extern void yyrestart(FILE* f);
 extern int yylineno;
 extern int yydebug;
 
+void SetParserMacros(MacroExpander* macros);
+void SetParserFile(const unsigned int file);
+
 namespace
 {
-    void DumpErrors(const std::vector<AST::Error>& errors)
+    class NodeCounter : public AST::AstVisitor
+    {
+    public:
+        NodeCounter() : Count(1) {}
+
+        virtual void Visit(AST::CommandNode* node) override                  { Count += 1 + CountLabels(node); }
+        virtual void Visit(AST::OneOperandCommandNode* node) override        { Count += 2 + CountLabels(node); }
+        virtual void Visit(AST::DoubleOperandCommandNode* node) override     { Count += 3 + CountLabels(node); }
+
+        uint64_t Count;
+
+    private:
+        uint64_t CountLabels(const AST::CommandNode* node) const
+        {
+            uint64_t labels = 0;
+            for (const AST::LabelNode* l = node->Labels; l != nullptr; l = l->Next)
+                ++labels;
+
+            return labels;
+        }
+    };
+
+    class SemanticPass final : public AST::TypedPass<AST::SemanticAnalyzer>
+    {
+    public:
+        SemanticPass() : TypedPass("semantic analysis", CompilePhase::SemanticAnalysis) {}
+
+        virtual AST::AstVisitor* Begin() override  { return &Analyzer; }
+        virtual bool End() override                { return Analyzer.GetErrors().empty(); }
+
+        const std::vector<AST::Error>& GetErrors() const { return Analyzer.GetErrors(); }
+
+    private:
+        AST::SemanticAnalyzer Analyzer;
+    };
+
+    class AnalysisPass final : public AST::TypedPass<AST::ControlFlowAnalyzer>
+    {
+    public:
+        AnalysisPass(const std::map<std::string, unsigned int>& loopBounds)
+            : TypedPass("control flow", CompilePhase::SemanticAnalysis)
+            , Analyzer(loopBounds)
+        {
+        }
+
+        virtual AST::AstVisitor* Begin() override  { return &Analyzer; }
+        virtual bool End() override                { Analyzer.Analyze(); return true; }
+
+        const AST::ControlFlowAnalyzer& GetAnalyzer() const { return Analyzer; }
+
+    private:
+        AST::ControlFlowAnalyzer Analyzer;
+    };
+
+    void DumpErrors(const std::vector<AST::Error>& errors, const SourceFiles& files)
     {
         if (errors.empty() == false)
         {
-            AST::ErrorDumper().Dump(errors);
+            AST::ErrorDumper{ &files }.Dump(errors);
             exit(-1);
         }
     }
@@ -53,40 +120,550 @@ std::vector<char> Compiler::ReadDataFile(const std::string& path)
     exit(-1);
 }
 
+std::map<std::string, unsigned int> Compiler::ParseLoopBounds(const std::vector<std::string>& bounds) const
+{
+    std::map<std::string, unsigned int> loopBounds;
+
+    for (const std::string& bound : bounds)
+    {
+        const size_t delimiter = bound.find('=');
+        const int iterations = delimiter != std::string::npos ? std::atoi(bound.c_str() + delimiter + 1) : 0;
+
+        if (delimiter == std::string::npos || iterations <= 0)
+        {
+            std::cerr << "Wrong loop bound `" << bound << "`: LABEL=N with N > 0 is expected.\n";
+            exit(-1);
+        }
+
+        loopBounds[bound.substr(0, delimiter)] = iterations;
+    }
+
+    return loopBounds;
+}
+
+void Compiler::WriteAnalysisReport(const AST::ControlFlowAnalyzer& cfa, const std::string& path) const
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "can't open a file %s", path.c_str());
+        exit(-1);
+    }
+
+    cfa.WriteReport(f);
+    fclose(f);
+}
+
+std::vector<std::pair<std::string, int>> Compiler::ParseDefinitions(const std::vector<std::string>& definitions) const
+{
+    std::vector<std::pair<std::string, int>> symbols;
+
+    for (const std::string& definition : definitions)
+    {
+        const size_t delimiter = definition.find('=');
+
+        char* end = nullptr;
+        const long value = delimiter != std::string::npos ? std::strtol(definition.c_str() + delimiter + 1, &end, 10) : 0;
+
+        if (delimiter == std::string::npos || delimiter == 0 || end == definition.c_str() + delimiter + 1 || *end != '\0')
+        {
+            std::cerr << "Wrong definition `" << definition << "`: NAME=VALUE with an integer VALUE is expected.\n";
+            exit(-1);
+        }
+
+        symbols.emplace_back(definition.substr(0, delimiter), static_cast<int>(value));
+    }
+
+    return symbols;
+}
+
+std::vector<AST::Variant> Compiler::ParseVariants(const std::vector<std::string>& variants) const
+{
+    std::vector<AST::Variant> parsed;
+
+    for (const std::string& variant : variants)
+    {
+        const size_t delimiter = variant.find(':');
+        if (delimiter == std::string::npos || delimiter == 0)
+        {
+            std::cerr << "Wrong variant `" << variant << "`: NAME:SYMBOL=VALUE,... is expected.\n";
+            exit(-1);
+        }
+
+        std::vector<std::string> definitions;
+        for (size_t begin = delimiter + 1; begin <= variant.size(); )
+        {
+            const size_t end = std::min(variant.find(',', begin), variant.size());
+            definitions.push_back(variant.substr(begin, end - begin));
+            begin = end + 1;
+        }
+
+        AST::Variant v;
+        v.Name = variant.substr(0, delimiter);
+        for (const auto& definition : ParseDefinitions(definitions))
+            v.Symbols[definition.first] = definition.second;
+
+        parsed.push_back(std::move(v));
+    }
+
+    return parsed;
+}
+
+void Compiler::WriteDepfile(const std::string& path, const std::vector<std::string>& outputs, const std::vector<std::string>& inputs) const
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "can't open a file %s", path.c_str());
+        exit(-1);
+    }
+
+    // one rule, `outputs: inputs`, as make and Ninja read it; spaces, # and $ are escaped.
+    const auto write = [f](const std::string& file)
+    {
+        for (const char c : file)
+        {
+            if (c == ' ' || c == '#')
+                fputc('\\', f);
+            else if (c == '$')
+                fputc('$', f);
+
+            fputc(c, f);
+        }
+    };
+
+    for (size_t i = 0; i < outputs.size(); ++i)
+    {
+        if (i != 0)
+            fputc(' ', f);
+
+        write(outputs[i]);
+    }
+
+    fputc(':', f);
+
+    for (const std::string& input : inputs)
+    {
+        fputs(" \\\n  ", f);
+        write(input);
+    }
+
+    fputc('\n', f);
+    fclose(f);
+}
+
+void Compiler::CheckSegmentSizes(const std::vector<unsigned int>& segments, const uint64_t programSize, const uint64_t dataSize) const
+{
+    bool fits = true;
+
+    if (segments.size() <= 1 && programSize > GetROMSize())
+    {
+        std::fprintf(stderr, "program doesn't fit into ROM: %llu bytes, only %zu bytes are available.\n", static_cast<unsigned long long>(programSize), GetROMSize());
+        fits = false;
+    }
+
+    // overlays only split the program between commands, so a segment may still be too large.
+    for (size_t i = 0; segments.size() > 1 && i < segments.size(); ++i)
+    {
+        const uint64_t end = i + 1 < segments.size() ? segments[i + 1] * sizeof(Word) : programSize;
+        const uint64_t size = end - segments[i] * sizeof(Word);
+        if (size > GetROMSize())
+        {
+            std::fprintf(stderr, "segment %zu doesn't fit into ROM: %llu bytes, only %zu bytes are available.\n", i, static_cast<unsigned long long>(size), GetROMSize());
+            fits = false;
+        }
+    }
+
+    // the data is loaded into RAM and the program into ROM, so program plus data is checked as
+    // each of them against its own segment; neither can spill into the other.
+    if (dataSize > GetRAMSize())
+    {
+        std::fprintf(stderr, "data doesn't fit into RAM: %llu bytes, only %zu bytes are available.\n", static_cast<unsigned long long>(dataSize), GetRAMSize());
+        fits = false;
+    }
+
+    if (fits == false)
+        exit(-1);
+}
+
 void Compiler::Compile(int argc, char** argv)
 {
     optparse::OptionParser parser = optparse::OptionParser().description("MACRO11 compiler");
 
-    parser.add_option("-i").help("input file.").dest("input");
+    parser.add_option("-i").action("append").help("input file (may be repeated; with several inputs -o names a directory).").dest("input");
     parser.add_option("-o").help("output file.").dest("out");
     parser.add_option("-d").help("data file.").dest("data");
+    parser.add_option("-c").action("store_true").help("compile into a relocatable object file, to be linked into an image by macro11-link.").dest("object");
+    parser.add_option("-D").action("append").help("NAME=VALUE: assign the symbol before the first line (may be repeated).").dest("define");
+    parser.add_option("-I").action("append").help("directory to look for the files of `.INCLUDE` in (may be repeated).").dest("include_dir");
+    parser.add_option("--variant").action("append").help("NAME:SYMBOL=VALUE,...: also build the variant that assigns these symbols, into the output named with .NAME (may be repeated).").dest("variant");
+    parser.add_option("--depfile").help("write the files the output depends on as a Makefile rule, also read by Ninja.").dest("depfile");
+    parser.add_option("--overlays").action("store_true").help("split a program that doesn't fit into ROM into segments, each mapped at the start of ROM; a label can only be referred to from its own segment.").dest("overlays");
+    parser.add_option("--pic").action("store_true").help("position independent code: jumps and calls to labels are encoded PC-relative; other label operands are errors.").dest("pic");
+    parser.add_option("--strip-unreachable").action("store_true").help("remove code that can't be reached from the entry point or an exported label.").dest("strip");
+    parser.add_option("--export").action("append").help("label that is reachable from outside the program (may be repeated).").dest("export");
+    parser.add_option("--analysis-report").help("write basic blocks, call graph, worst-case stack depth and cycles as JSON.").dest("analysis");
+    parser.add_option("--loop-bound").action("append").help("LABEL=N: the loop headed by LABEL runs at most N iterations (may be repeated).").dest("loop_bound");
+    parser.add_option("--size-report").help("write the code size of every label and section.").dest("size_report");
+    parser.add_option("--size-diff").action("append").help("size report to compare the build with; given twice, compares the two reports without compiling.").dest("size_diff");
+    parser.add_option("--time-report").action("store_true").help("print the time and hardware counters of every compile phase.").dest("time_report");
+    parser.add_option("--time-report-json").help("write the time report as JSON.").dest("time_report_json");
+    parser.add_option("--trace").help("write the spans and counters of every compile phase in the Chrome trace event format.").dest("trace");
+    parser.add_option("--max-macro-depth").type("int").help("fail when macro calls and repeat blocks nest deeper.").dest("max_macro_depth");
+    parser.add_option("--max-macro-expansion").help("fail when macro expansions produce more tokens.").dest("max_macro_expansion");
+    parser.add_option("--pipeline").action("store_true").help("scan, parse and run the first passes of a file on separate threads.").dest("pipeline");
+    parser.add_option("--alloc-report").action("store_true").help("print heap allocations, bytes and peak live heap of every compile phase; needs a build of make alloc.").dest("alloc_report");
+    parser.add_option("--max-allocations-per-line").type("double").help("fail when the compile makes more heap allocations per source line; needs a build of make alloc.").dest("max_allocations");
 
     const optparse::Values options = parser.parse_args(argc, argv);
-    if (options.is_set("input") == false || options.is_set("out") == false)
+    const std::vector<std::string> sizeDiff = options.all("size_diff");
+    if (sizeDiff.size() == 2)
+    {
+        AST::SizeReporter().Diff(stdout, sizeDiff[0], sizeDiff[1]);
+        return;
+    }
+
+    const std::vector<std::string> inputs = options.all("input");
+    if (inputs.empty() || options.is_set("out") == false)
     {
         parser.print_help();
         exit(-1);
     }
 
-    uint64_t dataSize = 0;
+    // the data and the layout of ROM are only known once the modules are linked.
+    if (options.is_set("object") && (options.is_set("data") || options.is_set("overlays") || options.is_set("variant")))
+    {
+        std::cerr << "-c can't be combined with -d, --overlays or --variant.\n";
+        exit(-1);
+    }
+
+    std::unique_ptr<TimeReport> timeReport;
+    if (options.is_set("time_report") || options.is_set("time_report_json"))
+        timeReport.reset(new TimeReport());
+
+    std::unique_ptr<Trace> trace;
+    if (options.is_set("trace"))
+        trace.reset(new Trace());
+
+    std::unique_ptr<AllocationReport> allocationReport;
+    if (options.is_set("alloc_report") || options.is_set("max_allocations"))
+        allocationReport.reset(new AllocationReport());
+
+    // a budget that can't be checked mustn't pass.
+    if (options.is_set("max_allocations") && allocationReport->IsSupported() == false)
+    {
+        std::fprintf(stderr, "allocations can't be counted: %s is built without the allocation hooks (make alloc).\n", argv[0]);
+        exit(-1);
+    }
+
+    Instrumentation instrumentation{ timeReport.get(), trace.get(), allocationReport.get() };
+    Instrumentation* instr = instrumentation.IsEnabled() ? &instrumentation : nullptr;
+
     std::vector<char> data;
     if (options.is_set("data"))
     {
+        PhaseScope phase{ instr, CompilePhase::ReadData };
         data = ReadDataFile(options["data"]);
-        dataSize = data.size();
     }
 
-    const std::string& sourceFile = options["input"];
-    AST::AbstractSyntaxTree ast = Parse(sourceFile.c_str());
-    
-    AST::SemanticAnalyzer sa;
-    ast.Accept(&sa);
-    DumpErrors(sa.GetErrors());
+    // a file included by several files of a batch is only scanned once.
+    IncludeCache includes{ options.all("include_dir") };
+
+    const std::vector<AST::Variant> variants = ParseVariants(options.all("variant"));
+
+    const bool batch = inputs.size() > 1;
+    for (const std::string& sourceFile : inputs)
+    {
+        const std::string extension = options.is_set("object") ? ".obj" : ".bin";
+        const std::string outputFile = batch ? options["out"] + "/" + GetStem(sourceFile) + extension : options["out"];
+
+        std::vector<std::string> dependencies{ sourceFile };
+        if (options.is_set("data"))
+            dependencies.push_back(options["data"]);
+
+        // every parse builds the variants that take the same conditional blocks as the first one left.
+        std::vector<AST::Variant> left = variants;
+        do
+        {
+            CompileFile(sourceFile, outputFile, data, options, batch, includes, &left, &dependencies, instr);
+        } while (left.empty() == false);
+
+        if (options.is_set("depfile"))
+        {
+            std::vector<std::string> outputs;
+            for (const AST::Variant& variant : variants)
+                outputs.push_back(AddSuffix(outputFile, variant.Name));
+            if (variants.empty())
+                outputs.push_back(outputFile);
+
+            WriteDepfile(GetReportPath(options["depfile"], sourceFile, batch), outputs, dependencies);
+        }
+    }
+
+    if (options.is_set("time_report"))
+        timeReport->Print(stdout);
+
+    if (options.is_set("time_report_json"))
+    {
+        FILE* f = fopen(options["time_report_json"].c_str(), "w");
+        if (!f)
+        {
+            fprintf(stderr, "can't open a file %s", options["time_report_json"].c_str());
+            exit(-1);
+        }
+
+        timeReport->WriteJson(f);
+        fclose(f);
+    }
+
+    if (options.is_set("alloc_report"))
+        allocationReport->Print(stdout);
+
+    if (options.is_set("max_allocations"))
+    {
+        const double limit = std::atof(options["max_allocations"].c_str());
+        if (allocationReport->GetAllocationsPerLine() > limit)
+        {
+            std::fprintf(stderr, "allocation budget exceeded: %.2f allocations per source line, at most %.2f are allowed.\n",
+                         allocationReport->GetAllocationsPerLine(), limit);
+            exit(-1);
+        }
+    }
+
+    if (options.is_set("trace"))
+    {
+        FILE* f = fopen(options["trace"].c_str(), "w");
+        if (!f)
+        {
+            fprintf(stderr, "can't open a file %s", options["trace"].c_str());
+            exit(-1);
+        }
+
+        trace->Write(f);
+        fclose(f);
+    }
+}
+
+std::string Compiler::GetStem(const std::string& path) const
+{
+    const size_t begin = path.find_last_of('/') == std::string::npos ? 0 : path.find_last_of('/') + 1;
+    const size_t end = path.find_last_of('.');
+
+    return path.substr(begin, end == std::string::npos || end < begin ? std::string::npos : end - begin);
+}
+
+std::string Compiler::GetReportPath(const std::string& path, const std::string& sourceFile, const bool batch) const
+{
+    // every file of a batch gets its own report: report.json -> report.<source stem>.json
+    if (batch == false)
+        return path;
+
+    return AddSuffix(path, GetStem(sourceFile));
+}
+
+std::string Compiler::AddSuffix(const std::string& path, const std::string& suffix) const
+{
+    const size_t extension = path.find_last_of('.');
+    const size_t directory = path.find_last_of('/');
+    if (extension == std::string::npos || (directory != std::string::npos && extension < directory))
+        return path + "." + suffix;
+
+    return path.substr(0, extension) + "." + suffix + path.substr(extension);
+}
+
+void Compiler::CompileFile(const std::string& sourceFile, const std::string& outputFile, const std::vector<char>& data,
+                           const optparse::Values& options, const bool batch, IncludeCache& includes, std::vector<AST::Variant>* variants,
+                           std::vector<std::string>* inputs, Instrumentation* instr)
+{
+    const uint64_t dataSize = data.size();
+    const std::vector<std::string> sizeDiff = options.all("size_diff");
+
+    if (instr != nullptr)
+        instr->BeginFile(sourceFile);
+
+    // the semantic checks, the analyses and the first pass only look at one command at a time,
+    // so the pass manager runs them in a single walk.
+    AST::PassManager passes{ instr };
+
+    SemanticPass semantic;
+    passes.Add(&semantic);
+
+    NodeCounter counter;
+    AST::VisitorPass counterPass{ "ast nodes", CompilePhase::SemanticAnalysis, &counter };
+    if (instr != nullptr)
+        passes.Add(&counterPass);
+
+    const std::map<std::string, unsigned int> loopBounds = ParseLoopBounds(options.all("loop_bound"));
+    AnalysisPass analysis{ loopBounds };
+    if (options.is_set("analysis"))
+        passes.Add(&analysis);
+
+    AST::CodeGeneratorOptions codeGenOptions;
+    codeGenOptions.PositionIndependent = options.is_set("pic");
+    codeGenOptions.Overlays = options.is_set("overlays");
+    codeGenOptions.Relocatable = options.is_set("object");
+    codeGenOptions.StripUnreachable = options.is_set("strip");
+    codeGenOptions.ExportedLabels = options.all("export");
+    codeGenOptions.CollectSizeBreakdown = options.is_set("size_report") || sizeDiff.empty() == false;
+
+    AST::CodeGenerator codeGen{ codeGenOptions };
+    codeGen.SetInstrumentation(instr);
+
+    codeGen.AddPasses(passes);
+
+    // pipelined, the first walk runs on its own thread while the file is being parsed.
+    const bool pipelined = options.is_set("pipeline");
+
+    MacroLimits macroLimits;
+    if (options.is_set("max_macro_depth"))
+        macroLimits.MaxDepth = std::atoi(options["max_macro_depth"].c_str());
+    if (options.is_set("max_macro_expansion"))
+        macroLimits.MaxExpandedTokens = std::strtoull(options["max_macro_expansion"].c_str(), nullptr, 10);
+
+    // the symbols of the variants are variables: the file is parsed with the values of the first
+    // variant left for its conditions, and operands refer to them by name until they are encoded.
+    std::set<std::string> variables;
+    for (const AST::Variant& variant : *variants)
+    {
+        for (const auto& symbol : variant.Symbols)
+            variables.insert(symbol.first);
+    }
+
+    MacroExpander macros{ macroLimits, &includes };
+    for (const auto& definition : ParseDefinitions(options.all("define")))
+    {
+        if (variables.count(definition.first) == 0)
+            macros.Predefine(definition.first, definition.second);
+    }
+
+    for (const std::string& name : variables)
+    {
+        auto it = variants->front().Symbols.find(name);
+        macros.AddVariable(name, it != variants->front().Symbols.end() ? &it->second : nullptr);
+    }
+
+    AST::AbstractSyntaxTree ast;
+    {
+        PhaseScope phase{ instr, CompilePhase::Parse };
+        ast = Parse(sourceFile.c_str(), Files.Add(sourceFile), macros, pipelined ? &passes : nullptr);
+    }
+
+    if (instr != nullptr)
+    {
+        instr->AddSourceLines(yylineno - 1);
+
+        const MacroStats& macroStats = macros.GetStats();
+        instr->Counter("macro expansions", macroStats.Expansions);
+        instr->Counter("macro cache hits", macroStats.CacheHits);
+        instr->Counter("expanded tokens", macroStats.ExpandedTokens);
+        instr->Counter("included files", macros.GetIncludedFiles().size());
+        instr->Counter("include cache hits", includes.GetStats().Hits);
+        instr->Counter("fixups", ast.GetProgram()->Expressions.GetFixupCount());
+    }
+
+    // the variants that agree with the first one on every variable a condition took share the parse.
+    std::vector<AST::Variant> built;
+    if (variants->empty() == false)
+    {
+        const AST::Variant first = variants->front();
+        const std::vector<std::string> conditions = macros.GetConditionVariables();
+
+        std::vector<AST::Variant> left;
+        for (AST::Variant& variant : *variants)
+        {
+            bool agrees = true;
+            for (const std::string& name : conditions)
+            {
+                auto a = variant.Symbols.find(name);
+                auto b = first.Symbols.find(name);
+                if ((a == variant.Symbols.end()) != (b == first.Symbols.end()) || (a != variant.Symbols.end() && a->second != b->second))
+                    agrees = false;
+            }
+
+            (agrees ? built : left).push_back(std::move(variant));
+        }
+
+        *variants = std::move(left);
+        codeGen.SetVariants(built);
+
+        if (instr != nullptr)
+            instr->Counter("variants", built.size());
+    }
+
+    for (const std::string& file : macros.GetIncludedFiles())
+    {
+        if (std::find(inputs->begin(), inputs->end(), file) == inputs->end())
+            inputs->push_back(file);
+    }
+
+    if (pipelined)
+        passes.FinishStream(&ast);
+    else
+        passes.Run(&ast);
+    DumpErrors(semantic.GetErrors(), Files);
+
+    if (instr != nullptr)
+        instr->Counter("ast nodes", counter.Count);
+
+    if (options.is_set("analysis"))
+        WriteAnalysisReport(analysis.GetAnalyzer(), GetReportPath(options["analysis"], sourceFile, batch));
+
+    // the errors and the encoded program don't refer to the tree, so it's freed before the image is written.
+    ast = AST::AbstractSyntaxTree();
+
+    DumpErrors(codeGen.GetErrors(), Files);
+
+    std::vector<std::vector<Word>> programs;
+    if (built.empty())
+        programs.push_back(codeGen.TakeProgram());
+    else
+        programs = codeGen.TakePrograms();
+
+    // the variants share the layout, so their programs have the same size.
+    const std::vector<Word>& program = programs[0];
+
+    if (options.is_set("time_report"))
+    {
+        std::printf("passes of %s: %u walks\n", sourceFile.c_str(), passes.GetWalks());
+        passes.PrintTimings(stdout);
+    }
+
+    const AST::EliminationStats& elimination = codeGen.GetEliminationStats();
+    if (elimination.RemovedCommands != 0)
+        std::printf("unreachable code: %u commands removed, %u bytes reclaimed\n", elimination.RemovedCommands, elimination.ReclaimedBytes);
+
+    const AST::RelaxationStats& relaxation = codeGen.GetRelaxationStats();
+    if (relaxation.Lengthened != 0 || relaxation.Shortened != 0)
+        std::printf("branch relaxation: %u lengthened, %u shortened\n", relaxation.Lengthened, relaxation.Shortened);
+
+    // the report and the diff are written before the sizes are checked, as they show what grew.
+    if (options.is_set("size_report"))
+    {
+        const std::string path = GetReportPath(options["size_report"], sourceFile, batch);
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f)
+        {
+            fprintf(stderr, "can't open a file %s\n", path.c_str());
+            exit(-1);
+        }
+
+        AST::SizeReporter().Write(f, codeGen.GetSizeBreakdown(), dataSize);
+        fclose(f);
+    }
+
+    if (sizeDiff.empty() == false)
+        AST::SizeReporter().Diff(stdout, sizeDiff[0], codeGen.GetSizeBreakdown(), dataSize);
+
+    uint64_t programSize = program.size() * sizeof(Word);
+    const std::vector<unsigned int>& segments = codeGen.GetSegments();
+    CheckSegmentSizes(segments, programSize, dataSize);
+
+    // reserved space at the end of the program is described by the header instead of stored.
+    const uint64_t bssSize = codeGen.GetBssWords() * sizeof(Word);
+    const uint64_t storedSize = programSize - bssSize;
+
+    PhaseScope phase{ instr, CompilePhase::Write };
 
-    AST::CodeGenerator codeGen;
-    const std::vector<Word>& program = codeGen.Generate(&ast);
-    DumpErrors(codeGen.GetErrors());
-    
     FILE* f = fopen("dump.txt", "w");
     for (const Word instruction : program)
     {
@@ -94,18 +671,57 @@ void Compiler::Compile(int argc, char** argv)
     }
     fclose(f);
 
-    uint64_t programSize = program.size() * sizeof(Word);
+    if (options.is_set("object"))
+    {
+        ObjectFile object = codeGen.TakeObject();
+        object.Program.assign(program.begin(), program.begin() + storedSize / sizeof(Word));
+        object.BssWords = codeGen.GetBssWords();
 
-    const std::string& outputFile = options["out"];
-    f = fopen(outputFile.c_str(), "w");
-    fwrite(&dataSize, sizeof(uint64_t), 1, f);
-    fwrite(data.data(), sizeof(Byte), dataSize, f);
-    fwrite(program.data(), sizeof(Byte), programSize, f);
+        std::string error;
+        if (object.Write(outputFile, &error) == false)
+        {
+            std::cerr << error << "\n";
+            exit(-1);
+        }
 
-    fclose(f);
+        return;
+    }
+
+    // the header holds the data size in its low half and the BSS size in its high half, so an
+    // image without BSS is the same as before there was any.
+    uint64_t header = dataSize | bssSize << 32;
+
+    // an image of several segments sets the top bit of the header and puts the segment table after
+    // the data: the number of segments and the stored size of each, in words of 16 bits. The
+    // segments follow one after another and are each loaded at the start of ROM; the BSS follows
+    // the last one.
+    std::vector<uint16_t> segmentTable;
+    if (segments.size() > 1)
+    {
+        header |= 1ull << 63;
+        segmentTable.push_back(static_cast<uint16_t>(segments.size()));
+
+        for (size_t i = 0; i < segments.size(); ++i)
+        {
+            const uint64_t begin = std::min<uint64_t>(segments[i] * sizeof(Word), storedSize);
+            const uint64_t end = std::min<uint64_t>(i + 1 < segments.size() ? segments[i + 1] * sizeof(Word) : storedSize, storedSize);
+            segmentTable.push_back(static_cast<uint16_t>(end - begin));
+        }
+    }
+
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+        f = fopen((built.empty() ? outputFile : AddSuffix(outputFile, built[i].Name)).c_str(), "w");
+        fwrite(&header, sizeof(uint64_t), 1, f);
+        fwrite(data.data(), sizeof(Byte), dataSize, f);
+        fwrite(segmentTable.data(), sizeof(uint16_t), segmentTable.size(), f);
+        fwrite(programs[i].data(), sizeof(Byte), storedSize, f);
+
+        fclose(f);
+    }
 }
 
-AST::AbstractSyntaxTree Compiler::Parse(const char* sourceFile) const
+AST::AbstractSyntaxTree Compiler::Parse(const char* sourceFile, const unsigned int file, MacroExpander& macros, AST::PassManager* streamTo) const
 {
     FILE* f = fopen(sourceFile, "r");
 
@@ -115,10 +731,23 @@ AST::AbstractSyntaxTree Compiler::Parse(const char* sourceFile) const
         exit(-1);
     }
 
-    yyin = f;
-
     AST::AbstractSyntaxTree ast;
-    yyparse(&ast);
+    SetParserFile(file);
+
+    if (streamTo != nullptr)
+    {
+        Pipeline{ *streamTo, macros }.Parse(f, &ast);
+    }
+    else
+    {
+        // restarting the scanner on every file lets one run compile several files.
+        yyrestart(f);
+        yylineno = 1;
+
+        SetParserMacros(&macros);
+        yyparse(&ast);
+        SetParserMacros(nullptr);
+    }
 
     fclose(f);
     return ast;
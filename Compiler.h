@@ -1,6 +1,22 @@
 #pragma once
 
 #include "Ast.h"
+#include "CodeGenerator.h"
+#include "ControlFlowAnalyzer.h"
+#include "PassManager.h"
+#include "Instrumentation.h"
+#include "MacroExpander.h"
+#include "IncludeCache.h"
+#include "SourceLocation.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace optparse
+{
+    class Values;
+}
 
 class Compiler
 {
@@ -8,9 +24,23 @@ public:
     void Compile(int argc, char** argv);
 
 private:
+    void CompileFile(const std::string& sourceFile, const std::string& outputFile, const std::vector<char>& data,
+                     const optparse::Values& options, const bool batch, IncludeCache& includes, std::vector<AST::Variant>* variants,
+                     std::vector<std::string>* inputs, Instrumentation* instrumentation);
+    std::string GetStem(const std::string& path) const;
+    std::string GetReportPath(const std::string& path, const std::string& sourceFile, const bool batch) const;
+    std::string AddSuffix(const std::string& path, const std::string& suffix) const;
     std::vector<char> ReadDataFile(const std::string& path);
+    std::map<std::string, unsigned int> ParseLoopBounds(const std::vector<std::string>& bounds) const;
+    std::vector<std::pair<std::string, int>> ParseDefinitions(const std::vector<std::string>& definitions) const;
+    std::vector<AST::Variant> ParseVariants(const std::vector<std::string>& variants) const;
+    void CheckSegmentSizes(const std::vector<unsigned int>& segments, const uint64_t programSize, const uint64_t dataSize) const;
+    void WriteAnalysisReport(const AST::ControlFlowAnalyzer& cfa, const std::string& path) const;
+    void WriteDepfile(const std::string& path, const std::vector<std::string>& outputs, const std::vector<std::string>& inputs) const;
 
 private:
 
-    AST::AbstractSyntaxTree Parse(const char* sourceFile) const;
+    AST::AbstractSyntaxTree Parse(const char* sourceFile, const unsigned int file, MacroExpander& macros, AST::PassManager* streamTo) const;
+
+    SourceFiles Files;
 };
\ No newline at end of file
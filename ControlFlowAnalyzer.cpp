@@ -0,0 +1,634 @@
+#include "ControlFlowAnalyzer.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <set>
+
+namespace AST
+{
+    namespace
+    {
+        bool WritesDestination(const int opcode)
+        {
+            switch (opcode)
+            {
+            case OPCODE_CMP:
+            case OPCODE_CMPB:
+            case OPCODE_BIT:
+            case OPCODE_BITB:
+            case OPCODE_TST:
+            case OPCODE_TSTB:
+                return false;
+
+            default:
+                return true;
+            }
+        }
+
+        void WriteIndices(FILE* f, const std::vector<size_t>& indices)
+        {
+            std::fprintf(f, "[");
+            for (size_t i = 0; i < indices.size(); ++i)
+                std::fprintf(f, i == 0 ? "%zu" : ", %zu", indices[i]);
+            std::fprintf(f, "]");
+        }
+    }
+
+    ControlFlowAnalyzer::ControlFlowAnalyzer(const std::map<std::string, unsigned int>& loopBounds)
+        : LoopBounds(loopBounds)
+    {
+    }
+
+    void ControlFlowAnalyzer::Visit(CommandNode* node)
+    {
+        AddInstruction(node, 1);
+
+        Instruction& instruction = Instructions.back();
+        if (node->Opcode == OPCODE_RETURN)
+        {
+            instruction.Cycles += 1;
+            instruction.StackEffect = -2;
+        }
+        else if (node->Opcode == OPCODE_RTI)
+        {
+            instruction.Cycles += 2;
+            instruction.StackEffect = -4;
+        }
+    }
+
+    void ControlFlowAnalyzer::Visit(OneOperandCommandNode* node)
+    {
+        const InstructionGroup g = GetInstructionGroup(node->Opcode);
+        AddInstruction(node, 1 + GetOperandCycles(node->First, g));
+
+        if (g == InstructionGroup::Branch || node->Opcode == OPCODE_JMP)
+        {
+            Instruction& instruction = Instructions.back();
+            if (node->First->AddrType == AddressingType::Label && node->First->LabelName != nullptr)
+                instruction.Target = node->First;
+            else if (node->Opcode == OPCODE_JMP)
+                instruction.IndirectTransfer = true;
+        }
+        else if (node->Opcode == OPCODE_RTS)
+        {
+            Instruction& instruction = Instructions.back();
+            instruction.Cycles += 1;
+            instruction.StackEffect = -2;
+        }
+        else
+        {
+            AddOperand(node->First, WritesDestination(node->Opcode) == false);
+        }
+    }
+
+    void ControlFlowAnalyzer::Visit(DoubleOperandCommandNode* node)
+    {
+        const InstructionGroup g = GetInstructionGroup(node->Opcode);
+        AddInstruction(node, 1 + GetOperandCycles(node->First, g) + GetOperandCycles(node->Second, g));
+
+        // as in the encoding, the second operand is the source and the first one the destination,
+        // which is the target of JSR.
+        Instruction& instruction = Instructions.back();
+        const OperandNode* destination = node->First;
+        const OperandNode* source = node->Second;
+
+        if (node->Opcode == OPCODE_JSR)
+        {
+            // the link register is pushed by JSR and popped again by the callee's RTS.
+            instruction.Cycles += 1;
+            if (destination->AddrType == AddressingType::Label && destination->LabelName != nullptr)
+                instruction.Callee = destination->LabelName;
+            else
+                instruction.IndirectTransfer = true;
+        }
+        else if ((node->Opcode == OPCODE_ADD || node->Opcode == OPCODE_SUB)
+                 && source->OpType == OperandType::Number && source->AddrType == AddressingType::AutoIncrement
+                 && destination->OpType == OperandType::Register && destination->AddrType == AddressingType::Register && destination->Value == SP)
+        {
+            instruction.StackEffect = node->Opcode == OPCODE_SUB ? source->Value : -source->Value;
+        }
+        else
+        {
+            AddOperand(source, true);
+            AddOperand(destination, WritesDestination(node->Opcode) == false);
+        }
+    }
+
+    void ControlFlowAnalyzer::Visit(DataNode* node)
+    {
+        // data isn't executed; a label on it can't start a block.
+    }
+
+    void ControlFlowAnalyzer::AddInstruction(const CommandNode* node, const unsigned int cycles)
+    {
+        for (LabelNode* l = node->Labels; l != nullptr; l = l->Next)
+            LabelsTable[l->Name] = Instructions.size();
+
+        Instructions.push_back(Instruction{ node, node->Location.GetLine(), cycles, 0, false, nullptr, nullptr, false });
+    }
+
+    void ControlFlowAnalyzer::AddOperand(const OperandNode* node, const bool isSource)
+    {
+        if (node->OpType != OperandType::Register || node->Value != SP)
+            return;
+
+        Instruction& instruction = Instructions.back();
+        switch (node->AddrType)
+        {
+        case AddressingType::AutoDecrement:
+        case AddressingType::AutoDecrementDeferred:
+            instruction.StackEffect += 2;
+            break;
+
+        case AddressingType::AutoIncrement:
+        case AddressingType::AutoIncrementDeferred:
+            instruction.StackEffect -= 2;
+            break;
+
+        case AddressingType::Register:
+            if (isSource == false)
+                instruction.StackUnknown = true;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    unsigned int ControlFlowAnalyzer::GetOperandCycles(const OperandNode* node, const InstructionGroup g) const
+    {
+        // memory references per addressing mode, extension words included.
+        static const unsigned int modeCycles[] = { 0, 1, 1, 2, 1, 2, 2, 3 };
+
+        if (node->AddrType == AddressingType::Label)
+            return g == InstructionGroup::Branch ? 0 : 1;
+
+        return modeCycles[static_cast<int>(node->AddrType)];
+    }
+
+    void ControlFlowAnalyzer::Analyze()
+    {
+        if (Instructions.empty())
+            return;
+
+        BuildBlocks();
+
+        const LabelNode* entryLabel = Instructions[0].Node->Labels;
+        GetRoutine(entryLabel != nullptr ? entryLabel->Name : "$entry", 0);
+
+        for (const Instruction& instruction : Instructions)
+        {
+            if (instruction.Callee == nullptr)
+                continue;
+
+            auto it = LabelsTable.find(instruction.Callee);
+            if (it != LabelsTable.end())
+                GetRoutine(instruction.Callee, it->second);
+        }
+
+        for (Routine& routine : Routines)
+            CollectRoutineBlocks(routine);
+
+        for (size_t r = 0; r < Routines.size(); ++r)
+            AnalyzeRoutine(r);
+    }
+
+    void ControlFlowAnalyzer::BuildBlocks()
+    {
+        const size_t n = Instructions.size();
+        std::vector<bool> leaders(n + 1, false);
+        leaders[0] = true;
+
+        // only the commands that local labels label are looked up by node.
+        for (const Instruction& instruction : Instructions)
+        {
+            if (instruction.Target != nullptr && instruction.Target->Target != nullptr)
+                LocalTargets.emplace(instruction.Target->Target, n);
+        }
+
+        for (size_t i = 0; i < n && LocalTargets.empty() == false; ++i)
+        {
+            auto it = LocalTargets.find(Instructions[i].Node);
+            if (it != LocalTargets.end())
+                it->second = i;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const Instruction& instruction = Instructions[i];
+            const int opcode = instruction.Node->Opcode;
+
+            size_t target = 0;
+            if (instruction.Target != nullptr && FindTarget(instruction.Target, &target))
+                leaders[target] = true;
+
+            if (   instruction.Target != nullptr
+                || instruction.IndirectTransfer
+                || IsUnconditionalTransfer(opcode)
+                || GetInstructionGroup(opcode) == InstructionGroup::Branch)
+            {
+                leaders[i + 1] = true;
+            }
+        }
+
+        BlockOf.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (leaders[i])
+                Blocks.push_back(BasicBlock{ i, i, {} });
+
+            Blocks.back().Last = i;
+            BlockOf[i] = Blocks.size() - 1;
+        }
+
+        for (BasicBlock& block : Blocks)
+        {
+            const Instruction& last = Instructions[block.Last];
+
+            size_t target = 0;
+            if (last.Target != nullptr && FindTarget(last.Target, &target))
+                block.Successors.push_back(BlockOf[target]);
+
+            if (IsUnconditionalTransfer(last.Node->Opcode) == false && block.Last + 1 < n)
+            {
+                const size_t next = BlockOf[block.Last + 1];
+                if (std::find(block.Successors.begin(), block.Successors.end(), next) == block.Successors.end())
+                    block.Successors.push_back(next);
+            }
+        }
+    }
+
+    bool ControlFlowAnalyzer::FindTarget(const OperandNode* node, size_t* instruction) const
+    {
+        // data isn't an instruction, so a local label on data is in neither table.
+        if (node->Target != nullptr)
+        {
+            auto it = LocalTargets.find(node->Target);
+            if (it == LocalTargets.end() || it->second == Instructions.size())
+                return false;
+
+            *instruction = it->second;
+            return true;
+        }
+
+        auto it = LabelsTable.find(node->LabelName);
+        if (it == LabelsTable.end())
+            return false;
+
+        *instruction = it->second;
+        return true;
+    }
+
+    size_t ControlFlowAnalyzer::GetRoutine(const std::string& name, const size_t entryInstruction)
+    {
+        auto it = RoutinesTable.find(name);
+        if (it != RoutinesTable.end())
+            return it->second;
+
+        Routine routine;
+        routine.Name = name;
+        routine.Entry = entryInstruction;
+        routine.IndirectTransfers = false;
+        routine.Analyzed = false;
+        routine.InProgress = false;
+        routine.StackBounded = false;
+        routine.MaxStack = 0;
+        routine.CyclesBounded = false;
+        routine.MaxCycles = 0;
+
+        Routines.push_back(routine);
+        RoutinesTable[name] = Routines.size() - 1;
+
+        return Routines.size() - 1;
+    }
+
+    void ControlFlowAnalyzer::CollectRoutineBlocks(Routine& routine)
+    {
+        std::vector<bool> visited(Blocks.size(), false);
+        std::vector<size_t> pending{ BlockOf[routine.Entry] };
+
+        while (pending.empty() == false)
+        {
+            const size_t b = pending.back();
+            pending.pop_back();
+
+            if (visited[b])
+                continue;
+
+            visited[b] = true;
+            routine.Blocks.push_back(b);
+
+            for (size_t i = Blocks[b].First; i <= Blocks[b].Last; ++i)
+            {
+                const Instruction& instruction = Instructions[i];
+                if (instruction.IndirectTransfer)
+                    routine.IndirectTransfers = true;
+
+                if (instruction.Callee != nullptr
+                    && std::find(routine.Callees.begin(), routine.Callees.end(), instruction.Callee) == routine.Callees.end())
+                {
+                    routine.Callees.push_back(instruction.Callee);
+                }
+            }
+
+            for (const size_t s : Blocks[b].Successors)
+                pending.push_back(s);
+        }
+
+        std::sort(routine.Blocks.begin(), routine.Blocks.end());
+    }
+
+    void ControlFlowAnalyzer::AnalyzeRoutine(const size_t r)
+    {
+        if (Routines[r].Analyzed || Routines[r].InProgress)
+            return;
+
+        Routines[r].InProgress = true;
+
+        for (const std::string& callee : Routines[r].Callees)
+        {
+            auto it = RoutinesTable.find(callee);
+            if (it != RoutinesTable.end())
+                AnalyzeRoutine(it->second);
+        }
+
+        ComputeStackDepth(Routines[r]);
+        ComputeCycles(Routines[r]);
+
+        Routines[r].InProgress = false;
+        Routines[r].Analyzed = true;
+    }
+
+    const ControlFlowAnalyzer::Routine* ControlFlowAnalyzer::GetCallee(const char* name) const
+    {
+        if (name == nullptr)
+            return nullptr;
+
+        auto it = RoutinesTable.find(name);
+        if (it == RoutinesTable.end())
+            return nullptr;
+
+        // a callee that is still being analyzed is part of a recursive cycle.
+        const Routine* callee = &Routines[it->second];
+        return callee->InProgress ? nullptr : callee;
+    }
+
+    void ControlFlowAnalyzer::ComputeStackDepth(Routine& routine)
+    {
+        std::map<size_t, int> entryDepths;
+        std::map<size_t, size_t> updates;
+        std::vector<size_t> pending{ BlockOf[routine.Entry] };
+
+        entryDepths[pending.back()] = 0;
+        routine.StackBounded = true;
+        routine.MaxStack = 0;
+
+        while (pending.empty() == false && routine.StackBounded)
+        {
+            const size_t b = pending.back();
+            pending.pop_back();
+
+            int depth = entryDepths[b];
+            for (size_t i = Blocks[b].First; i <= Blocks[b].Last && routine.StackBounded; ++i)
+            {
+                const Instruction& instruction = Instructions[i];
+
+                if (instruction.StackUnknown)
+                {
+                    routine.StackBounded = false;
+                    break;
+                }
+
+                if (instruction.Node->Opcode == OPCODE_JSR)
+                {
+                    const Routine* callee = GetCallee(instruction.Callee);
+                    if (callee == nullptr || callee->StackBounded == false)
+                    {
+                        routine.StackBounded = false;
+                        break;
+                    }
+
+                    routine.MaxStack = std::max(routine.MaxStack, depth + 2 + callee->MaxStack);
+                }
+
+                depth += instruction.StackEffect;
+                routine.MaxStack = std::max(routine.MaxStack, depth);
+            }
+
+            for (const size_t s : Blocks[b].Successors)
+            {
+                auto it = entryDepths.find(s);
+                if (it != entryDepths.end() && it->second >= depth)
+                    continue;
+
+                // a loop that keeps pushing never reaches a fixed point.
+                if (++updates[s] > Blocks.size())
+                {
+                    routine.StackBounded = false;
+                    break;
+                }
+
+                entryDepths[s] = depth;
+                pending.push_back(s);
+            }
+        }
+    }
+
+    bool ControlFlowAnalyzer::GetBlockCycles(const size_t block, unsigned long* cycles)
+    {
+        *cycles = 0;
+
+        for (size_t i = Blocks[block].First; i <= Blocks[block].Last; ++i)
+        {
+            const Instruction& instruction = Instructions[i];
+            *cycles += instruction.Cycles;
+
+            if (instruction.Node->Opcode == OPCODE_JSR)
+            {
+                const Routine* callee = GetCallee(instruction.Callee);
+                if (callee == nullptr || callee->CyclesBounded == false)
+                    return false;
+
+                *cycles += callee->MaxCycles;
+            }
+        }
+
+        return true;
+    }
+
+    void ControlFlowAnalyzer::ComputeCycles(Routine& routine)
+    {
+        struct Loop
+        {
+            size_t        First;
+            size_t        Last;
+            unsigned long Cycles;
+        };
+
+        routine.CyclesBounded = false;
+        routine.MaxCycles = 0;
+
+        if (routine.IndirectTransfers)
+            return;
+
+        std::map<size_t, unsigned long> blockCycles;
+        for (const size_t b : routine.Blocks)
+        {
+            if (GetBlockCycles(b, &blockCycles[b]) == false)
+                return;
+        }
+
+        // a back edge goes to a block that doesn't come later in the layout. The loop is
+        // approximated by the address range between its header and the furthest back edge.
+        std::map<size_t, size_t> loopEnds;
+        for (const size_t b : routine.Blocks)
+        {
+            for (const size_t s : Blocks[b].Successors)
+            {
+                if (Blocks[s].First <= Blocks[b].First)
+                    loopEnds[s] = std::max(loopEnds[s], Blocks[b].Last);
+            }
+        }
+
+        std::vector<Loop> loops;
+        for (const auto& loop : loopEnds)
+        {
+            unsigned int bound = 0;
+            for (const LabelNode* l = Instructions[Blocks[loop.first].First].Node->Labels; l != nullptr; l = l->Next)
+            {
+                auto it = LoopBounds.find(l->Name);
+                if (it != LoopBounds.end())
+                    bound = it->second;
+            }
+
+            if (bound == 0)
+                return;
+
+            loops.push_back(Loop{ Blocks[loop.first].First, loop.second, bound });
+        }
+
+        // inner loops first. Every block of a loop body whose inner loops are already collapsed
+        // runs at most once per iteration, so bound * sum of the body is a safe estimate.
+        std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.Last - a.First < b.Last - b.First; });
+
+        std::map<size_t, int> owners;
+        for (size_t l = 0; l < loops.size(); ++l)
+        {
+            unsigned long body = 0;
+            std::set<int> inner;
+
+            for (const size_t b : routine.Blocks)
+            {
+                if (Blocks[b].First < loops[l].First || Blocks[b].First > loops[l].Last)
+                    continue;
+
+                auto it = owners.find(b);
+                if (it == owners.end())
+                    body += blockCycles[b];
+                else if (inner.insert(it->second).second)
+                    body += loops[it->second].Cycles;
+            }
+
+            loops[l].Cycles *= body;
+
+            for (const size_t b : routine.Blocks)
+            {
+                auto it = owners.find(b);
+                const bool inRange = Blocks[b].First >= loops[l].First && Blocks[b].First <= loops[l].Last;
+                if (inRange || (it != owners.end() && inner.count(it->second) != 0))
+                    owners[b] = l;
+            }
+        }
+
+        // with the loops collapsed the remaining graph is acyclic in layout order, so the
+        // longest path is found by relaxing the edges in that order.
+        auto unitOf = [&](const size_t b) -> size_t {
+            auto it = owners.find(b);
+            return it == owners.end() ? b : Blocks.size() + it->second;
+        };
+        auto unitPosition = [&](const size_t u) -> size_t {
+            return u < Blocks.size() ? Blocks[u].First : loops[u - Blocks.size()].First;
+        };
+        auto unitCycles = [&](const size_t u) -> unsigned long {
+            return u < Blocks.size() ? blockCycles[u] : loops[u - Blocks.size()].Cycles;
+        };
+
+        std::map<size_t, std::vector<size_t>> units;
+        for (const size_t b : routine.Blocks)
+            units[unitOf(b)].push_back(b);
+
+        std::vector<size_t> order;
+        for (const auto& u : units)
+            order.push_back(u.first);
+
+        std::sort(order.begin(), order.end(), [&](const size_t a, const size_t b) { return unitPosition(a) < unitPosition(b); });
+
+        std::map<size_t, unsigned long> distances;
+        const size_t entry = unitOf(BlockOf[routine.Entry]);
+        distances[entry] = unitCycles(entry);
+
+        for (const size_t u : order)
+        {
+            auto it = distances.find(u);
+            if (it == distances.end())
+                continue;
+
+            const unsigned long distance = it->second;
+            routine.MaxCycles = std::max(routine.MaxCycles, distance);
+
+            for (const size_t b : units[u])
+            {
+                for (const size_t s : Blocks[b].Successors)
+                {
+                    const size_t v = unitOf(s);
+                    if (v == u || unitPosition(v) <= unitPosition(u))
+                        continue;
+
+                    unsigned long& d = distances[v];
+                    d = std::max(d, distance + unitCycles(v));
+                }
+            }
+        }
+
+        routine.CyclesBounded = true;
+    }
+
+    void ControlFlowAnalyzer::WriteReport(FILE* f) const
+    {
+        std::fprintf(f, "{\n  \"blocks\": [");
+        for (size_t b = 0; b < Blocks.size(); ++b)
+        {
+            const BasicBlock& block = Blocks[b];
+            std::fprintf(f, "%s\n    { \"id\": %zu, \"first_line\": %u, \"last_line\": %u, \"instructions\": %zu, \"successors\": ",
+                         b == 0 ? "" : ",", b, Instructions[block.First].Line, Instructions[block.Last].Line, block.Last - block.First + 1);
+            WriteIndices(f, block.Successors);
+            std::fprintf(f, " }");
+        }
+
+        std::fprintf(f, "\n  ],\n  \"routines\": [");
+        for (size_t r = 0; r < Routines.size(); ++r)
+        {
+            const Routine& routine = Routines[r];
+            std::fprintf(f, "%s\n    { \"name\": \"%s\", \"line\": %u, \"blocks\": ",
+                         r == 0 ? "" : ",", routine.Name.c_str(), Instructions[routine.Entry].Line);
+            WriteIndices(f, routine.Blocks);
+
+            std::fprintf(f, ", \"calls\": [");
+            for (size_t i = 0; i < routine.Callees.size(); ++i)
+                std::fprintf(f, "%s\"%s\"", i == 0 ? "" : ", ", routine.Callees[i].c_str());
+            std::fprintf(f, "], \"indirect_transfers\": %s", routine.IndirectTransfers ? "true" : "false");
+
+            if (routine.StackBounded)
+                std::fprintf(f, ", \"max_stack_bytes\": %d", routine.MaxStack);
+            else
+                std::fprintf(f, ", \"max_stack_bytes\": null");
+
+            if (routine.CyclesBounded)
+                std::fprintf(f, ", \"max_cycles\": %lu }", routine.MaxCycles);
+            else
+                std::fprintf(f, ", \"max_cycles\": null }");
+        }
+
+        std::fprintf(f, "\n  ]\n}\n");
+    }
+}
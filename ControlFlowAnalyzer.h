@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Ast.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace AST
+{
+    // Splits the program into basic blocks, builds the call graph from JSR targets and
+    // computes for every routine its worst-case stack depth and a worst-case cycle bound.
+    //
+    // Cycles are counted as memory cycles: one per instruction fetch, plus the extension
+    // words and operand references implied by the addressing modes. Loops are bounded only
+    // when their header label has an annotated iteration count.
+    class ControlFlowAnalyzer final : public AstVisitor
+    {
+    public:
+        ControlFlowAnalyzer(const std::map<std::string, unsigned int>& loopBounds);
+
+        virtual void Visit(CommandNode* node) override;
+        virtual void Visit(OneOperandCommandNode* node) override;
+        virtual void Visit(DoubleOperandCommandNode* node) override;
+        virtual void Visit(DataNode* node) override;
+
+        void Analyze();
+        void WriteReport(FILE* f) const;
+
+    private:
+        // Node is only read by Analyze: unreachable commands may be deleted right after it, so
+        // the report uses the line kept next to it.
+        struct Instruction
+        {
+            const CommandNode* Node;
+            unsigned int       Line;
+            unsigned int       Cycles;
+            int                StackEffect;
+            bool               StackUnknown;
+            const OperandNode* Target;
+            const char*        Callee;
+            bool               IndirectTransfer;
+        };
+
+        struct BasicBlock
+        {
+            size_t              First;
+            size_t              Last;
+            std::vector<size_t> Successors;
+        };
+
+        struct Routine
+        {
+            std::string              Name;
+            size_t                   Entry;
+            std::vector<size_t>      Blocks;
+            std::vector<std::string> Callees;
+            bool                     IndirectTransfers;
+            bool                     Analyzed;
+            bool                     InProgress;
+            bool                     StackBounded;
+            int                      MaxStack;
+            bool                     CyclesBounded;
+            unsigned long            MaxCycles;
+        };
+
+    private:
+        void AddInstruction(const CommandNode* node, const unsigned int cycles);
+        void AddOperand(const OperandNode* node, const bool isSource);
+        unsigned int GetOperandCycles(const OperandNode* node, const InstructionGroup g) const;
+
+        void BuildBlocks();
+        bool FindTarget(const OperandNode* node, size_t* instruction) const;
+        size_t GetRoutine(const std::string& name, const size_t entryInstruction);
+        void AnalyzeRoutine(const size_t r);
+        void CollectRoutineBlocks(Routine& routine);
+        void ComputeStackDepth(Routine& routine);
+        void ComputeCycles(Routine& routine);
+        bool GetBlockCycles(const size_t block, unsigned long* cycles);
+        const Routine* GetCallee(const char* name) const;
+
+    private:
+        const std::map<std::string, unsigned int>& LoopBounds;
+        std::vector<Instruction>                   Instructions;
+        std::map<std::string, size_t>              LabelsTable;
+        std::unordered_map<const CommandNode*, size_t> LocalTargets;
+        std::vector<BasicBlock>                    Blocks;
+        std::vector<size_t>                        BlockOf;
+        std::vector<Routine>                       Routines;
+        std::map<std::string, size_t>              RoutinesTable;
+    };
+}
@@ -0,0 +1,352 @@
+#include "EncoderCheck.h"
+
+#include "Ast.h"
+#include "CodeGenerator.h"
+#include "SemanticAnalyzer.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const int Opcodes[] = {
+        OPCODE_ADC, OPCODE_ADCB, OPCODE_ADD, OPCODE_ASH, OPCODE_ASHC, OPCODE_ASL, OPCODE_ASLB, OPCODE_ASR, OPCODE_ASRB,
+        OPCODE_BCC, OPCODE_BCS, OPCODE_BEQ, OPCODE_BGE, OPCODE_BGT, OPCODE_BHI, OPCODE_BHIS, OPCODE_BIC, OPCODE_BICB,
+        OPCODE_BIS, OPCODE_BISB, OPCODE_BIT, OPCODE_BITB, OPCODE_BLE, OPCODE_BLO, OPCODE_BLOS, OPCODE_BLT, OPCODE_BMI,
+        OPCODE_BNE, OPCODE_BPL, OPCODE_BPT, OPCODE_BR, OPCODE_BVC, OPCODE_BVS, OPCODE_CALL, OPCODE_CALLR, OPCODE_CCC,
+        OPCODE_CLC, OPCODE_CLN, OPCODE_CLR, OPCODE_CLRB, OPCODE_CLV, OPCODE_CLZ, OPCODE_CMP, OPCODE_CMPB, OPCODE_COM,
+        OPCODE_COMB, OPCODE_DEC, OPCODE_DECB, OPCODE_DIV, OPCODE_EMT, OPCODE_HALT, OPCODE_INC, OPCODE_INCB, OPCODE_IOT,
+        OPCODE_JMP, OPCODE_JSR, OPCODE_MOV, OPCODE_MOVB, OPCODE_MUL, OPCODE_NEG, OPCODE_NEGB, OPCODE_NOP, OPCODE_RETURN,
+        OPCODE_RTS, OPCODE_RTI, OPCODE_SUB, OPCODE_TST, OPCODE_TSTB, OPCODE_XOR,
+    };
+
+    // the register, offset and value of an operand depend on its position, so swapped operands show.
+    struct OperandForm
+    {
+        const char*    Text;
+        OperandType    OpType;
+        AddressingType AddrType;
+        const char*    Label;
+    };
+
+    const OperandForm Forms[] = {
+        { "R%d",     OperandType::Register,  AddressingType::Register,              nullptr },
+        { "(R%d)",   OperandType::Register,  AddressingType::RegisterDeferred,      nullptr },
+        { "(R%d)+",  OperandType::Register,  AddressingType::AutoIncrement,         nullptr },
+        { "@(R%d)+", OperandType::Register,  AddressingType::AutoIncrementDeferred, nullptr },
+        { "-(R%d)",  OperandType::Register,  AddressingType::AutoDecrement,         nullptr },
+        { "@-(R%d)", OperandType::Register,  AddressingType::AutoDecrementDeferred, nullptr },
+        { "X(R%d)",  OperandType::Register,  AddressingType::Index,                 nullptr },
+        { "@X(R%d)", OperandType::Register,  AddressingType::IndexDeferred,         nullptr },
+        { "#N",      OperandType::Number,    AddressingType::AutoIncrement,         nullptr },
+        { "@#N",     OperandType::Number,    AddressingType::AutoIncrementDeferred, nullptr },
+        { "N",       OperandType::Number,    AddressingType::Index,                 nullptr },
+        { "@N",      OperandType::Number,    AddressingType::IndexDeferred,         nullptr },
+        { "BACK",    OperandType::LabelName, AddressingType::Label,                 "BACK" },
+        { "NEAR",    OperandType::LabelName, AddressingType::Label,                 "NEAR" },
+        { "FAR",     OperandType::LabelName, AddressingType::Label,                 "FAR" },
+    };
+
+    const int FormCount = sizeof(Forms) / sizeof(Forms[0]);
+
+    // words between NEAR and FAR, so a short branch can't reach FAR.
+    const unsigned int FarDistance = 300;
+
+    AST::OperandNode* MakeOperand(const int form, const int position)
+    {
+        const OperandForm& f = Forms[form];
+        const int reg = 1 + position;
+        const int value = 5 + position * 0100;
+
+        if (f.AddrType == AddressingType::Label)
+            return new AST::OperandNode(f.OpType, -1, f.AddrType, f.Label);
+
+        if (f.OpType == OperandType::Number)
+            return new AST::OperandNode(f.OpType, value, f.AddrType, nullptr, value);
+
+        return new AST::OperandNode(f.OpType, reg, f.AddrType, nullptr, value + 1);
+    }
+
+    std::string GetFormText(const int form, const int position)
+    {
+        char text[16];
+        std::snprintf(text, sizeof(text), Forms[form].Text, 1 + position);
+        return text;
+    }
+
+    void Append(AST::CommandNode** last, AST::CommandNode* node, const char* label = nullptr)
+    {
+        if (label != nullptr)
+            node->Labels = new AST::LabelNode(strdup(label));
+
+        (*last)->Next = node;
+        *last = node;
+    }
+
+    // The second pass as it was before it encoded through a table: every operand is looked at when
+    // it's encoded. Labels are laid out by the first pass, which also picks the form of every jump.
+    class ReferenceEncoder final : public AST::AstVisitor
+    {
+    public:
+        explicit ReferenceEncoder(const bool pic)
+            : Pic(pic)
+        {
+        }
+
+        virtual void Visit(AST::ProgramNode* node) override
+        {
+            for (const AST::CommandNode* n = node->Commands; n != nullptr; n = n->Next)
+            {
+                for (const AST::LabelNode* l = n->Labels; l != nullptr; l = l->Next)
+                    LabelsTable[l->Name] = n->InstructionNumber;
+            }
+        }
+
+        virtual void Visit(AST::CommandNode* node) override
+        {
+            Program.push_back(static_cast<Word>(node->Opcode));
+        }
+
+        virtual void Visit(AST::OneOperandCommandNode* node) override
+        {
+            const InstructionGroup g = AST::GetInstructionGroup(node->Opcode);
+            std::vector<Word> additionalWords;
+            const unsigned int instr = static_cast<unsigned int>(Program.size());
+
+            if (node->First->AddrType == AddressingType::Label && (g == InstructionGroup::Branch || node->Opcode == OPCODE_JMP))
+            {
+                const Word rawLabel = GetRawLabel(node->First);
+                if (node->Form == JumpForm::Short)
+                {
+                    const Word opcode = static_cast<Word>(g == InstructionGroup::Branch ? node->Opcode : OPCODE_BR);
+                    Program.push_back(opcode | static_cast<Byte>(static_cast<Byte>(rawLabel - instr) - 1));
+                    return;
+                }
+
+                if (node->Opcode != OPCODE_BR && node->Opcode != OPCODE_JMP)
+                    Program.push_back(static_cast<Word>(AST::GetInvertedBranchOpcode(node->Opcode) | 2));
+
+                const Word op = ConstructLabelOperand(rawLabel, static_cast<unsigned int>(Program.size()), &additionalWords);
+                Emit(OPCODE_JMP | op, additionalWords);
+                return;
+            }
+
+            Word op = 0;
+            if (node->First->AddrType == AddressingType::Label)
+            {
+                CheckPicLabel(node);
+                op = ConstructLabelOperand(GetRawLabel(node->First), instr, &additionalWords);
+            }
+            else
+                op = GetRawOperand(node->First, &additionalWords);
+
+            Emit(static_cast<Word>(node->Opcode) | op, additionalWords);
+        }
+
+        virtual void Visit(AST::DoubleOperandCommandNode* node) override
+        {
+            const bool oneAndHalf = AST::GetInstructionGroup(node->Opcode) == InstructionGroup::OneAndHalf;
+            const unsigned int instr = static_cast<unsigned int>(Program.size());
+            std::vector<Word> additionalWords;
+
+            if (node->First->AddrType == AddressingType::Label || node->Second->AddrType == AddressingType::Label)
+                CheckPicLabel(node);
+
+            Word raw = static_cast<Word>(node->Opcode);
+            raw |= ConstructDoubleOperand(node->Second, instr, oneAndHalf, &additionalWords) << 6;
+            raw |= ConstructDoubleOperand(node->First, instr, oneAndHalf, &additionalWords);
+
+            Emit(raw, additionalWords);
+        }
+
+        virtual void Visit(AST::DataNode* node) override
+        {
+            const size_t begin = Program.size();
+            Program.resize(begin + node->GetWords());
+            if (node->Bytes.empty() == false)
+                std::memcpy(Program.data() + begin, node->Bytes.data(), node->Bytes.size());
+        }
+
+        inline const std::vector<Word>& GetProgram() const
+        {
+            return Program;
+        }
+
+        // whether the program has a label operand --pic can't encode.
+        inline bool RejectsPic() const
+        {
+            return Rejects;
+        }
+
+    private:
+        void CheckPicLabel(const AST::CommandNode* node)
+        {
+            if (Pic && AST::TransfersToOperand(node->Opcode) == false)
+                Rejects = true;
+        }
+
+        void Emit(const Word raw, const std::vector<Word>& additionalWords)
+        {
+            Program.push_back(raw);
+            Program.insert(Program.end(), additionalWords.begin(), additionalWords.end());
+        }
+
+        Word GetRawLabel(const AST::OperandNode* opNode) const
+        {
+            return static_cast<Word>(LabelsTable.at(opNode->LabelName));
+        }
+
+        Word GetRawOperand(const AST::OperandNode* opNode, std::vector<Word>* additionalWords) const
+        {
+            Word op = 0;
+            if (opNode->OpType == OperandType::Number)
+            {
+                additionalWords->push_back(static_cast<Word>(opNode->Value));
+                op = RegisterNumber::PC;
+            }
+            else
+            {
+                if (opNode->AddrType == AddressingType::Index || opNode->AddrType == AddressingType::IndexDeferred)
+                    additionalWords->push_back(static_cast<Word>(opNode->IndexedOffset));
+                op = static_cast<Word>(opNode->Value);
+            }
+
+            return op | static_cast<Word>(static_cast<int>(opNode->AddrType) << 3);
+        }
+
+        Word ConstructLabelOperand(const Word rawLabel, const unsigned int instr, std::vector<Word>* additionalWords) const
+        {
+            if (Pic)
+            {
+                const int next = instr + 1 + static_cast<int>(additionalWords->size()) + 1;
+                additionalWords->push_back(static_cast<Word>((rawLabel - next) * sizeof(Word)));
+                return RegisterNumber::PC | static_cast<int>(AddressingType::Index) << 3;
+            }
+
+            additionalWords->push_back(static_cast<Word>(rawLabel * sizeof(Word) + GetROMBegining()));
+            return RegisterNumber::PC | static_cast<int>(AddressingType::AutoIncrement) << 3;
+        }
+
+        Word ConstructDoubleOperand(const AST::OperandNode* opNode, const unsigned int instr, const bool oneAndHalf, std::vector<Word>* additionalWords) const
+        {
+            if (opNode->AddrType == AddressingType::Label)
+                return ConstructLabelOperand(GetRawLabel(opNode), instr, additionalWords);
+
+            const Word op = GetRawOperand(opNode, additionalWords);
+            return oneAndHalf ? op & 07 : op;
+        }
+
+    private:
+        const bool                 Pic;
+        bool                       Rejects = false;
+        std::map<std::string, int> LabelsTable;
+        std::vector<Word>          Program;
+    };
+}
+
+bool EncoderCheck::Run(FILE* f)
+{
+    Compared = 0;
+    Rejected = 0;
+    RejectedPic = 0;
+    Mismatches = 0;
+
+    // -1 is no operand.
+    for (const int opcode : Opcodes)
+    {
+        for (int first = -1; first < FormCount; ++first)
+        {
+            for (int second = -1; second < (first < 0 ? 0 : FormCount); ++second)
+            {
+                RunCase(f, opcode, first, second, false);
+                RunCase(f, opcode, first, second, true);
+            }
+        }
+    }
+
+    std::fprintf(f, "encoders: %u cases compared, %u rejected by the semantic analysis, %u label operands rejected by --pic, %u mismatches.\n",
+                 Compared, Rejected, RejectedPic, Mismatches);
+    return Mismatches == 0;
+}
+
+bool EncoderCheck::RunCase(FILE* f, const int opcode, const int first, const int second, const bool pic)
+{
+    // BACK: NOP / the case / NEAR: NOP / .BLKW FarDistance / FAR: NOP
+    const SourceLocation location{ 0, 2 };
+    AST::CommandNode* head = new AST::CommandNode(OPCODE_NOP, SourceLocation{ 0, 1 });
+    head->Labels = new AST::LabelNode(strdup("BACK"));
+    AST::CommandNode* last = head;
+
+    if (first < 0)
+        Append(&last, new AST::CommandNode(opcode, location));
+    else if (second < 0)
+        Append(&last, new AST::OneOperandCommandNode(opcode, MakeOperand(first, 0), location));
+    else
+        Append(&last, new AST::DoubleOperandCommandNode(opcode, MakeOperand(first, 0), MakeOperand(second, 1), location));
+
+    Append(&last, new AST::CommandNode(OPCODE_NOP, SourceLocation{ 0, 3 }), "NEAR");
+    AST::DataNode* data = new AST::DataNode(SourceLocation{ 0, 4 });
+    data->Reserve(FarDistance * sizeof(Word));
+    Append(&last, data);
+    Append(&last, new AST::CommandNode(OPCODE_NOP, SourceLocation{ 0, 5 }), "FAR");
+
+    AST::AbstractSyntaxTree ast;
+    ast.SetProgram(new AST::ProgramNode(head));
+
+    AST::SemanticAnalyzer sa;
+    ast.Traverse(sa);
+    if (sa.GetErrors().empty() == false)
+    {
+        ++Rejected;
+        return true;
+    }
+
+    AST::CodeGeneratorOptions options;
+    options.PositionIndependent = pic;
+    AST::CodeGenerator codeGen{ options };
+    const std::vector<Word> program = codeGen.Generate(&ast);
+
+    ReferenceEncoder reference{ pic };
+    ast.Traverse(reference);
+
+    // a case --pic rejects has to be rejected for its label operands alone.
+    if (reference.RejectsPic())
+    {
+        const std::vector<AST::Error>& errors = codeGen.GetErrors();
+        const bool rejected = errors.empty() == false && std::all_of(errors.begin(), errors.end(),
+                                                                     [](const AST::Error& e) { return e.Id == AST::MessageId::PicLabelOperand; });
+        if (rejected)
+        {
+            ++RejectedPic;
+            return true;
+        }
+    }
+
+    ++Compared;
+    if (reference.RejectsPic() == false && codeGen.GetErrors().empty() && program == reference.GetProgram())
+        return true;
+
+    ++Mismatches;
+    std::string text;
+    if (first >= 0)
+        text += " " + GetFormText(first, 0);
+    if (second >= 0)
+        text += "," + GetFormText(second, 1);
+
+    // the case starts at word 1 and takes at most three words.
+    const std::vector<Word>& expected = reference.GetProgram();
+    std::fprintf(f, "opcode %06o%s%s:", opcode, text.c_str(), pic ? " with --pic" : "");
+    for (size_t i = 1; i < 4 && i < program.size(); ++i)
+        std::fprintf(f, " %06o", program[i]);
+    std::fprintf(f, ", expected");
+    for (size_t i = 1; i < 4 && i < expected.size(); ++i)
+        std::fprintf(f, " %06o", expected[i]);
+    std::fprintf(f, codeGen.GetErrors().empty() ? "\n" : " (with errors)\n");
+
+    return false;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+
+// Compares the second pass with the operand-driven encoder it replaced, which is kept in
+// EncoderCheck.cpp as the reference. Every opcode is encoded with no operand, with each operand
+// form and with every pair of them, against a label behind it, a near one and a far one, with and
+// without --pic. Cases the semantic analysis rejects are only counted, as they are never encoded;
+// label operands --pic can't encode have to be rejected by the encoder.
+class EncoderCheck
+{
+public:
+    // reports every case that encodes differently to f, returns whether there was none.
+    bool Run(FILE* f);
+
+private:
+    bool RunCase(FILE* f, const int opcode, const int first, const int second, const bool pic);
+
+private:
+    unsigned int Compared = 0;
+    unsigned int Rejected = 0;
+    unsigned int RejectedPic = 0;
+    unsigned int Mismatches = 0;
+};
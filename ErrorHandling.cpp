@@ -3,11 +3,60 @@
 
 namespace AST
 {
+    namespace
+    {
+        // in the order of MessageId; {N} is replaced by the argument N.
+        const char* const Messages[] =
+        {
+            "wrong operands number.",
+            "wrong operand (second operand is expected to be a register).",
+            "wrong operand(label or int is expected).",
+            "wrong operand(a branch target is expected to be a label).",
+            "wrong operand(RTS expects only a register.)",
+            "Label doesn't exist:{0}",
+            "{0}",
+            "expression can't be relocated",
+            "a byte can't be relocated",
+            "label {0} is in segment {1}, which isn't mapped while this segment runs",
+            "the address of {0} can't be an operand with --pic: only JMP and JSR can refer to a label PC-relative",
+        };
+    }
+
+    ErrorDumper::ErrorDumper(const SourceFiles* files)
+        : Files(files)
+    {
+    }
+
+    std::string ErrorDumper::Format(const Error& error)
+    {
+        std::string message = error.Variant.empty() ? "" : "variant " + error.Variant + ": ";
+
+        for (const char* c = Messages[static_cast<int>(error.Id)]; *c != '\0'; ++c)
+        {
+            const size_t argument = static_cast<size_t>(c[1] - '0');
+            if (c[0] == '{' && argument < error.Arguments.size() && c[2] == '}')
+            {
+                message += error.Arguments[argument];
+                c += 2;
+            }
+            else
+            {
+                message += *c;
+            }
+        }
+
+        return message;
+    }
+
     void ErrorDumper::Dump(const std::vector<Error>& errors)
     {
         for (const auto& e : errors)
         {
-            std::fprintf(stderr, "line:%d error:%s\n", e.ErrorNode->Line, e.Message.c_str());
+            const std::string message = Format(e);
+            if (Files != nullptr)
+                std::fprintf(stderr, "%s: line:%u error:%s\n", Files->GetPath(e.Location.GetFile()).c_str(), e.Location.GetLine(), message.c_str());
+            else
+                std::fprintf(stderr, "line:%u error:%s\n", e.Location.GetLine(), message.c_str());
         }
     }
-}
\ No newline at end of file
+}
@@ -1,21 +1,53 @@
 #pragma once
 
-#include "Ast.h"
+#include "SourceLocation.h"
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace AST
 {
+    // the message of an error is only formatted from its id and arguments when it's printed.
+    enum class MessageId : uint8_t
+    {
+        WrongOperandsNumber,
+        SecondOperandNotRegister,
+        LabelOrNumberExpected,
+        BranchTargetNotLabel,
+        RtsOperandNotRegister,
+        // {0}: the label.
+        UndefinedLabel,
+        // {0}: what the expression evaluator reported.
+        ExpressionError,
+        ExpressionNotRelocatable,
+        ByteNotRelocatable,
+        // {0}: the label, {1}: the segment it's in.
+        CrossSegmentReference,
+        // {0}: the label.
+        PicLabelOperand,
+    };
+
+    // An error keeps no pointer into the tree, so the tree can be freed once it's encoded.
     struct Error
     {
-        const CommandNode* ErrorNode;
-        std::string Message;
+        SourceLocation           Location;
+        MessageId                Id;
+        std::vector<std::string> Arguments;
+        // the variant the error was found in, empty if the program has no variants.
+        std::string              Variant;
     };
 
     class ErrorDumper
     {
     public:
+        // without the files, errors are printed without the path of their file.
+        explicit ErrorDumper(const SourceFiles* files = nullptr);
+
         void Dump(const std::vector<Error>& errors);
+        static std::string Format(const Error& error);
+
+    private:
+        const SourceFiles* Files;
     };
-}
\ No newline at end of file
+}
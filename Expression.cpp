@@ -0,0 +1,366 @@
+#include "Expression.h"
+#include "LocalLabels.h"
+
+#include <algorithm>
+
+namespace AST
+{
+    // 32-bit two's complement arithmetic; the code generator keeps the low word of the result.
+    bool ApplyExpressionOp(const ExpressionOp op, const int left, const int right, int* result)
+    {
+        const unsigned int a = static_cast<unsigned int>(left);
+        const unsigned int b = static_cast<unsigned int>(right);
+
+        switch (op)
+        {
+        case ExpressionOp::Negate:   *result = static_cast<int>(0u - a); return true;
+        case ExpressionOp::Add:      *result = static_cast<int>(a + b);  return true;
+        case ExpressionOp::Subtract: *result = static_cast<int>(a - b);  return true;
+        case ExpressionOp::Multiply: *result = static_cast<int>(a * b);  return true;
+        case ExpressionOp::And:      *result = static_cast<int>(a & b);  return true;
+        case ExpressionOp::Or:       *result = static_cast<int>(a | b);  return true;
+
+        case ExpressionOp::Divide:
+            if (right == 0)
+                return false;
+
+            *result = right == -1 ? static_cast<int>(0u - a) : left / right;
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    Expression ExpressionTable::MakeConstant(const int value)
+    {
+        const uint32_t begin = static_cast<uint32_t>(Codes.size());
+        Codes.push_back(Code{ ExpressionOp::Constant, value });
+
+        return Expression{ value, begin, true };
+    }
+
+    Expression ExpressionTable::MakeReference(const char* name)
+    {
+        const uint32_t begin = static_cast<uint32_t>(Codes.size());
+
+        auto it = SymbolIndexes.find(name);
+        if (it != SymbolIndexes.end() && Symbols[it->second].Assigned)
+        {
+            const Symbol& symbol = Symbols[it->second];
+            if (symbol.Constant)
+                return MakeConstant(symbol.Value);
+
+            Symbols[it->second].Referenced = true;
+            Codes.push_back(Code{ ExpressionOp::Symbol, it->second });
+            return Expression{ 0, begin, false };
+        }
+
+        // most names are labels of jumps, which need no symbol.
+        Codes.push_back(Code{ ExpressionOp::Name, static_cast<int>(Names.size()) });
+        Names.push_back(name);
+
+        return Expression{ 0, begin, false };
+    }
+
+    Expression ExpressionTable::MakeUnary(const ExpressionOp op, const Expression& operand)
+    {
+        int value = 0;
+        if (operand.Constant && ApplyExpressionOp(op, operand.Value, 0, &value))
+        {
+            Drop(operand);
+            return MakeConstant(value);
+        }
+
+        Codes.push_back(Code{ op, 0 });
+        return Expression{ 0, operand.Begin, false };
+    }
+
+    Expression ExpressionTable::MakeBinary(const ExpressionOp op, const Expression& left, const Expression& right)
+    {
+        // the code of right follows the code of left, so both are dropped together.
+        int value = 0;
+        if (left.Constant && right.Constant && ApplyExpressionOp(op, left.Value, right.Value, &value))
+        {
+            Drop(left);
+            return MakeConstant(value);
+        }
+
+        Codes.push_back(Code{ op, 0 });
+        return Expression{ 0, left.Begin, false };
+    }
+
+    const char* ExpressionTable::TakeLabel(const Expression& e)
+    {
+        if (e.Constant || Codes.size() != e.Begin + 1 || Codes[e.Begin].Op != ExpressionOp::Name)
+            return nullptr;
+
+        const char* name = Names[Codes[e.Begin].Operand];
+        Drop(e);
+        Names.clear();
+
+        return name;
+    }
+
+    int ExpressionTable::AddFixup(const Expression& e)
+    {
+        if (e.Constant)
+        {
+            Drop(e);
+            Names.clear();
+            return -1;
+        }
+
+        End(e);
+        Fixups.push_back(Fixup{ e.Begin, static_cast<uint32_t>(Codes.size()) });
+        return static_cast<int>(Fixups.size()) - 1;
+    }
+
+    void ExpressionTable::Assign(const char* name, const Expression& e)
+    {
+        // the expression first, `N = N + 1` refers to the previous N.
+        if (e.Constant)
+        {
+            Drop(e);
+            Names.clear();
+        }
+        else
+        {
+            End(e);
+        }
+
+        // code that already refers to an assigned symbol keeps its definition, so the symbol is given
+        // a new one for the uses that follow. Uses before the first assignment get the first one.
+        int index = GetSymbolIndex(name);
+        if (Symbols[index].Assigned && Symbols[index].Referenced)
+        {
+            index = static_cast<int>(Symbols.size());
+            Symbols.push_back(Symbol{ name, false, false, false, 0, Fixup{ 0, 0 } });
+            SymbolIndexes[name] = index;
+        }
+
+        Symbol& symbol = Symbols[index];
+        symbol.Assigned = true;
+        symbol.Constant = e.Constant;
+        symbol.Value = e.Value;
+        symbol.Definition = Fixup{ e.Begin, static_cast<uint32_t>(Codes.size()) };
+    }
+
+    std::vector<std::string> ExpressionTable::GetReferencedSymbols() const
+    {
+        // folded code is dropped as soon as it is folded, so all the code left is referenced.
+        std::vector<bool> referenced(Symbols.size(), false);
+        for (const Code& c : Codes)
+        {
+            if (c.Op == ExpressionOp::Symbol)
+                referenced[c.Operand] = true;
+        }
+
+        std::vector<std::string> names;
+        for (size_t i = 0; i < Symbols.size(); ++i)
+        {
+            if (referenced[i])
+                names.push_back(Symbols[i].Name);
+        }
+
+        // a symbol assigned several times has a definition for each, so its name is only added once.
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+
+        return names;
+    }
+
+    std::vector<const CommandNode*> ExpressionTable::GetReferencedCommands() const
+    {
+        std::vector<const CommandNode*> commands;
+        for (const Code& c : Codes)
+        {
+            if (c.Op == ExpressionOp::Command && Locals[c.Operand].Command != nullptr)
+                commands.push_back(Locals[c.Operand].Command);
+        }
+
+        return commands;
+    }
+
+    bool ExpressionTable::BindLocals(const LocalResolver& resolve, std::string* unresolved)
+    {
+        bool ok = true;
+        for (; BoundLocals < Locals.size(); ++BoundLocals)
+        {
+            LocalLabel& local = Locals[BoundLocals];
+            local.Command = resolve(local.Name);
+            if (local.Command == nullptr && ok)
+            {
+                *unresolved = local.Name;
+                ok = false;
+            }
+        }
+
+        return ok;
+    }
+
+    int ExpressionTable::GetSymbolIndex(const char* name)
+    {
+        auto it = SymbolIndexes.find(name);
+        if (it != SymbolIndexes.end())
+            return it->second;
+
+        const int index = static_cast<int>(Symbols.size());
+        Symbols.push_back(Symbol{ name, false, false, false, 0, Fixup{ 0, 0 } });
+        SymbolIndexes.emplace(name, index);
+
+        return index;
+    }
+
+    void ExpressionTable::Drop(const Expression& e)
+    {
+        Codes.resize(e.Begin);
+    }
+
+    void ExpressionTable::End(const Expression& e)
+    {
+        for (size_t i = e.Begin; i < Codes.size(); ++i)
+        {
+            if (Codes[i].Op == ExpressionOp::Name && LocalLabels::IsLocal(Names[Codes[i].Operand]))
+            {
+                Locals.push_back(LocalLabel{ Names[Codes[i].Operand], nullptr });
+                Codes[i] = Code{ ExpressionOp::Command, static_cast<int>(Locals.size()) - 1 };
+            }
+            else if (Codes[i].Op == ExpressionOp::Name)
+            {
+                const int symbol = GetSymbolIndex(Names[Codes[i].Operand]);
+                Symbols[symbol].Referenced = true;
+                Codes[i] = Code{ ExpressionOp::Symbol, symbol };
+            }
+        }
+
+        Names.clear();
+    }
+
+    ExpressionEvaluator::ExpressionEvaluator(const ExpressionTable& table, const LabelResolver& labels, const CommandResolver& commands)
+        : Table(table)
+        , Labels(labels)
+        , Commands(commands)
+        , States(table.Symbols.size(), SymbolState::Unknown)
+        , Values(table.Symbols.size(), 0)
+    {
+    }
+
+    bool ExpressionEvaluator::Evaluate(const int fixup, int* value, std::string* error)
+    {
+        return Evaluate(Table.Fixups[fixup], value, error);
+    }
+
+    bool ExpressionEvaluator::Evaluate(const Fixup& code, int* value, std::string* error)
+    {
+        // symbols are evaluated on top of the operands of the expression that refers to them.
+        const size_t base = Stack.size();
+
+        for (uint32_t i = code.Begin; i < code.End; ++i)
+        {
+            const ExpressionTable::Code& c = Table.Codes[i];
+
+            switch (c.Op)
+            {
+            case ExpressionOp::Constant:
+                Stack.push_back(c.Operand);
+                break;
+
+            case ExpressionOp::Symbol:
+            {
+                int symbolValue = 0;
+                if (EvaluateSymbol(c.Operand, &symbolValue, error) == false)
+                {
+                    Stack.resize(base);
+                    return false;
+                }
+
+                Stack.push_back(symbolValue);
+                break;
+            }
+
+            case ExpressionOp::Command:
+            {
+                const ExpressionTable::LocalLabel& local = Table.Locals[c.Operand];
+                if (local.Command == nullptr)
+                {
+                    *error = "Symbol doesn't exist:" + local.Name;
+                    Stack.resize(base);
+                    return false;
+                }
+
+                Stack.push_back(Commands(local.Command));
+                break;
+            }
+
+            case ExpressionOp::Negate:
+                ApplyExpressionOp(c.Op, Stack.back(), 0, &Stack.back());
+                break;
+
+            default:
+            {
+                const int right = Stack.back();
+                Stack.pop_back();
+
+                if (ApplyExpressionOp(c.Op, Stack.back(), right, &Stack.back()) == false)
+                {
+                    *error = "Division by zero";
+                    Stack.resize(base);
+                    return false;
+                }
+                break;
+            }
+            }
+        }
+
+        *value = Stack.back();
+        Stack.resize(base);
+        return true;
+    }
+
+    bool ExpressionEvaluator::EvaluateSymbol(const int symbol, int* value, std::string* error)
+    {
+        const ExpressionTable::Symbol& s = Table.Symbols[symbol];
+
+        switch (States[symbol])
+        {
+        case SymbolState::Known:
+            *value = Values[symbol];
+            return true;
+
+        case SymbolState::Evaluating:
+            *error = "Symbol is defined in terms of itself:" + s.Name;
+            return false;
+
+        case SymbolState::Unknown:
+            break;
+        }
+
+        if (s.Assigned == false)
+        {
+            // a symbol that is never assigned names a label.
+            if (Labels(s.Name, value) == false)
+            {
+                *error = "Symbol doesn't exist:" + s.Name;
+                return false;
+            }
+        }
+        else if (s.Constant)
+        {
+            *value = s.Value;
+        }
+        else
+        {
+            States[symbol] = SymbolState::Evaluating;
+            if (Evaluate(s.Definition, value, error) == false)
+            {
+                States[symbol] = SymbolState::Unknown;
+                return false;
+            }
+        }
+
+        States[symbol] = SymbolState::Known;
+        Values[symbol] = *value;
+        return true;
+    }
+}
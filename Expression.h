@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace AST
+{
+    class CommandNode;
+
+    enum class ExpressionOp : unsigned char
+    {
+        Constant,
+        Symbol,
+        // a symbol the parser has not looked up yet, so a bare label operand costs no symbol.
+        Name,
+        // the command a local label labels, which is only known once the scope of the label ends.
+        Command,
+        Negate,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        And,
+        Or,
+    };
+
+    // applies a unary or binary operator; false for a division by zero.
+    bool ApplyExpressionOp(const ExpressionOp op, const int left, const int right, int* result);
+
+    // an expression on the parser stack. Value is only meaningful if Constant is set, otherwise the
+    // expression is the code of the table from Begin to its end.
+    struct Expression
+    {
+        int      Value;
+        uint32_t Begin;
+        bool     Constant;
+    };
+
+    // the code of an operand value that is only known once the program is laid out.
+    struct Fixup
+    {
+        uint32_t Begin;
+        uint32_t End;
+    };
+
+    // Expressions of a program and the symbols assigned with `NAME = EXPRESSION`.
+    //
+    // A local label (1$, 2$, ...) in an expression refers to the command it labels instead of a
+    // symbol, as local labels never reach the labels tables; the parser binds it at the end of the
+    // label's scope.
+    //
+    // A name refers to the definition assigned last before it. Assigning a symbol that code already
+    // refers to adds a new definition under the same name, so `N = LABEL` and `N = N + 2` are two
+    // symbols; a name used before its first assignment refers to the first one.
+    //
+    // The parser builds every expression bottom up as postfix code at the end of one array. Whenever
+    // both operands of an operator are constants, their code is dropped again and the result takes
+    // its place, so only expressions that depend on a label, or on a symbol not assigned yet, keep
+    // any code. An operand keeps the index of a Fixup, the range of code to evaluate after layout.
+    class ExpressionTable
+    {
+    public:
+        ExpressionTable() = default;
+        ExpressionTable(ExpressionTable&&) = default;
+        ExpressionTable& operator=(ExpressionTable&&) = default;
+
+        ExpressionTable(const ExpressionTable&) = delete;
+        ExpressionTable& operator=(const ExpressionTable&) = delete;
+
+        Expression MakeConstant(const int value);
+        Expression MakeReference(const char* name);
+        Expression MakeUnary(const ExpressionOp op, const Expression& operand);
+        Expression MakeBinary(const ExpressionOp op, const Expression& left, const Expression& right);
+
+        // the name of the label the expression consists of, nullptr if it is anything else. The code
+        // of the expression is dropped, so the label can be used like a label operand.
+        const char* TakeLabel(const Expression& e);
+        // AddFixup, Assign and TakeLabel end an expression; until then it may be folded further.
+        // the fixup to evaluate the expression after layout, -1 for a constant, whose code is dropped.
+        int AddFixup(const Expression& e);
+        void Assign(const char* name, const Expression& e);
+
+        // the symbols the code of any fixup or symbol refers to.
+        std::vector<std::string> GetReferencedSymbols() const;
+        // the commands local labels in the code of any fixup or symbol label.
+        std::vector<const CommandNode*> GetReferencedCommands() const;
+
+        typedef std::function<const CommandNode*(const std::string& name)> LocalResolver;
+        // gives every local label the expressions ended since the last call refer to the command it
+        // labels. false, with the name in unresolved, if the scope doesn't define one of them.
+        bool BindLocals(const LocalResolver& resolve, std::string* unresolved);
+
+        inline size_t GetFixupCount() const;
+
+    private:
+        friend class ExpressionEvaluator;
+
+        struct Code
+        {
+            ExpressionOp Op;
+            int          Operand;
+        };
+
+        struct LocalLabel
+        {
+            std::string        Name;
+            const CommandNode* Command;
+        };
+
+        struct Symbol
+        {
+            std::string Name;
+            bool        Assigned;
+            // whether any code refers to this definition of the symbol.
+            bool        Referenced;
+            bool        Constant;
+            int         Value;
+            Fixup       Definition;
+        };
+
+        int GetSymbolIndex(const char* name);
+        void Drop(const Expression& e);
+        void End(const Expression& e);
+
+    private:
+        std::vector<Code>                    Codes;
+        std::vector<const char*>             Names;
+        std::vector<Fixup>                   Fixups;
+        std::vector<Symbol>                  Symbols;
+        std::unordered_map<std::string, int> SymbolIndexes;
+        std::vector<LocalLabel>              Locals;
+        size_t                               BoundLocals = 0;
+    };
+
+    // Evaluates the fixups of a table once the labels have addresses. A symbol is evaluated once and
+    // its value is kept for every other fixup that refers to it.
+    class ExpressionEvaluator
+    {
+    public:
+        typedef std::function<bool(const std::string& label, int* address)> LabelResolver;
+        typedef std::function<int(const CommandNode* command)>              CommandResolver;
+
+        ExpressionEvaluator(const ExpressionTable& table, const LabelResolver& labels, const CommandResolver& commands);
+
+        // false, with the reason in error, if a symbol is undefined or defined in terms of itself,
+        // or if the expression divides by zero.
+        bool Evaluate(const int fixup, int* value, std::string* error);
+
+    private:
+        enum class SymbolState : unsigned char
+        {
+            Unknown,
+            Evaluating,
+            Known,
+        };
+
+        bool Evaluate(const Fixup& code, int* value, std::string* error);
+        bool EvaluateSymbol(const int symbol, int* value, std::string* error);
+
+    private:
+        const ExpressionTable&   Table;
+        LabelResolver            Labels;
+        CommandResolver          Commands;
+        std::vector<SymbolState> States;
+        std::vector<int>         Values;
+        std::vector<int>         Stack;
+    };
+
+    size_t ExpressionTable::GetFixupCount() const
+    {
+        return Fixups.size();
+    }
+}
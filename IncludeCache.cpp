@@ -0,0 +1,130 @@
+#include "IncludeCache.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+extern int yylex();
+extern int yylineno;
+extern YYSTYPE ScannerValue;
+
+void DeferScannerErrors(std::string* message);
+void PushScannerFile(FILE* f);
+void PopScannerFile();
+
+IncludeCache::IncludeCache(const std::vector<std::string>& directories)
+    : Directories(directories)
+{
+}
+
+bool IncludeCache::Load(const std::string& name, std::string* path, SharedTokens* tokens, std::string* error)
+{
+    Entry entry;
+    if (Find(name, path, &entry) == false)
+    {
+        *error = "can't find the included file " + name;
+        return false;
+    }
+
+    auto it = Entries.find(*path);
+    if (it != Entries.end() && it->second.ModificationTime == entry.ModificationTime && it->second.Size == entry.Size)
+    {
+        ++Stats.Hits;
+        *tokens = it->second.Tokens;
+        return true;
+    }
+
+    std::vector<Token> scanned;
+    if (Scan(*path, &scanned, error) == false)
+        return false;
+
+    ++Stats.Scans;
+    entry.Tokens = std::make_shared<const std::vector<Token>>(std::move(scanned));
+    Entries[*path] = entry;
+
+    *tokens = entry.Tokens;
+    return true;
+}
+
+bool IncludeCache::Find(const std::string& name, std::string* path, Entry* entry) const
+{
+    for (size_t i = 0; i <= Directories.size(); ++i)
+    {
+        // an absolute name is only looked for as it is.
+        if (i > 0 && name.empty() == false && name[0] == '/')
+            break;
+
+        const std::string candidate = i == 0 ? name : Directories[i - 1] + "/" + name;
+
+        struct stat status;
+        if (stat(candidate.c_str(), &status) != 0 || S_ISREG(status.st_mode) == false)
+            continue;
+
+#ifdef __linux__
+        entry->ModificationTime = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#else
+        entry->ModificationTime = static_cast<int64_t>(status.st_mtime);
+#endif
+        entry->Size = static_cast<int64_t>(status.st_size);
+
+        *path = candidate;
+        return true;
+    }
+
+    return false;
+}
+
+bool IncludeCache::Scan(const std::string& path, std::vector<Token>* tokens, std::string* error)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+    {
+        *error = "can't open the included file " + path;
+        return false;
+    }
+
+    // the file that includes this one has been scanned up to its line so far.
+    const int line = yylineno;
+    yylineno = 1;
+    PushScannerFile(f);
+
+    // an error of the included file is reported by the directive that includes it.
+    std::string scannerError;
+    DeferScannerErrors(&scannerError);
+
+    bool ok = true;
+    for (;;)
+    {
+        Token token;
+        token.Kind = yylex();
+        token.Line = yylineno;
+        token.Value = ScannerValue;
+
+        if (token.Kind == 0)
+            break;
+
+        if (token.Kind == SCANNER_ERROR)
+        {
+            *error = path + ":" + std::to_string(token.Line) + ": " + scannerError;
+            ok = false;
+            break;
+        }
+
+        if (HasString(token.Kind))
+        {
+            char* scanned = token.Value.sval;
+            token.Value.sval = const_cast<char*>(Strings.insert(scanned).first->c_str());
+            free(scanned);
+        }
+
+        tokens->push_back(token);
+    }
+
+    DeferScannerErrors(nullptr);
+    PopScannerFile();
+    yylineno = line;
+
+    fclose(f);
+    return ok;
+}
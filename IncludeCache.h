@@ -0,0 +1,62 @@
+#pragma once
+
+#include "MacroExpander.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct IncludeStats
+{
+    uint64_t Scans = 0;
+    uint64_t Hits  = 0;
+};
+
+// Tokens of the files .INCLUDE names, shared by every file a run compiles.
+//
+// A file is scanned once, and its tokens are kept with their strings in a pool of the cache, so
+// the next file that includes it only splices the kept tokens into its stream. An entry is kept
+// for the path the file was found at and is scanned again if the modification time or the size
+// of the file changed since. Files are scanned with the scanner of the compile, one at a time.
+class IncludeCache
+{
+public:
+    typedef std::shared_ptr<const std::vector<Token>> SharedTokens;
+
+    explicit IncludeCache(const std::vector<std::string>& directories = std::vector<std::string>());
+
+    IncludeCache(const IncludeCache&) = delete;
+    IncludeCache& operator=(const IncludeCache&) = delete;
+
+    // the tokens of the file, which is looked for as named and then in every include directory,
+    // and the path it was found at. false, with the reason in error, if it can't be found or scanned.
+    bool Load(const std::string& name, std::string* path, SharedTokens* tokens, std::string* error);
+
+    inline const IncludeStats& GetStats() const;
+
+private:
+    struct Entry
+    {
+        int64_t      ModificationTime;
+        int64_t      Size;
+        SharedTokens Tokens;
+    };
+
+    bool Find(const std::string& name, std::string* path, Entry* entry) const;
+    bool Scan(const std::string& path, std::vector<Token>* tokens, std::string* error);
+
+private:
+    const std::vector<std::string>         Directories;
+    IncludeStats                           Stats;
+
+    std::unordered_set<std::string>        Strings;
+    std::unordered_map<std::string, Entry> Entries;
+};
+
+const IncludeStats& IncludeCache::GetStats() const
+{
+    return Stats;
+}
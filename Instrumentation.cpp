@@ -0,0 +1,64 @@
+#include "Instrumentation.h"
+#include "AllocationReport.h"
+#include "TimeReport.h"
+#include "Trace.h"
+
+const char* GetPhaseName(const CompilePhase phase)
+{
+    static const char* names[] = { "read data", "parse", "semantic analysis", "first pass", "second pass", "write" };
+    return names[static_cast<int>(phase)];
+}
+
+Instrumentation::Instrumentation(TimeReport* timeReport, Trace* trace, AllocationReport* allocationReport)
+    : Timer(timeReport)
+    , Tracer(trace)
+    , Allocations(allocationReport)
+{
+}
+
+void Instrumentation::BeginFile(const std::string& file)
+{
+    File = file;
+
+    if (Timer != nullptr)
+        Timer->AddFile();
+}
+
+void Instrumentation::Begin(const CompilePhase phase)
+{
+    if (Timer != nullptr)
+        Timer->Begin(phase);
+
+    Starts[static_cast<int>(phase)] = Clock::now();
+
+    if (Allocations != nullptr)
+        Allocations->Begin(phase);
+}
+
+void Instrumentation::End(const CompilePhase phase)
+{
+    const Clock::time_point end = Clock::now();
+
+    if (Allocations != nullptr)
+        Allocations->End(phase);
+
+    if (Tracer != nullptr)
+        Tracer->AddSpan(GetPhaseName(phase), File, Starts[static_cast<int>(phase)], end);
+
+    if (Timer != nullptr)
+        Timer->End(phase);
+}
+
+void Instrumentation::Counter(const char* name, const uint64_t value)
+{
+    if (Tracer != nullptr)
+        Tracer->AddCounter(name, value, Clock::now());
+}
+
+void Instrumentation::AddSourceLines(const uint64_t lines)
+{
+    if (Allocations != nullptr)
+        Allocations->AddSourceLines(lines);
+
+    Counter("source lines", lines);
+}
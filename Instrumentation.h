@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+enum class CompilePhase : unsigned char
+{
+    ReadData         = 0,
+    Parse            = 1,
+    SemanticAnalysis = 2,
+    FirstPass        = 3,
+    SecondPass       = 4,
+    Write            = 5,
+    Count
+};
+
+const char* GetPhaseName(const CompilePhase phase);
+
+class TimeReport;
+class Trace;
+class AllocationReport;
+
+// Forwards phase boundaries and counters of one compile thread to the enabled reports.
+// Code that is instrumented receives a null pointer when no report is enabled.
+class Instrumentation
+{
+public:
+    Instrumentation(TimeReport* timeReport, Trace* trace, AllocationReport* allocationReport);
+
+    void BeginFile(const std::string& file);
+    void Begin(const CompilePhase phase);
+    void End(const CompilePhase phase);
+    void Counter(const char* name, const uint64_t value);
+    void AddSourceLines(const uint64_t lines);
+
+    inline bool IsEnabled() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    TimeReport*       Timer;
+    Trace*            Tracer;
+    AllocationReport* Allocations;
+    std::string       File;
+    Clock::time_point Starts[static_cast<int>(CompilePhase::Count)];
+};
+
+bool Instrumentation::IsEnabled() const
+{
+    return Timer != nullptr || Tracer != nullptr || Allocations != nullptr;
+}
+
+// Marks the enclosing scope as the given phase. Costs one comparison without instrumentation.
+class PhaseScope
+{
+public:
+    PhaseScope(Instrumentation* instrumentation, const CompilePhase phase)
+        : Instr(instrumentation)
+        , Phase(phase)
+    {
+        if (Instr != nullptr)
+            Instr->Begin(Phase);
+    }
+
+    ~PhaseScope()
+    {
+        if (Instr != nullptr)
+            Instr->End(Phase);
+    }
+
+private:
+    Instrumentation*   Instr;
+    const CompilePhase Phase;
+};
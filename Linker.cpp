@@ -0,0 +1,210 @@
+#include "Linker.h"
+
+#include "optparse.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
+
+void Linker::Link(int argc, char** argv)
+{
+    optparse::OptionParser parser = optparse::OptionParser().description("macro11 linker");
+
+    parser.add_option("-i").action("append").help("object file of macro11 -c (may be repeated; the modules are placed in this order).").dest("input");
+    parser.add_option("-o").help("output file.").dest("out");
+    parser.add_option("-d").help("data file.").dest("data");
+
+    const optparse::Values options = parser.parse_args(argc, argv);
+    const std::vector<std::string> inputs = options.all("input");
+    if (inputs.empty() || options.is_set("out") == false)
+    {
+        parser.print_help();
+        exit(-1);
+    }
+
+    ReadModules(inputs);
+    ResolveImports();
+
+    // the BSS of the last module is described by the header, like the BSS of a program is.
+    const Module& last = Modules.back();
+    const uint64_t storedSize = last.Base + last.Object.Program.size() * sizeof(Word);
+    const uint64_t bssSize = last.Object.BssWords * sizeof(Word);
+    if (storedSize + bssSize > GetROMSize())
+    {
+        std::fprintf(stderr, "program doesn't fit into ROM: %llu bytes, only %zu bytes are available.\n",
+                     static_cast<unsigned long long>(storedSize + bssSize), GetROMSize());
+        exit(-1);
+    }
+
+    std::vector<Byte> image(storedSize);
+    for (const Module& module : Modules)
+    {
+        Byte* words = image.data() + module.Base;
+        for (const Word w : module.Object.Program)
+        {
+            *words++ = static_cast<Byte>(w);
+            *words++ = static_cast<Byte>(w >> 8);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (const Module& module : Modules)
+        threads.emplace_back([this, &module, &image]() { Relocate(module, image); });
+
+    for (std::thread& t : threads)
+        t.join();
+
+    std::vector<Byte> data;
+    if (options.is_set("data"))
+        data = ReadDataFile(options["data"]);
+
+    if (data.size() > GetRAMSize())
+    {
+        std::fprintf(stderr, "data doesn't fit into RAM: %zu bytes, only %zu bytes are available.\n", data.size(), GetRAMSize());
+        exit(-1);
+    }
+
+    FILE* f = fopen(options["out"].c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "can't open a file %s", options["out"].c_str());
+        exit(-1);
+    }
+
+    const uint64_t header = data.size() | bssSize << 32;
+    fwrite(&header, sizeof(uint64_t), 1, f);
+    fwrite(data.data(), sizeof(Byte), data.size(), f);
+    fwrite(image.data(), sizeof(Byte), image.size(), f);
+    fclose(f);
+}
+
+void Linker::ReadModules(const std::vector<std::string>& paths)
+{
+    uint32_t base = 0;
+    Modules.resize(paths.size());
+
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        Module& module = Modules[i];
+        module.Path = paths[i];
+
+        std::string error;
+        if (module.Object.Read(module.Path, &error) == false)
+        {
+            std::cerr << error << "\n";
+            exit(-1);
+        }
+
+        // checked before the relocations are applied, which happens on other threads.
+        const ObjectFile& object = module.Object;
+        for (const Relocation& r : object.Relocations)
+        {
+            if (   r.Offset + sizeof(Word) > object.Program.size() * sizeof(Word)
+                || r.Symbol < -1 || r.Symbol >= static_cast<int32_t>(object.Imports.size()))
+            {
+                std::fprintf(stderr, "%s has a relocation out of the module.\n", module.Path.c_str());
+                exit(-1);
+            }
+        }
+
+        // the reserved words are added to the program below, so a corrupt count mustn't be allocated.
+        if ((object.Program.size() + object.BssWords) * sizeof(Word) > GetROMSize())
+        {
+            std::fprintf(stderr, "%s doesn't fit into ROM.\n", module.Path.c_str());
+            exit(-1);
+        }
+
+        // the reserved words of a module are only left out of the image at its end.
+        if (i + 1 < paths.size())
+        {
+            module.Object.Program.resize(module.Object.Program.size() + module.Object.BssWords);
+            module.Object.BssWords = 0;
+        }
+
+        module.Base = base;
+        base += static_cast<uint32_t>(module.Object.Program.size() * sizeof(Word));
+    }
+}
+
+void Linker::ResolveImports()
+{
+    struct Definition
+    {
+        Word               Address;
+        const std::string* Path;
+    };
+
+    std::unordered_map<std::string, Definition> exports;
+    for (const Module& module : Modules)
+    {
+        for (const ExportedSymbol& e : module.Object.Exports)
+        {
+            const Word address = static_cast<Word>(GetROMBegining() + module.Base + e.WordNumber * sizeof(Word));
+            auto inserted = exports.emplace(e.Name, Definition{ address, &module.Path });
+            if (inserted.second == false)
+            {
+                std::fprintf(stderr, "label `%s` is exported by both %s and %s.\n", e.Name.c_str(), inserted.first->second.Path->c_str(), module.Path.c_str());
+                exit(-1);
+            }
+        }
+    }
+
+    bool resolved = true;
+    for (Module& module : Modules)
+    {
+        for (const std::string& name : module.Object.Imports)
+        {
+            auto it = exports.find(name);
+            if (it == exports.end())
+            {
+                std::fprintf(stderr, "label `%s` of %s isn't exported by any module.\n", name.c_str(), module.Path.c_str());
+                resolved = false;
+                continue;
+            }
+
+            module.Imports.push_back(it->second.Address);
+        }
+    }
+
+    if (resolved == false)
+        exit(-1);
+}
+
+void Linker::Relocate(const Module& module, std::vector<Byte>& image) const
+{
+    // a module only changes its own words, so the modules are relocated at once.
+    Byte* words = image.data() + module.Base;
+
+    for (const Relocation& r : module.Object.Relocations)
+    {
+        Word value = static_cast<Word>(words[r.Offset] | words[r.Offset + 1] << 8);
+        if (r.Symbol >= 0)
+            value += module.Imports[r.Symbol];
+        value += static_cast<Word>(r.BaseFactor * static_cast<int>(module.Base));
+
+        words[r.Offset] = static_cast<Byte>(value);
+        words[r.Offset + 1] = static_cast<Byte>(value >> 8);
+    }
+}
+
+std::vector<Byte> Linker::ReadDataFile(const std::string& path) const
+{
+    std::ifstream f{ path, std::ios::binary };
+    if (f.is_open() == false)
+    {
+        std::cerr << "Can't read the data file: can't open the data file.\n";
+        exit(-1);
+    }
+
+    return std::vector<Byte>{ std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>() };
+}
+
+int main(int argc, char** argv)
+{
+    Linker l;
+    l.Link(argc, argv);
+}
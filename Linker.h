@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ObjectFile.h"
+
+#include <string>
+#include <vector>
+
+// Links the object files of macro11 -c into an image, laid out like the one macro11 writes.
+//
+// The modules are placed in ROM in the order they are given, each right after the one before;
+// the BSS of every module but the last is stored as zeros. Every imported label has to be exported
+// by exactly one module. The relocations of the modules are applied in parallel, as every module
+// only changes its own words.
+class Linker
+{
+public:
+    void Link(int argc, char** argv);
+
+private:
+    struct Module
+    {
+        std::string Path;
+        ObjectFile  Object;
+        // in bytes, from the start of ROM.
+        uint32_t    Base;
+        // the address of every import, in the order of the imports of the object.
+        std::vector<Word> Imports;
+    };
+
+    void ReadModules(const std::vector<std::string>& paths);
+    void ResolveImports();
+    void Relocate(const Module& module, std::vector<Byte>& image) const;
+    std::vector<Byte> ReadDataFile(const std::string& path) const;
+
+private:
+    std::vector<Module> Modules;
+};
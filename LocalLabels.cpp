@@ -0,0 +1,110 @@
+#include "LocalLabels.h"
+
+#include <cctype>
+#include <cstdlib>
+
+bool LocalLabels::IsLocal(const char* name)
+{
+    if (isdigit(static_cast<unsigned char>(name[0])) == false)
+        return false;
+
+    const char* end = name;
+    while (isdigit(static_cast<unsigned char>(*end)))
+        ++end;
+
+    if (end[0] != '$' || end[1] != '\0')
+        return false;
+
+    const unsigned int number = GetNumber(name);
+    return number >= 1 && number <= 65535 && end - name <= 5;
+}
+
+LocalLabels::LocalLabels()
+    : Count(0)
+    , Bound(0)
+{
+}
+
+bool LocalLabels::Define(const char* name, std::string* error)
+{
+    const unsigned int number = GetNumber(name);
+    if (Find(number) != nullptr)
+    {
+        *error = std::string("local label `") + name + "` is defined twice in its scope";
+        return false;
+    }
+
+    if (Count == MaxLabels)
+    {
+        *error = "more than " + std::to_string(MaxLabels) + " local labels between two labels";
+        return false;
+    }
+
+    Labels[Count++] = Label{ number, nullptr };
+    return true;
+}
+
+void LocalLabels::Bind(AST::CommandNode* command)
+{
+    for (; Bound < Count; ++Bound)
+        Labels[Bound].Command = command;
+}
+
+void LocalLabels::Refer(AST::OperandNode* operand, const int line)
+{
+    // a label further down the scope isn't known yet, so every operand is resolved at its end.
+    References.push_back(Reference{ operand, line });
+}
+
+bool LocalLabels::End(AST::ExpressionTable& expressions, std::string* error)
+{
+    bool ok = true;
+    for (const Reference& reference : References)
+    {
+        const Label* label = Find(GetNumber(reference.Operand->LabelName));
+        if (label == nullptr || label->Command == nullptr)
+        {
+            *error = std::string("local label `") + reference.Operand->LabelName + "` of line " + std::to_string(reference.Line)
+                     + " isn't defined in its scope";
+            ok = false;
+            break;
+        }
+
+        reference.Operand->Target = label->Command;
+    }
+
+    auto resolve = [this](const std::string& name) -> const AST::CommandNode*
+    {
+        const Label* label = Find(GetNumber(name.c_str()));
+        return label != nullptr ? label->Command : nullptr;
+    };
+
+    std::string unresolved;
+    if (expressions.BindLocals(resolve, &unresolved) == false && ok)
+    {
+        *error = "local label `" + unresolved + "` isn't defined in its scope";
+        ok = false;
+    }
+
+    References.clear();
+    Count = 0;
+    Bound = 0;
+
+    return ok;
+}
+
+unsigned int LocalLabels::GetNumber(const char* name)
+{
+    return static_cast<unsigned int>(strtoul(name, nullptr, 10));
+}
+
+const LocalLabels::Label* LocalLabels::Find(const unsigned int number) const
+{
+    for (unsigned int i = 0; i < Count; ++i)
+    {
+        if (Labels[i].Number == number)
+            return &Labels[i];
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Ast.h"
+
+#include <string>
+#include <vector>
+
+// The local labels (1$, 2$, ...) of the scope being parsed.
+//
+// A scope ends at the next label that isn't local, and a local label is only known inside its
+// scope, so the labels of a scope are kept in a table of a fixed size that is emptied at its end.
+// The parser resolves every operand and expression that refers to a local label to the command it
+// labels, so local labels never reach the labels tables of the passes and cost nothing once their
+// scope ends.
+class LocalLabels
+{
+public:
+    static const unsigned int MaxLabels = 64;
+
+    // 1$ to 65535$.
+    static bool IsLocal(const char* name);
+
+    LocalLabels();
+
+    LocalLabels(const LocalLabels&) = delete;
+    LocalLabels& operator=(const LocalLabels&) = delete;
+
+    // the label labels the next command. false, with the reason in error, if the scope already
+    // has it or is full.
+    bool Define(const char* name, std::string* error);
+    // the labels defined since the last command label this one.
+    void Bind(AST::CommandNode* command);
+    // the operand refers to a label of the scope, which may be defined later in it.
+    void Refer(AST::OperandNode* operand, const int line);
+    // resolves the operands and the expressions of the scope and empties it. false, with the
+    // reason in error, if one of them refers to a label the scope doesn't define.
+    bool End(AST::ExpressionTable& expressions, std::string* error);
+
+private:
+    struct Label
+    {
+        unsigned int      Number;
+        AST::CommandNode* Command;
+    };
+
+    struct Reference
+    {
+        AST::OperandNode* Operand;
+        int               Line;
+    };
+
+    static unsigned int GetNumber(const char* name);
+    const Label* Find(const unsigned int number) const;
+
+private:
+    Label                  Labels[MaxLabels];
+    unsigned int           Count;
+    unsigned int           Bound;
+    // kept between scopes, so it only grows to the most references a scope has.
+    std::vector<Reference> References;
+};
@@ -62,6 +62,12 @@ enum class InstructionGroup : unsigned char
     Other         = 6
 };
 
+enum class JumpForm : unsigned char
+{
+    Short = 0,
+    Long  = 1,
+};
+
 static std::map<Word, std::string> SingleOperandOpcodes = {
     { 0005000, "CLR"  },
     { 0105000, "CLRB" },
@@ -205,5 +211,7 @@ enum OpCodes
    OPCODE_RTS  = 0000200,
    OPCODE_RTI  = 0000002,
    OPCODE_SUB  = 0160000,
+   OPCODE_TST  = 0005700,
+   OPCODE_TSTB = 0105700,
    OPCODE_XOR  = 0074000,
 };
@@ -0,0 +1,1069 @@
+#include "MacroExpander.h"
+#include "IncludeCache.h"
+#include "Expression.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+extern int yylex();
+extern int yylineno;
+extern YYSTYPE ScannerValue;
+
+void DeferScannerErrors(std::string* message);
+void SkipConditionalBlock(const int blocks, const bool midLine);
+
+bool HasString(const int kind)
+{
+    return kind == STRING || kind == LABEL || kind == SYMBOL || kind == TEXT;
+}
+
+namespace
+{
+    bool HasInteger(const int kind)
+    {
+        return kind == INT || kind == REGISTER || kind == COMMAND;
+    }
+
+    bool OpensBlock(const int kind)
+    {
+        return kind == MACRO_DIRECTIVE || kind == REPT_DIRECTIVE || kind == IRP_DIRECTIVE;
+    }
+
+    bool EndsBlock(const int kind)
+    {
+        return kind == ENDM_DIRECTIVE || kind == ENDR_DIRECTIVE;
+    }
+
+    // a directive that ends the part of a conditional block before it.
+    bool EndsConditionalPart(const int kind)
+    {
+        return kind == IFF_DIRECTIVE || kind == IFT_DIRECTIVE || kind == IFTF_DIRECTIVE || kind == ENDC_DIRECTIVE;
+    }
+
+    // the value of a condition on a value; false if the condition tests anything else.
+    bool TestValue(const std::string& condition, const int16_t value, bool* result)
+    {
+        if (condition == "EQ" || condition == "Z")
+            *result = value == 0;
+        else if (condition == "NE" || condition == "NZ")
+            *result = value != 0;
+        else if (condition == "GT" || condition == "G")
+            *result = value > 0;
+        else if (condition == "GE")
+            *result = value >= 0;
+        else if (condition == "LT" || condition == "L")
+            *result = value < 0;
+        else if (condition == "LE")
+            *result = value <= 0;
+        else
+            return false;
+
+        return true;
+    }
+
+    bool IsValueCondition(const std::string& condition)
+    {
+        bool result = false;
+        return TestValue(condition, 0, &result);
+    }
+
+    bool SameTokens(const std::vector<Token>& a, const std::vector<Token>& b)
+    {
+        if (a.size() != b.size())
+            return false;
+
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].Kind != b[i].Kind)
+                return false;
+
+            // strings of expanded tokens may come from another pool.
+            if (HasString(a[i].Kind) ? std::strcmp(a[i].Value.sval, b[i].Value.sval) != 0 : a[i].Value.ival != b[i].Value.ival)
+                return false;
+        }
+
+        return true;
+    }
+}
+
+MacroExpander::MacroExpander(const MacroLimits& limits, IncludeCache* includes)
+    : Limits(limits)
+    , OwnIncludes(includes == nullptr ? new IncludeCache() : nullptr)
+    , Includes(includes == nullptr ? OwnIncludes.get() : includes)
+    , CallLine(0)
+    , RawLastLine(0)
+    , CachedTokens(0)
+    , AfterLabel(false)
+    , ConditionVariables(0)
+    , Assigning(false)
+    , ErrorLine(0)
+{
+}
+
+MacroExpander::~MacroExpander() = default;
+
+void MacroExpander::Predefine(const std::string& name, const int value)
+{
+    // the assignments are a body read before the file, one line each.
+    const int line = static_cast<int>(Predefined.size() / 3) + 1;
+
+    Token token;
+    token.Kind = SYMBOL;
+    token.Line = line;
+    token.Value.sval = const_cast<char*>(Intern(name.c_str()));
+    Predefined.push_back(token);
+
+    token.Kind = TOKEN_DIRECT_ASSIGN;
+    token.Value.ival = 0;
+    Predefined.push_back(token);
+
+    token.Kind = INT;
+    token.Value.ival = value;
+    Predefined.push_back(token);
+
+    Frames.clear();
+    Frames.push_back(Frame{ std::make_shared<const TokenList>(Predefined), 0, 1, 1, -1 });
+}
+
+void MacroExpander::AddVariable(const std::string& name, const int* value)
+{
+    Variables.push_back(name);
+
+    if (value != nullptr)
+        Symbols[name] = AssignedSymbol{ true, *value, GetVariableBit(name.c_str()) };
+}
+
+std::vector<std::string> MacroExpander::GetConditionVariables() const
+{
+    std::vector<std::string> names;
+    for (const std::string& name : Variables)
+    {
+        if (ConditionVariables & GetVariableBit(name.c_str()))
+            names.push_back(name);
+    }
+
+    return names;
+}
+
+int MacroExpander::Next(YYSTYPE* value, int* line)
+{
+    for (;;)
+    {
+        const Pulled pulled = Pull();
+        const Token& token = pulled.Value;
+
+        const bool statementStart = pulled.LineStart || AfterLabel;
+        if (Assigning && (statementStart || token.Kind == 0))
+            EndAssignment();
+
+        bool ok = true;
+        bool expanded = false;
+
+        if (token.Kind == SCANNER_ERROR)
+        {
+            ok = SetError(Error, pulled.ReportedLine);
+        }
+        else if (token.Kind == 0 && Conditions.empty() == false)
+        {
+            ok = SetError("`.IF` has no `.ENDC`", Conditions.back().Line);
+        }
+        else if (token.Kind == MACRO_DIRECTIVE)
+        {
+            ok = Define(pulled.ReportedLine);
+            expanded = true;
+        }
+        else if (token.Kind == REPT_DIRECTIVE)
+        {
+            ok = Repeat(pulled);
+            expanded = true;
+        }
+        else if (token.Kind == IRP_DIRECTIVE)
+        {
+            ok = RepeatForEach(pulled);
+            expanded = true;
+        }
+        else if (token.Kind == INCLUDE_DIRECTIVE)
+        {
+            ok = Include(pulled);
+            expanded = true;
+        }
+        else if (token.Kind == IF_DIRECTIVE)
+        {
+            ok = EnterConditional(pulled);
+            expanded = true;
+        }
+        else if (EndsConditionalPart(token.Kind))
+        {
+            ok = ContinueConditional(pulled);
+            expanded = true;
+        }
+        else if (token.Kind == IIF_DIRECTIVE)
+        {
+            ok = ImmediateConditional(pulled);
+            expanded = true;
+        }
+        else if (EndsBlock(token.Kind))
+        {
+            ok = SetError("`.ENDM` or `.ENDR` without a block to end", pulled.ReportedLine);
+        }
+        else if (token.Kind == STRING && statementStart && Macros.empty() == false)
+        {
+            // a name at the start of a line, or right after its label, calls a macro.
+            auto it = Macros.find(token.Value.sval);
+            if (it != Macros.end())
+            {
+                Drop(pulled);
+                ok = Call(it->second, pulled);
+                expanded = true;
+            }
+        }
+
+        if (ok == false)
+        {
+            value->sval = strdup(Error.c_str());
+            *line = ErrorLine;
+            return SCANNER_ERROR;
+        }
+
+        if (expanded)
+            continue;
+
+        Follow(pulled, statementStart);
+        AfterLabel = token.Kind == LABEL;
+
+        *value = token.Value;
+        *line = pulled.ReportedLine;
+
+        // the parser owns the strings it gets.
+        if (pulled.Expanded && HasString(token.Kind))
+            value->sval = strdup(token.Value.sval);
+
+        return token.Kind;
+    }
+}
+
+MacroExpander::Pulled MacroExpander::Pull()
+{
+    for (;;)
+    {
+        // a token read one too far comes back once the frames pushed after it are done.
+        if (Pending.empty() == false && Frames.size() <= Pending.back().Depth)
+        {
+            const Pulled pulled = Pending.back().Value;
+            Pending.pop_back();
+            return pulled;
+        }
+
+        if (Frames.empty())
+            break;
+
+        Frame& frame = Frames.back();
+        if (frame.Position == frame.Tokens->size())
+        {
+            if (frame.Repeats > 1)
+            {
+                --frame.Repeats;
+                frame.Position = 0;
+                frame.LastLine = -1;
+            }
+            else
+            {
+                Frames.pop_back();
+            }
+
+            continue;
+        }
+
+        Pulled pulled;
+        pulled.Value = (*frame.Tokens)[frame.Position++];
+        pulled.ReportedLine = CallLine;
+        pulled.Depth = frame.Depth;
+        pulled.LineStart = pulled.Value.Line != frame.LastLine;
+        pulled.Expanded = true;
+
+        frame.LastLine = pulled.Value.Line;
+        return pulled;
+    }
+
+    Pulled pulled;
+
+    DeferScannerErrors(&Error);
+    pulled.Value.Kind = yylex();
+    DeferScannerErrors(nullptr);
+
+    pulled.Value.Line = yylineno;
+    pulled.Value.Value = ScannerValue;
+    pulled.ReportedLine = yylineno;
+    pulled.Depth = 0;
+    pulled.LineStart = pulled.Value.Kind == 0 || pulled.Value.Line != RawLastLine;
+    pulled.Expanded = false;
+
+    RawLastLine = pulled.Value.Line;
+    return pulled;
+}
+
+bool MacroExpander::PullOnLine(Pulled* pulled)
+{
+    *pulled = Pull();
+    if (pulled->LineStart == false && pulled->Value.Kind != SCANNER_ERROR)
+        return true;
+
+    Pending.push_back(PendingToken{ *pulled, Frames.size() });
+    return false;
+}
+
+void MacroExpander::ReadLine(TokenList* tokens)
+{
+    Pulled pulled;
+    while (PullOnLine(&pulled))
+        tokens->push_back(Keep(pulled));
+}
+
+bool MacroExpander::Define(const int line)
+{
+    Pulled name;
+    if (PullOnLine(&name) == false)
+        return SetError("`.MACRO` needs a name", line);
+
+    if (name.Value.Kind != STRING)
+    {
+        Drop(name);
+        return SetError("`.MACRO` needs a name", line);
+    }
+
+    const std::string macroName{ name.Value.Value.sval };
+    Drop(name);
+
+    Macro macro;
+    Pulled parameter;
+    while (PullOnLine(&parameter))
+    {
+        if (parameter.Value.Kind == STRING)
+        {
+            macro.Parameters.push_back(Keep(parameter).Value.sval);
+        }
+        else if (parameter.Value.Kind != TOKEN_COMMA)
+        {
+            Drop(parameter);
+            return SetError("wrong parameter of macro " + macroName, line);
+        }
+    }
+
+    if (ReadBody(".MACRO", line, &macro.Body) == false)
+        return false;
+
+    auto it = Macros.find(macroName);
+    if (it != Macros.end())
+    {
+        for (const auto& expansion : it->second.Expansions)
+            CachedTokens -= expansion.second->size();
+    }
+
+    Macros[macroName] = std::move(macro);
+    ++Stats.Definitions;
+
+    return true;
+}
+
+bool MacroExpander::Repeat(const Pulled& directive)
+{
+    const int line = directive.ReportedLine;
+
+    TokenList arguments;
+    ReadLine(&arguments);
+    if (arguments.empty())
+        return SetError("`.REPT` needs a count", line);
+
+    // the count is an expression of the symbols assigned so far, like the value of a condition.
+    size_t position = 0;
+    int count = 0;
+    std::string error;
+    if (Evaluate(arguments, &position, &count, &ConditionVariables, &error) == false)
+        return SetError("`.REPT`: " + error, line);
+
+    if (position != arguments.size() || count < 0)
+        return SetError("`.REPT` needs a count", line);
+
+    TokenList body;
+    if (ReadBody(".REPT", line, &body) == false)
+        return false;
+
+    if (count == 0 || body.empty())
+        return true;
+
+    return PushFrame(std::make_shared<const TokenList>(std::move(body)), static_cast<unsigned int>(count), directive);
+}
+
+bool MacroExpander::RepeatForEach(const Pulled& directive)
+{
+    const int line = directive.ReportedLine;
+
+    Pulled symbol;
+    if (PullOnLine(&symbol) == false)
+        return SetError("`.IRP` needs a symbol", line);
+
+    if (symbol.Value.Kind != STRING)
+    {
+        Drop(symbol);
+        return SetError("`.IRP` needs a symbol", line);
+    }
+
+    const std::vector<const char*> parameters{ Keep(symbol).Value.sval };
+
+    Pulled comma;
+    if (PullOnLine(&comma) == false)
+        return SetError("`.IRP` needs a list of arguments after the symbol", line);
+
+    if (comma.Value.Kind != TOKEN_COMMA)
+    {
+        Drop(comma);
+        return SetError("`.IRP` needs a list of arguments after the symbol", line);
+    }
+
+    TokenList list;
+    ReadLine(&list);
+
+    // .IRP X, <A, B, C> lists the arguments in brackets; without brackets, the list ends the line.
+    if (list.size() >= 2 && list.front().Kind == TOKEN_LEFT_ANGLE && list.back().Kind == TOKEN_RIGHT_ANGLE)
+    {
+        list.pop_back();
+        list.erase(list.begin());
+    }
+
+    std::vector<TokenList> arguments;
+    SplitArguments(list, &arguments);
+
+    TokenList body;
+    if (ReadBody(".IRP", line, &body) == false)
+        return false;
+
+    TokenList expansion;
+    std::vector<TokenList> argument(1);
+    for (TokenList& a : arguments)
+    {
+        argument[0].swap(a);
+
+        const TokenList repetition = Substitute(body, parameters, argument);
+        expansion.insert(expansion.end(), repetition.begin(), repetition.end());
+    }
+
+    if (expansion.empty())
+        return true;
+
+    return PushFrame(std::make_shared<const TokenList>(std::move(expansion)), 1, directive);
+}
+
+bool MacroExpander::Call(Macro& macro, const Pulled& name)
+{
+    TokenList tokens;
+    ReadLine(&tokens);
+
+    std::vector<TokenList> arguments;
+    SplitArguments(tokens, &arguments);
+
+    ++Stats.Expansions;
+
+    const std::string key = GetExpansionKey(arguments);
+    auto it = macro.Expansions.find(key);
+    if (it != macro.Expansions.end())
+    {
+        ++Stats.CacheHits;
+        return PushFrame(it->second, 1, name);
+    }
+
+    const SharedTokens expansion = std::make_shared<const TokenList>(Substitute(macro.Body, macro.Parameters, arguments));
+    if (CachedTokens + expansion->size() <= Limits.MaxCachedTokens)
+    {
+        macro.Expansions.emplace(key, expansion);
+        CachedTokens += expansion->size();
+    }
+
+    return PushFrame(expansion, 1, name);
+}
+
+bool MacroExpander::Include(const Pulled& directive)
+{
+    const int line = directive.ReportedLine;
+
+    Pulled name;
+    if (PullOnLine(&name) == false)
+        return SetError("`.INCLUDE` needs a file name", line);
+
+    if (name.Value.Kind != TEXT)
+    {
+        Drop(name);
+        return SetError("`.INCLUDE` needs a file name", line);
+    }
+
+    const std::string fileName{ name.Value.Value.sval };
+    Drop(name);
+
+    Pulled rest;
+    if (PullOnLine(&rest))
+    {
+        Drop(rest);
+        return SetError("`.INCLUDE` takes nothing but a file name", line);
+    }
+
+    std::string path;
+    SharedTokens tokens;
+    std::string error;
+    if (Includes->Load(fileName, &path, &tokens, &error) == false)
+        return SetError(error, line);
+
+    if (std::find(IncludedFiles.begin(), IncludedFiles.end(), path) == IncludedFiles.end())
+        IncludedFiles.push_back(path);
+
+    // included files count toward the depth, so a file that includes itself stops, but their
+    // tokens are not expansions.
+    const unsigned int depth = directive.Depth + 1;
+    if (depth > Limits.MaxDepth)
+        return SetError("included files and macro calls are nested deeper than " + std::to_string(Limits.MaxDepth) + " levels", line);
+
+    if (tokens->empty())
+        return true;
+
+    if (Frames.empty())
+        CallLine = line;
+
+    Frames.push_back(Frame{ tokens, 0, 1, depth, -1 });
+    return true;
+}
+
+bool MacroExpander::EnterConditional(const Pulled& directive)
+{
+    const int line = directive.ReportedLine;
+
+    bool value = false;
+    if (ReadCondition(line, false, &value) == false)
+        return false;
+
+    Conditions.push_back(Condition{ value, line });
+    if (value)
+        return true;
+
+    Pulled end;
+    if (SkipConditional(line, &end) == false)
+        return false;
+
+    return ContinueConditional(end);
+}
+
+bool MacroExpander::ContinueConditional(Pulled directive)
+{
+    for (;;)
+    {
+        const int kind = directive.Value.Kind;
+        if (Conditions.empty())
+            return SetError("`.IFF`, `.IFT`, `.IFTF` or `.ENDC` without a conditional block", directive.ReportedLine);
+
+        if (kind == ENDC_DIRECTIVE)
+        {
+            Conditions.pop_back();
+            return true;
+        }
+
+        // .IFT goes on with the block if its condition was true, .IFF if it was false.
+        if (kind == IFTF_DIRECTIVE || (kind == IFT_DIRECTIVE) == Conditions.back().Value)
+            return true;
+
+        if (SkipConditional(Conditions.back().Line, &directive) == false)
+            return false;
+    }
+}
+
+bool MacroExpander::ImmediateConditional(const Pulled& directive)
+{
+    bool value = false;
+    if (ReadCondition(directive.ReportedLine, true, &value) == false)
+        return false;
+
+    // the statement after the condition is assembled as if it started the line.
+    if (value)
+    {
+        AfterLabel = true;
+        return true;
+    }
+
+    Pulled rest;
+    while (PullOnLine(&rest))
+        Drop(rest);
+
+    return true;
+}
+
+bool MacroExpander::ReadCondition(const int line, const bool immediate, bool* value)
+{
+    const std::string directive = immediate ? "`.IIF`" : "`.IF`";
+
+    Pulled name;
+    if (PullOnLine(&name) == false)
+        return SetError(directive + " needs a condition", line);
+
+    if (name.Value.Kind != STRING)
+    {
+        Drop(name);
+        return SetError(directive + " needs a condition", line);
+    }
+
+    const std::string condition{ name.Value.Value.sval };
+    Drop(name);
+
+    // .IF takes the rest of the line as its argument, .IIF ends it with a comma before the statement.
+    const bool pair = condition == "IDN" || condition == "DIF";
+    unsigned int commas = pair ? 2 : 1;
+    unsigned int depth = 0;
+    bool ended = false;
+
+    TokenList arguments;
+    Pulled argument;
+    while (PullOnLine(&argument))
+    {
+        const int kind = argument.Value.Kind;
+
+        // a comma may separate the condition from its argument.
+        if (kind == TOKEN_COMMA && depth == 0 && arguments.empty())
+            continue;
+
+        if (kind == TOKEN_COMMA && depth == 0 && immediate && --commas == 0)
+        {
+            ended = true;
+            break;
+        }
+
+        if (kind == TOKEN_LEFT_ANGLE)
+            ++depth;
+        else if (kind == TOKEN_RIGHT_ANGLE && depth > 0)
+            --depth;
+
+        arguments.push_back(Keep(argument));
+    }
+
+    if (immediate && ended == false)
+        return SetError("`.IIF` needs a statement after its condition", line);
+
+    if (IsValueCondition(condition))
+    {
+        size_t position = 0;
+        int result = 0;
+        std::string error;
+        if (Evaluate(arguments, &position, &result, &ConditionVariables, &error) == false)
+            return SetError(directive + ": " + error, line);
+
+        if (position != arguments.size())
+            return SetError(directive + " needs one expression after " + condition, line);
+
+        // conditions test the word the value is assembled to.
+        TestValue(condition, static_cast<int16_t>(result), value);
+    }
+    else if (condition == "DF" || condition == "NDF")
+    {
+        if (arguments.size() != 1 || (arguments[0].Kind != STRING && arguments[0].Kind != SYMBOL))
+            return SetError(directive + " needs a symbol after " + condition, line);
+
+        // a variable is defined in some variants only.
+        ConditionVariables |= GetVariableBit(arguments[0].Value.sval);
+        *value = (Symbols.find(arguments[0].Value.sval) != Symbols.end()) == (condition == "DF");
+    }
+    else if (condition == "B" || condition == "NB")
+    {
+        std::vector<TokenList> split;
+        SplitArguments(arguments, &split);
+
+        const bool blank = split.empty() || (split.size() == 1 && split[0].empty());
+        *value = blank == (condition == "B");
+    }
+    else if (pair)
+    {
+        std::vector<TokenList> split;
+        SplitArguments(arguments, &split);
+
+        if (split.size() != 2)
+            return SetError(directive + " needs two arguments after " + condition, line);
+
+        *value = SameTokens(split[0], split[1]) == (condition == "IDN");
+    }
+    else
+    {
+        return SetError("unknown condition " + condition + " of " + directive, line);
+    }
+
+    return true;
+}
+
+bool MacroExpander::SkipConditional(const int line, Pulled* end)
+{
+    // blocks opened inside the skipped part end inside it too.
+    int blocks = 0;
+    bool labelled = false;
+
+    for (;;)
+    {
+        if (Frames.empty() && Pending.empty())
+        {
+            // the rest of the part is in the file, which the scanner passes over; after the labels
+            // of a line, the rest of it may still start with a directive.
+            SkipConditionalBlock(blocks, RawLastLine != 0 && labelled == false);
+            blocks = 0;
+        }
+
+        *end = Pull();
+        const int kind = end->Value.Kind;
+        labelled = kind == LABEL && end->Expanded == false;
+
+        if (kind == 0)
+            return SetError("`.IF` has no `.ENDC`", line);
+
+        if (kind == IF_DIRECTIVE)
+        {
+            ++blocks;
+        }
+        else if (kind == ENDC_DIRECTIVE && blocks > 0)
+        {
+            --blocks;
+        }
+        else if (blocks == 0 && EndsConditionalPart(kind))
+        {
+            return true;
+        }
+
+        Drop(*end);
+    }
+}
+
+void MacroExpander::Follow(const Pulled& pulled, const bool statementStart)
+{
+    const Token& token = pulled.Value;
+
+    if (Assigning)
+    {
+        Token kept = token;
+        if (HasString(token.Kind))
+            kept.Value.sval = const_cast<char*>(Intern(token.Value.sval));
+
+        Assignment.push_back(kept);
+    }
+    else if (token.Kind == SYMBOL && statementStart)
+    {
+        Assigning = true;
+        AssignedName = token.Value.sval;
+        Assignment.clear();
+    }
+    else if (token.Kind == LABEL)
+    {
+        auto it = Symbols.find(token.Value.sval);
+        if (it == Symbols.end())
+            Symbols.emplace(token.Value.sval, AssignedSymbol{ false, 0, 0 });
+    }
+}
+
+void MacroExpander::EndAssignment()
+{
+    Assigning = false;
+
+    size_t position = 0;
+    if (Assignment.empty() == false && Assignment[0].Kind == TOKEN_DIRECT_ASSIGN)
+        ++position;
+
+    // an assignment the expander can't evaluate still defines the symbol.
+    int value = 0;
+    uint64_t variables = 0;
+    std::string error;
+    const bool known = Evaluate(Assignment, &position, &value, &variables, &error) && position == Assignment.size();
+
+    Symbols[AssignedName] = AssignedSymbol{ known, known ? value : 0, variables };
+}
+
+bool MacroExpander::Evaluate(const TokenList& tokens, size_t* position, int* value, uint64_t* variables, std::string* error) const
+{
+    // as in the parser, operators apply from left to right and angle brackets group.
+    if (EvaluateTerm(tokens, position, value, variables, error) == false)
+        return false;
+
+    while (*position < tokens.size())
+    {
+        AST::ExpressionOp op;
+        switch (tokens[*position].Kind)
+        {
+        case TOKEN_PLUS:      op = AST::ExpressionOp::Add;      break;
+        case TOKEN_MINUS:     op = AST::ExpressionOp::Subtract; break;
+        case TOKEN_MUL:       op = AST::ExpressionOp::Multiply; break;
+        case TOKEN_DIV:       op = AST::ExpressionOp::Divide;   break;
+        case TOKEN_LOGIC_AND: op = AST::ExpressionOp::And;      break;
+        case TOKEN_LOGIC_OR:  op = AST::ExpressionOp::Or;       break;
+        default:
+            return true;
+        }
+
+        ++*position;
+
+        int right = 0;
+        if (EvaluateTerm(tokens, position, &right, variables, error) == false)
+            return false;
+
+        if (AST::ApplyExpressionOp(op, *value, right, value) == false)
+        {
+            *error = "Division by zero";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MacroExpander::EvaluateTerm(const TokenList& tokens, size_t* position, int* value, uint64_t* variables, std::string* error) const
+{
+    if (*position == tokens.size())
+    {
+        *error = "an expression is expected";
+        return false;
+    }
+
+    const Token& token = tokens[(*position)++];
+    switch (token.Kind)
+    {
+    case INT:
+        *value = token.Value.ival;
+        return true;
+
+    case STRING:
+    case SYMBOL:
+    {
+        auto it = Symbols.find(token.Value.sval);
+        if (it == Symbols.end())
+        {
+            *error = std::string("Symbol doesn't exist:") + token.Value.sval;
+            return false;
+        }
+
+        if (it->second.Known == false)
+        {
+            *error = std::string("Symbol has no value before layout:") + token.Value.sval;
+            return false;
+        }
+
+        *value = it->second.Value;
+        *variables |= it->second.Variables;
+        return true;
+    }
+
+    case TOKEN_PLUS:
+        return EvaluateTerm(tokens, position, value, variables, error);
+
+    case TOKEN_MINUS:
+        if (EvaluateTerm(tokens, position, value, variables, error) == false)
+            return false;
+
+        AST::ApplyExpressionOp(AST::ExpressionOp::Negate, *value, 0, value);
+        return true;
+
+    case TOKEN_LEFT_ANGLE:
+        if (Evaluate(tokens, position, value, variables, error) == false)
+            return false;
+
+        if (*position == tokens.size() || tokens[*position].Kind != TOKEN_RIGHT_ANGLE)
+        {
+            *error = "`>` is expected";
+            return false;
+        }
+
+        ++*position;
+        return true;
+
+    default:
+        *error = "an expression is expected";
+        return false;
+    }
+}
+
+uint64_t MacroExpander::GetVariableBit(const char* name) const
+{
+    // past 63 variables, the rest share the last bit, so a condition on one of them depends on all.
+    for (size_t i = 0; i < Variables.size(); ++i)
+    {
+        if (Variables[i] == name)
+            return uint64_t(1) << std::min<size_t>(i, 63);
+    }
+
+    return 0;
+}
+
+bool MacroExpander::ReadBody(const char* directive, const int line, TokenList* body)
+{
+    // blocks nest, and .ENDM or .ENDR end the innermost one.
+    unsigned int depth = 0;
+
+    for (;;)
+    {
+        const Pulled pulled = Pull();
+        const int kind = pulled.Value.Kind;
+
+        if (kind == 0)
+            return SetError(std::string("`") + directive + "` has no `.ENDM` or `.ENDR`", line);
+
+        if (kind == SCANNER_ERROR)
+            return SetError(Error, pulled.ReportedLine);
+
+        if (EndsBlock(kind) && depth == 0)
+        {
+            // .ENDM may repeat the name of the macro.
+            Pulled rest;
+            while (PullOnLine(&rest))
+                Drop(rest);
+
+            return true;
+        }
+
+        if (OpensBlock(kind))
+            ++depth;
+        else if (EndsBlock(kind))
+            --depth;
+
+        body->push_back(Keep(pulled));
+    }
+}
+
+bool MacroExpander::PushFrame(const SharedTokens& tokens, const unsigned int repeats, const Pulled& origin)
+{
+    // a frame is one level deeper than the file or body the call came from, whether or not that
+    // body has been read to its end, so a macro that calls itself on its last line stops too.
+    const unsigned int depth = origin.Depth + 1;
+    if (depth > Limits.MaxDepth)
+        return SetError("macro calls are nested deeper than " + std::to_string(Limits.MaxDepth) + " levels", origin.ReportedLine);
+
+    Stats.ExpandedTokens += static_cast<uint64_t>(tokens->size()) * repeats;
+    if (Stats.ExpandedTokens > Limits.MaxExpandedTokens)
+        return SetError("macro expansions exceed " + std::to_string(Limits.MaxExpandedTokens) + " tokens", origin.ReportedLine);
+
+    if (Frames.empty())
+        CallLine = origin.ReportedLine;
+
+    Frames.push_back(Frame{ tokens, 0, repeats, depth, -1 });
+    return true;
+}
+
+void MacroExpander::SplitArguments(const TokenList& tokens, std::vector<TokenList>* arguments) const
+{
+    if (tokens.empty())
+        return;
+
+    // commas in angle brackets don't split, the outermost brackets are dropped.
+    arguments->emplace_back();
+    unsigned int depth = 0;
+
+    for (const Token& token : tokens)
+    {
+        if (token.Kind == TOKEN_COMMA && depth == 0)
+        {
+            arguments->emplace_back();
+            continue;
+        }
+
+        if (token.Kind == TOKEN_LEFT_ANGLE && depth++ == 0)
+            continue;
+
+        if (token.Kind == TOKEN_RIGHT_ANGLE && depth > 0 && --depth == 0)
+            continue;
+
+        arguments->back().push_back(token);
+    }
+}
+
+MacroExpander::TokenList MacroExpander::Substitute(const TokenList& body, const std::vector<const char*>& parameters,
+                                                   const std::vector<TokenList>& arguments) const
+{
+    TokenList expansion;
+    expansion.reserve(body.size());
+
+    for (const Token& token : body)
+    {
+        size_t p = 0;
+        if (token.Kind == STRING || token.Kind == SYMBOL)
+        {
+            // pooled strings are equal only if they are the same string.
+            while (p < parameters.size() && parameters[p] != token.Value.sval)
+                ++p;
+        }
+        else
+        {
+            p = parameters.size();
+        }
+
+        if (p == parameters.size())
+        {
+            expansion.push_back(token);
+            continue;
+        }
+
+        // a missing argument is empty; the argument tokens take the line of the parameter.
+        if (p < arguments.size())
+        {
+            for (Token argument : arguments[p])
+            {
+                // a name substituted for an assigned symbol is assigned itself.
+                if (token.Kind == SYMBOL && argument.Kind == STRING)
+                    argument.Kind = SYMBOL;
+
+                argument.Line = token.Line;
+                expansion.push_back(argument);
+            }
+        }
+    }
+
+    return expansion;
+}
+
+std::string MacroExpander::GetExpansionKey(const std::vector<TokenList>& arguments) const
+{
+    std::string key;
+
+    for (const TokenList& argument : arguments)
+    {
+        const uint32_t size = argument.size();
+        key.append(reinterpret_cast<const char*>(&size), sizeof(size));
+
+        for (const Token& token : argument)
+        {
+            key.append(reinterpret_cast<const char*>(&token.Kind), sizeof(token.Kind));
+
+            if (HasString(token.Kind))
+                key.append(reinterpret_cast<const char*>(&token.Value.sval), sizeof(token.Value.sval));
+            else if (HasInteger(token.Kind))
+                key.append(reinterpret_cast<const char*>(&token.Value.ival), sizeof(token.Value.ival));
+        }
+    }
+
+    return key;
+}
+
+Token MacroExpander::Keep(const Pulled& pulled)
+{
+    Token token = pulled.Value;
+
+    if (pulled.Expanded == false && HasString(token.Kind))
+    {
+        token.Value.sval = const_cast<char*>(Intern(token.Value.sval));
+        free(pulled.Value.Value.sval);
+    }
+
+    return token;
+}
+
+const char* MacroExpander::Intern(const char* string)
+{
+    return Strings.insert(string).first->c_str();
+}
+
+void MacroExpander::Drop(const Pulled& pulled) const
+{
+    if (pulled.Expanded == false && HasString(pulled.Value.Kind))
+        free(pulled.Value.Value.sval);
+}
+
+bool MacroExpander::SetError(const std::string& message, const int line)
+{
+    Error = message;
+    ErrorLine = line;
+    return false;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "macro11.tab.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct Token
+{
+    int     Kind;
+    int     Line;
+    YYSTYPE Value;
+};
+
+// whether sval holds the string of a token of this kind.
+bool HasString(const int kind);
+
+class IncludeCache;
+
+struct MacroLimits
+{
+    // nested macro calls and repeat blocks; deeper nesting is almost always a recursive macro.
+    unsigned int MaxDepth = 64;
+    // tokens all expansions of a file may produce together.
+    uint64_t MaxExpandedTokens = 1 << 26;
+    // tokens kept for memoized expansions; calls beyond it are expanded without being kept.
+    uint64_t MaxCachedTokens = 1 << 22;
+};
+
+struct MacroStats
+{
+    uint64_t Definitions    = 0;
+    uint64_t Expansions     = 0;
+    uint64_t CacheHits      = 0;
+    uint64_t ExpandedTokens = 0;
+};
+
+// Expands .MACRO, .REPT, .IRP and .INCLUDE between the scanner and the parser.
+//
+// Bodies are kept as the tokens the scanner produced, so an expansion is never scanned again: a
+// macro call splices the body, with the parameters replaced by the argument tokens, into the token
+// stream. The expansion of a call is memoized by its argument tokens, so calling a macro with the
+// same arguments again only splices the kept tokens. Expanded tokens carry the line of the call.
+// An included file is spliced the same way from the tokens an IncludeCache keeps for it.
+//
+// Conditional blocks are decided here too, so a part that isn't assembled never reaches the
+// parser; in the file itself, the scanner passes over such a part without making tokens. To test
+// a condition, the expander follows the symbols assigned a constant on the way to the parser.
+//
+// Errors are returned as a SCANNER_ERROR token with the message in sval, in stream order.
+class MacroExpander
+{
+public:
+    // without a cache of its own, the expander keeps one for the file it expands.
+    explicit MacroExpander(const MacroLimits& limits = MacroLimits(), IncludeCache* includes = nullptr);
+    ~MacroExpander();
+
+    MacroExpander(const MacroExpander&) = delete;
+    MacroExpander& operator=(const MacroExpander&) = delete;
+
+    // the next expanded token of the file the scanner reads, 0 at its end.
+    int Next(YYSTYPE* value, int* line);
+
+    // NAME = VALUE, assigned before the first line of the file.
+    void Predefine(const std::string& name, const int value);
+    // a symbol whose value tells the variants of a program apart. Conditions see its value, if the
+    // variant being parsed defines it, but the parser doesn't, so operands refer to it by name.
+    void AddVariable(const std::string& name, const int* value);
+    // the variables conditions depended on; variants that agree on all of them share a parse.
+    std::vector<std::string> GetConditionVariables() const;
+
+    inline const MacroStats& GetStats() const;
+    // the paths of the files the expanded file includes, directly or not, in the order of inclusion.
+    inline const std::vector<std::string>& GetIncludedFiles() const;
+
+private:
+    typedef std::vector<Token>               TokenList;
+    typedef std::shared_ptr<const TokenList> SharedTokens;
+
+    // kept tokens point to strings of the Strings pool, so lists of them copy without ownership.
+    struct Macro
+    {
+        std::vector<const char*>                      Parameters;
+        TokenList                                     Body;
+        std::unordered_map<std::string, SharedTokens> Expansions;
+    };
+
+    // a body being read; a .REPT body is read Repeats times.
+    struct Frame
+    {
+        SharedTokens Tokens;
+        size_t       Position;
+        unsigned int Repeats;
+        unsigned int Depth;
+        int          LastLine;
+    };
+
+    // a token on its way to the parser. Value.Line is the line in the file or body the token comes
+    // from and tells lines apart; ReportedLine is the one the parser sees. Only tokens of the file
+    // own their strings, expanded ones point into the pool.
+    struct Pulled
+    {
+        Token        Value;
+        int          ReportedLine;
+        unsigned int Depth;
+        bool         LineStart;
+        bool         Expanded;
+    };
+
+    // a conditional block being assembled, with the value of its condition.
+    struct Condition
+    {
+        bool Value;
+        int  Line;
+    };
+
+    // a symbol as far as conditions can tell; a label, or a symbol assigned anything but a constant,
+    // has no value before layout. Variables has a bit for every variable the value depends on.
+    struct AssignedSymbol
+    {
+        bool     Known;
+        int      Value;
+        uint64_t Variables;
+    };
+
+    // a token read past the end of a line, with the number of frames there were when it was read.
+    struct PendingToken
+    {
+        Pulled Value;
+        size_t Depth;
+    };
+
+    Pulled Pull();
+    bool PullOnLine(Pulled* pulled);
+    void ReadLine(TokenList* tokens);
+
+    bool Define(const int line);
+    bool Repeat(const Pulled& directive);
+    bool RepeatForEach(const Pulled& directive);
+    bool Call(Macro& macro, const Pulled& name);
+    bool Include(const Pulled& directive);
+
+    bool EnterConditional(const Pulled& directive);
+    bool ContinueConditional(Pulled directive);
+    bool ImmediateConditional(const Pulled& directive);
+    bool ReadCondition(const int line, const bool immediate, bool* value);
+    bool SkipConditional(const int line, Pulled* end);
+
+    void Follow(const Pulled& pulled, const bool statementStart);
+    void EndAssignment();
+    bool Evaluate(const TokenList& tokens, size_t* position, int* value, uint64_t* variables, std::string* error) const;
+    bool EvaluateTerm(const TokenList& tokens, size_t* position, int* value, uint64_t* variables, std::string* error) const;
+    uint64_t GetVariableBit(const char* name) const;
+
+    bool ReadBody(const char* directive, const int line, TokenList* body);
+    bool PushFrame(const SharedTokens& tokens, const unsigned int repeats, const Pulled& origin);
+    void SplitArguments(const TokenList& tokens, std::vector<TokenList>* arguments) const;
+
+    TokenList Substitute(const TokenList& body, const std::vector<const char*>& parameters,
+                         const std::vector<TokenList>& arguments) const;
+    std::string GetExpansionKey(const std::vector<TokenList>& arguments) const;
+
+    Token Keep(const Pulled& pulled);
+    const char* Intern(const char* string);
+    void Drop(const Pulled& pulled) const;
+    bool SetError(const std::string& message, const int line);
+
+private:
+    const MacroLimits                      Limits;
+    MacroStats                             Stats;
+
+    std::unordered_set<std::string>        Strings;
+    std::unordered_map<std::string, Macro> Macros;
+    std::unique_ptr<IncludeCache>          OwnIncludes;
+    IncludeCache*                          Includes;
+    std::vector<std::string>               IncludedFiles;
+    std::vector<Frame>                     Frames;
+    int                                    CallLine;
+    int                                    RawLastLine;
+    uint64_t                               CachedTokens;
+
+    std::vector<PendingToken>              Pending;
+    bool                                   AfterLabel;
+
+    TokenList                              Predefined;
+    std::vector<Condition>                 Conditions;
+    std::unordered_map<std::string, AssignedSymbol> Symbols;
+    std::vector<std::string>               Variables;
+    uint64_t                               ConditionVariables;
+    bool                                   Assigning;
+    std::string                            AssignedName;
+    TokenList                              Assignment;
+
+    std::string                            Error;
+    int                                    ErrorLine;
+};
+
+const MacroStats& MacroExpander::GetStats() const
+{
+    return Stats;
+}
+
+const std::vector<std::string>& MacroExpander::GetIncludedFiles() const
+{
+    return IncludedFiles;
+}
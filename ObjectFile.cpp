@@ -0,0 +1,201 @@
+#include "ObjectFile.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // every field is stored little-endian, as the words of an image are.
+    const char     Magic[4] = { 'M', '1', '1', 'O' };
+    const uint32_t Version  = 1;
+
+    void PutInteger(std::vector<Byte>& out, const uint64_t value, const unsigned int size)
+    {
+        for (unsigned int i = 0; i < size; ++i)
+            out.push_back(static_cast<Byte>(value >> (8 * i)));
+    }
+
+    void PutString(std::vector<Byte>& out, const std::string& s)
+    {
+        PutInteger(out, s.size(), sizeof(uint16_t));
+        out.insert(out.end(), s.begin(), s.end());
+    }
+
+    class Reader
+    {
+    public:
+        Reader(const std::vector<Byte>& bytes)
+            : Bytes(bytes)
+            , Position(0)
+        {
+        }
+
+        bool GetInteger(const unsigned int size, uint64_t* value)
+        {
+            if (Bytes.size() - Position < size)
+                return false;
+
+            *value = 0;
+            for (unsigned int i = 0; i < size; ++i)
+                *value |= static_cast<uint64_t>(Bytes[Position++]) << (8 * i);
+
+            return true;
+        }
+
+        bool GetString(std::string* s)
+        {
+            uint64_t size = 0;
+            if (GetInteger(sizeof(uint16_t), &size) == false || Bytes.size() - Position < size)
+                return false;
+
+            s->assign(reinterpret_cast<const char*>(Bytes.data() + Position), size);
+            Position += size;
+            return true;
+        }
+
+        // whether count records of at least size bytes each can follow, so a count read from a
+        // corrupt file is checked before anything is allocated for it.
+        bool CanHold(const uint64_t count, const unsigned int size) const
+        {
+            return count <= (Bytes.size() - Position) / size;
+        }
+
+    private:
+        const std::vector<Byte>& Bytes;
+        size_t                   Position;
+    };
+}
+
+bool ObjectFile::Write(const std::string& path, std::string* error) const
+{
+    std::vector<Byte> out(Magic, Magic + sizeof(Magic));
+    PutInteger(out, Version, sizeof(uint32_t));
+    PutInteger(out, Program.size(), sizeof(uint32_t));
+    PutInteger(out, BssWords, sizeof(uint32_t));
+
+    PutInteger(out, Exports.size(), sizeof(uint32_t));
+    for (const ExportedSymbol& e : Exports)
+    {
+        PutString(out, e.Name);
+        PutInteger(out, e.WordNumber, sizeof(uint32_t));
+    }
+
+    PutInteger(out, Imports.size(), sizeof(uint32_t));
+    for (const std::string& name : Imports)
+        PutString(out, name);
+
+    PutInteger(out, Relocations.size(), sizeof(uint32_t));
+    for (const Relocation& r : Relocations)
+    {
+        PutInteger(out, r.Offset, sizeof(uint32_t));
+        PutInteger(out, static_cast<uint32_t>(r.Symbol), sizeof(uint32_t));
+        PutInteger(out, static_cast<uint8_t>(r.BaseFactor), sizeof(uint8_t));
+    }
+
+    for (const Word w : Program)
+        PutInteger(out, w, sizeof(Word));
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+    {
+        *error = "can't open a file " + path;
+        return false;
+    }
+
+    fwrite(out.data(), sizeof(Byte), out.size(), f);
+    fclose(f);
+    return true;
+}
+
+bool ObjectFile::Read(const std::string& path, std::string* error)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+    {
+        *error = "can't open a file " + path;
+        return false;
+    }
+
+    std::vector<Byte> bytes;
+    Byte buffer[4096];
+    size_t read = 0;
+    while ((read = fread(buffer, sizeof(Byte), sizeof(buffer), f)) != 0)
+        bytes.insert(bytes.end(), buffer, buffer + read);
+
+    fclose(f);
+
+    *error = path + " isn't an object file of this version";
+    if (bytes.size() < sizeof(Magic) || memcmp(bytes.data(), Magic, sizeof(Magic)) != 0)
+        return false;
+
+    Reader reader{ bytes };
+    uint64_t value = 0;
+    uint64_t words = 0;
+    uint64_t count = 0;
+
+    reader.GetInteger(sizeof(Magic), &value);
+    if (reader.GetInteger(sizeof(uint32_t), &value) == false || value != Version)
+        return false;
+
+    *error = path + " is truncated";
+    if (reader.GetInteger(sizeof(uint32_t), &words) == false || reader.GetInteger(sizeof(uint32_t), &value) == false)
+        return false;
+
+    BssWords = static_cast<uint32_t>(value);
+
+    if (reader.GetInteger(sizeof(uint32_t), &count) == false || reader.CanHold(count, sizeof(uint16_t) + sizeof(uint32_t)) == false)
+        return false;
+
+    Exports.resize(count);
+    for (ExportedSymbol& e : Exports)
+    {
+        if (reader.GetString(&e.Name) == false || reader.GetInteger(sizeof(uint32_t), &value) == false)
+            return false;
+
+        e.WordNumber = static_cast<uint32_t>(value);
+    }
+
+    if (reader.GetInteger(sizeof(uint32_t), &count) == false || reader.CanHold(count, sizeof(uint16_t)) == false)
+        return false;
+
+    Imports.resize(count);
+    for (std::string& name : Imports)
+    {
+        if (reader.GetString(&name) == false)
+            return false;
+    }
+
+    if (reader.GetInteger(sizeof(uint32_t), &count) == false || reader.CanHold(count, 2 * sizeof(uint32_t) + sizeof(uint8_t)) == false)
+        return false;
+
+    Relocations.resize(count);
+    for (Relocation& r : Relocations)
+    {
+        uint64_t offset = 0;
+        uint64_t symbol = 0;
+        uint64_t factor = 0;
+        if (   reader.GetInteger(sizeof(uint32_t), &offset) == false
+            || reader.GetInteger(sizeof(uint32_t), &symbol) == false
+            || reader.GetInteger(sizeof(uint8_t), &factor) == false)
+        {
+            return false;
+        }
+
+        r = Relocation{ static_cast<uint32_t>(offset), static_cast<int32_t>(static_cast<uint32_t>(symbol)), static_cast<int8_t>(factor) };
+    }
+
+    if (reader.CanHold(words, sizeof(Word)) == false)
+        return false;
+
+    Program.resize(words);
+    for (Word& w : Program)
+    {
+        if (reader.GetInteger(sizeof(Word), &value) == false)
+            return false;
+
+        w = static_cast<Word>(value);
+    }
+
+    error->clear();
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Macro11Common.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A word of a module that depends on where the module is linked or on a symbol of another module.
+// The word is encoded as if the module started at the beginning of ROM and every imported symbol
+// were 0; the linker adds the address of Symbol, if there is one, and BaseFactor times the offset
+// of the module in ROM.
+struct Relocation
+{
+    // in bytes, from the start of the module.
+    uint32_t Offset;
+    // the index into the imports, -1 for none.
+    int32_t  Symbol;
+    int8_t   BaseFactor;
+};
+
+struct ExportedSymbol
+{
+    std::string Name;
+    uint32_t    WordNumber;
+};
+
+// A module compiled with -c: the words it stores, the .GLOBL labels it defines and uses, and
+// the words the linker has to relocate.
+struct ObjectFile
+{
+    std::vector<Word>           Program;
+    uint32_t                    BssWords = 0;
+    std::vector<ExportedSymbol> Exports;
+    std::vector<std::string>    Imports;
+    std::vector<Relocation>     Relocations;
+
+    bool Write(const std::string& path, std::string* error) const;
+    bool Read(const std::string& path, std::string* error);
+};
@@ -0,0 +1,239 @@
+#include "PassManager.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace AST
+{
+    namespace
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        double GetSeconds(const Clock::time_point begin, const Clock::time_point end)
+        {
+            return std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+        }
+
+        // Feeds every node of one walk to all the passes that share it.
+        class FusedVisitor final : public AstVisitor
+        {
+        public:
+            FusedVisitor(const std::vector<AstVisitor*>& visitors)
+                : Visitors(visitors)
+            {
+            }
+
+            virtual void Visit(ProgramNode* node) override
+            {
+                for (AstVisitor* v : Visitors)
+                    v->Visit(node);
+            }
+
+            virtual void Visit(CommandNode* node) override
+            {
+                for (AstVisitor* v : Visitors)
+                    v->Visit(node);
+            }
+
+            virtual void Visit(OneOperandCommandNode* node) override
+            {
+                for (AstVisitor* v : Visitors)
+                    v->Visit(node);
+            }
+
+            virtual void Visit(DoubleOperandCommandNode* node) override
+            {
+                for (AstVisitor* v : Visitors)
+                    v->Visit(node);
+            }
+
+            virtual void Visit(DataNode* node) override
+            {
+                for (AstVisitor* v : Visitors)
+                    v->Visit(node);
+            }
+
+        private:
+            const std::vector<AstVisitor*>& Visitors;
+        };
+    }
+
+    Pass::Pass(const char* name, const CompilePhase phase, const PassLocality locality)
+        : Name(name)
+        , Phase(phase)
+        , Locality(locality)
+    {
+    }
+
+    void Pass::Walk(AbstractSyntaxTree* ast, AstVisitor* visitor)
+    {
+        ast->Accept(visitor);
+    }
+
+    void Pass::DependsOn(const Pass* pass)
+    {
+        Dependencies.push_back(pass);
+    }
+
+    VisitorPass::VisitorPass(const char* name, const CompilePhase phase, AstVisitor* visitor)
+        : Pass(name, phase)
+        , Visitor(visitor)
+    {
+    }
+
+    AstVisitor* VisitorPass::Begin()
+    {
+        return Visitor;
+    }
+
+    PassManager::PassManager(Instrumentation* instrumentation)
+        : Instr(instrumentation)
+        , Walks(0)
+    {
+    }
+
+    void PassManager::Add(Pass* pass)
+    {
+        Passes.push_back(pass);
+    }
+
+    std::vector<std::vector<Pass*>> PassManager::Schedule() const
+    {
+        std::vector<std::vector<Pass*>> walks;
+
+        for (Pass* pass : Passes)
+        {
+            bool fuse = walks.empty() == false && pass->Locality == PassLocality::Command;
+
+            if (fuse)
+            {
+                for (const Pass* other : walks.back())
+                {
+                    const bool isDependency = std::find(pass->Dependencies.begin(), pass->Dependencies.end(), other) != pass->Dependencies.end();
+                    if (isDependency || other->Locality == PassLocality::Program)
+                        fuse = false;
+                }
+            }
+
+            if (!fuse)
+                walks.push_back(std::vector<Pass*>());
+
+            walks.back().push_back(pass);
+        }
+
+        return walks;
+    }
+
+    bool PassManager::Run(AbstractSyntaxTree* ast)
+    {
+        return RunWalks(Schedule(), 0, ast);
+    }
+
+    bool PassManager::RunWalks(const std::vector<std::vector<Pass*>>& walks, const size_t first, AbstractSyntaxTree* ast)
+    {
+        for (size_t w = first; w < walks.size(); ++w)
+        {
+            const std::vector<Pass*>& walk = walks[w];
+
+            Clock::time_point walkBegin, walkEnd;
+            {
+                PhaseScope phase{ Instr, walk[0]->Phase };
+
+                std::vector<AstVisitor*> visitors = BeginWalk(walk);
+
+                walkBegin = Clock::now();
+                if (visitors.size() == 1)
+                {
+                    walk[0]->Walk(ast, visitors[0]);
+                }
+                else
+                {
+                    FusedVisitor fused{ visitors };
+                    ast->Traverse(fused);
+                }
+                walkEnd = Clock::now();
+            }
+
+            if (!EndWalk(walk, GetSeconds(walkBegin, walkEnd)))
+                return false;
+        }
+
+        return true;
+    }
+
+    std::vector<AstVisitor*> PassManager::BeginWalk(const std::vector<Pass*>& walk)
+    {
+        std::vector<AstVisitor*> visitors;
+        for (Pass* pass : walk)
+            visitors.push_back(pass->Begin());
+
+        return visitors;
+    }
+
+    bool PassManager::EndWalk(const std::vector<Pass*>& walk, const double walkSeconds)
+    {
+        ++Walks;
+
+        bool succeeded = true;
+        for (Pass* pass : walk)
+        {
+            PhaseScope phase{ Instr, pass->Phase };
+
+            const Clock::time_point endBegin = Clock::now();
+            succeeded &= pass->End();
+
+            Timings.push_back(PassTiming{ pass->Name, Walks, walkSeconds, GetSeconds(endBegin, Clock::now()) });
+        }
+
+        return succeeded;
+    }
+
+    void PassManager::BeginStream()
+    {
+        StreamWalks = Schedule();
+        StreamVisitor.reset();
+
+        if (StreamWalks.empty())
+            return;
+
+        // a pass that relinks the commands can't see them before the list is complete.
+        for (const Pass* pass : StreamWalks[0])
+        {
+            if (pass->Locality == PassLocality::Program)
+                return;
+        }
+
+        StreamVisitors = BeginWalk(StreamWalks[0]);
+        StreamVisitor.reset(new FusedVisitor{ StreamVisitors });
+        StreamBegin = Clock::now();
+    }
+
+    void PassManager::Stream(CommandNode* command)
+    {
+        if (StreamVisitor)
+            Dispatch(command, *StreamVisitor);
+    }
+
+    bool PassManager::FinishStream(AbstractSyntaxTree* ast)
+    {
+        if (!StreamVisitor)
+            return RunWalks(StreamWalks, 0, ast);
+
+        // the program node only exists once the parse is done, so it comes last in a streamed walk.
+        StreamVisitor->Visit(ast->GetProgram());
+        StreamVisitor.reset();
+
+        if (!EndWalk(StreamWalks[0], GetSeconds(StreamBegin, Clock::now())))
+            return false;
+
+        return RunWalks(StreamWalks, 1, ast);
+    }
+
+    void PassManager::PrintTimings(FILE* f) const
+    {
+        std::fprintf(f, "%-20s %5s %12s %12s\n", "pass", "walk", "walk s", "end s");
+
+        for (const PassTiming& t : Timings)
+            std::fprintf(f, "%-20s %5u %12.6f %12.6f\n", t.Name, t.Walk, t.WalkSeconds, t.EndSeconds);
+    }
+}
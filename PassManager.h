@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Ast.h"
+#include "Instrumentation.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace AST
+{
+    enum class PassLocality : unsigned char
+    {
+        // looks at one command at a time and can share a walk with other passes.
+        Command,
+        // relinks or deletes commands while it walks, so it needs a walk of its own.
+        Program,
+    };
+
+    class Pass
+    {
+    public:
+        Pass(const char* name, const CompilePhase phase, const PassLocality locality = PassLocality::Command);
+        virtual ~Pass() {}
+
+        // called right before the walk the pass runs in; the returned visitor sees every command of it.
+        virtual AstVisitor* Begin() = 0;
+
+        // called after the walk, for the work that needs the whole program. Returning false stops
+        // the walks that haven't run yet.
+        virtual bool End() { return true; }
+
+        // walks the tree with the visitor Begin returned, when the pass has the walk to itself.
+        virtual void Walk(AbstractSyntaxTree* ast, AstVisitor* visitor);
+
+        // the pass needs the results of End of the given pass, so it can't share a walk with it.
+        void DependsOn(const Pass* pass);
+
+    public:
+        const char* const        Name;
+        const CompilePhase       Phase;
+        const PassLocality       Locality;
+        std::vector<const Pass*> Dependencies;
+    };
+
+    // A pass that walks the tree with the type of its visitor, so a walk of its own is dispatched
+    // statically. Begin has to return a Visitor.
+    template <typename Visitor>
+    class TypedPass : public Pass
+    {
+    public:
+        using Pass::Pass;
+
+        virtual void Walk(AbstractSyntaxTree* ast, AstVisitor* visitor) override
+        {
+            ast->Traverse(static_cast<Visitor&>(*visitor));
+        }
+    };
+
+    // A pass made of a visitor alone, without setup and without a whole-program step.
+    class VisitorPass : public Pass
+    {
+    public:
+        VisitorPass(const char* name, const CompilePhase phase, AstVisitor* visitor);
+
+        virtual AstVisitor* Begin() override;
+
+    private:
+        AstVisitor* Visitor;
+    };
+
+    struct PassTiming
+    {
+        const char*  Name;
+        unsigned int Walk;
+        double       WalkSeconds;
+        double       EndSeconds;
+    };
+
+    // Runs passes in the order they were added and fuses neighbours into one walk over the commands.
+    // A pass starts a new walk when it depends on a pass of the current walk or when either of them
+    // is Program local. Every walk is charged to the phase of its first pass, every End to the phase
+    // of its own pass. A pass alone in its walk walks the tree itself, see Pass::Walk; a fused walk
+    // calls every visitor of it through the virtual Visit, once per command.
+    class PassManager
+    {
+    public:
+        explicit PassManager(Instrumentation* instrumentation = nullptr);
+
+        void Add(Pass* pass);
+        bool Run(AbstractSyntaxTree* ast);
+
+        // Streaming runs the first walk while the tree is still being built: BeginStream, then Stream
+        // for every finished command in program order, possibly from another thread, then FinishStream
+        // with the complete tree. The streamed walk overlaps the parse, so it isn't charged to a phase.
+        void BeginStream();
+        void Stream(CommandNode* command);
+        bool FinishStream(AbstractSyntaxTree* ast);
+
+        void PrintTimings(FILE* f) const;
+
+        inline unsigned int GetWalks() const;
+        inline const std::vector<PassTiming>& GetTimings() const;
+
+    private:
+        std::vector<std::vector<Pass*>> Schedule() const;
+        bool RunWalks(const std::vector<std::vector<Pass*>>& walks, const size_t first, AbstractSyntaxTree* ast);
+        std::vector<AstVisitor*> BeginWalk(const std::vector<Pass*>& walk);
+        bool EndWalk(const std::vector<Pass*>& walk, const double walkSeconds);
+
+    private:
+        Instrumentation*        Instr;
+        std::vector<Pass*>      Passes;
+        std::vector<PassTiming> Timings;
+        unsigned int            Walks;
+
+        std::vector<std::vector<Pass*>>       StreamWalks;
+        std::vector<AstVisitor*>              StreamVisitors;
+        std::unique_ptr<AstVisitor>           StreamVisitor;
+        std::chrono::steady_clock::time_point StreamBegin;
+    };
+
+    unsigned int PassManager::GetWalks() const
+    {
+        return Walks;
+    }
+
+    const std::vector<PassTiming>& PassManager::GetTimings() const
+    {
+        return Timings;
+    }
+}
@@ -0,0 +1,293 @@
+#include "PerformanceGate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const char* SmallSource =
+        "START: MOV #10, R1\n"
+        "LOOP: MOV R1, -(R6)\n"
+        " JSR F1, R5\n"
+        " MOV (R6)+, R1\n"
+        " DEC R1\n"
+        " BNE LOOP\n"
+        " HALT\n"
+        "; saves R0 around the call of F2\n"
+        "F1: MOV R0, -(R6)\n"
+        " JSR F2, R5\n"
+        " MOV (R6)+, R0\n"
+        " RTS R5\n"
+        "F2: INC R0\n"
+        " BEQ SKIP\n"
+        " ADD 2(R1), R0\n"
+        " BIC @#177, 4(R0)\n"
+        " CMP (R2)+, @(R3)+\n"
+        "SKIP: RTS R5\n";
+}
+
+PerformanceGate::PerformanceGate(const GateOptions& options)
+    : Options(options)
+{
+}
+
+std::vector<PerformanceGate::Workload> PerformanceGate::GetCorpus()
+{
+    std::vector<Workload> corpus;
+
+    Workload small;
+    small.Name = "small";
+    small.Source = SmallSource;
+    corpus.push_back(small);
+
+    // the generated workloads are sized to fit into ROM: their branches cross any overlay boundary.
+    Workload large;
+    large.Name = "large";
+    large.Source = nullptr;
+    large.Options.Lines = 6000;
+    corpus.push_back(large);
+
+    Workload labels;
+    labels.Name = "labels";
+    labels.Source = nullptr;
+    labels.Options.Lines = 6000;
+    labels.Options.LabelDensity = 1.0;
+    corpus.push_back(labels);
+
+    Workload comments;
+    comments.Name = "comments";
+    comments.Source = nullptr;
+    comments.Options.Lines = 100000;
+    comments.Options.CommentRatio = 0.95;
+    corpus.push_back(comments);
+
+    // dense short branches, where relaxing one branch moves the targets of its neighbours.
+    Workload branches;
+    branches.Name = "branches";
+    branches.Source = nullptr;
+    branches.Options.Lines = 6000;
+    branches.Options.LabelDensity = 0.5;
+    branches.Options.BranchRatio = 0.9;
+    branches.Options.BranchDistance = 64;
+    branches.Options.Distribution = BranchDistribution::Uniform;
+    corpus.push_back(branches);
+
+    return corpus;
+}
+
+PerformanceGate::Metric PerformanceGate::GetMetric(std::vector<double> samples)
+{
+    Metric metric{ 0.0, 0.0 };
+    if (samples.empty())
+        return metric;
+
+    std::sort(samples.begin(), samples.end());
+    metric.Median = samples[samples.size() / 2];
+
+    // median absolute deviation, scaled to be comparable with a standard deviation.
+    std::vector<double> deviations;
+    for (const double sample : samples)
+        deviations.push_back(std::fabs(sample - metric.Median));
+
+    std::sort(deviations.begin(), deviations.end());
+    metric.Deviation = 1.4826 * deviations[deviations.size() / 2];
+
+    return metric;
+}
+
+PerformanceGate::Result PerformanceGate::MeasureWorkload(const Workload& workload) const
+{
+    Result result;
+    result.Name = workload.Name;
+    result.OutputSize = 0;
+
+    char source[] = "/tmp/macro11-gate-XXXXXX";
+    char output[] = "/tmp/macro11-gate-XXXXXX";
+    const int sourceFd = mkstemp(source);
+    const int outputFd = mkstemp(output);
+    if (sourceFd < 0 || outputFd < 0)
+    {
+        std::fprintf(stderr, "can't create the files of workload %s\n", workload.Name);
+        exit(-1);
+    }
+    close(outputFd);
+
+    FILE* in = fdopen(sourceFd, "w");
+    if (workload.Source)
+    {
+        std::fputs(workload.Source, in);
+        result.Lines = std::count(workload.Source, workload.Source + std::strlen(workload.Source), '\n');
+    }
+    else
+    {
+        WorkloadGenerator(workload.Options).Generate(in);
+        result.Lines = workload.Options.Lines;
+    }
+    std::fclose(in);
+
+    std::vector<double> times, rss;
+
+    for (unsigned int r = 0; r < Options.Repeat; ++r)
+    {
+        const Clock::time_point begin = Clock::now();
+
+        // the child runs the compiler as it is built and invoked, the reports on stdout are dropped.
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            const int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            execl(Options.Compiler.c_str(), Options.Compiler.c_str(), "-i", source, "-o", output, (char*)nullptr);
+            _exit(127);
+        }
+
+        int status = 0;
+        struct rusage usage;
+        if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::fprintf(stderr, "workload %s failed to compile with %s\n", workload.Name, Options.Compiler.c_str());
+            unlink(source);
+            unlink(output);
+            exit(-1);
+        }
+
+        times.push_back(std::chrono::duration_cast<std::chrono::duration<double>>(Clock::now() - begin).count());
+        rss.push_back(static_cast<double>(usage.ru_maxrss));
+
+        struct stat st;
+        stat(output, &st);
+        result.OutputSize = st.st_size;
+    }
+
+    unlink(source);
+    unlink(output);
+
+    result.Time = GetMetric(times);
+    result.Rss = GetMetric(rss);
+
+    return result;
+}
+
+void PerformanceGate::Measure()
+{
+    Results.clear();
+
+    for (const Workload& workload : GetCorpus())
+        Results.push_back(MeasureWorkload(workload));
+}
+
+bool PerformanceGate::WriteBaseline(const std::string& fileName) const
+{
+    FILE* f = std::fopen(fileName.c_str(), "w");
+    if (!f)
+    {
+        std::fprintf(stderr, "can't open a file %s", fileName.c_str());
+        return false;
+    }
+
+    // one workload per line: ReadBaseline relies on this layout.
+    std::fprintf(f, "{\n  \"repeat\": %u,\n  \"workloads\": [\n", Options.Repeat);
+    for (size_t i = 0; i < Results.size(); ++i)
+    {
+        const Result& result = Results[i];
+        std::fprintf(f, "    { \"name\": \"%s\", \"lines\": %llu, \"time_median\": %.6f, \"time_deviation\": %.6f, "
+                        "\"rss_median\": %.0f, \"rss_deviation\": %.0f, \"output_bytes\": %llu }%s\n",
+                     result.Name.c_str(), static_cast<unsigned long long>(result.Lines), result.Time.Median,
+                     result.Time.Deviation, result.Rss.Median, result.Rss.Deviation,
+                     static_cast<unsigned long long>(result.OutputSize), i + 1 < Results.size() ? "," : "");
+    }
+    std::fprintf(f, "  ]\n}\n");
+
+    std::fclose(f);
+    return true;
+}
+
+bool PerformanceGate::ReadBaseline(const std::string& fileName, std::vector<Result>* results)
+{
+    FILE* f = std::fopen(fileName.c_str(), "r");
+    if (!f)
+    {
+        std::fprintf(stderr, "can't open a file %s", fileName.c_str());
+        return false;
+    }
+
+    char line[1024];
+    while (std::fgets(line, sizeof(line), f))
+    {
+        char name[64];
+        unsigned long long lines = 0, outputSize = 0;
+        Result result;
+
+        if (std::sscanf(line, " { \"name\": \"%63[^\"]\", \"lines\": %llu, \"time_median\": %lf, \"time_deviation\": %lf, "
+                              "\"rss_median\": %lf, \"rss_deviation\": %lf, \"output_bytes\": %llu",
+                        name, &lines, &result.Time.Median, &result.Time.Deviation, &result.Rss.Median,
+                        &result.Rss.Deviation, &outputSize) != 7)
+            continue;
+
+        result.Name = name;
+        result.Lines = lines;
+        result.OutputSize = outputSize;
+        results->push_back(result);
+    }
+
+    std::fclose(f);
+    return true;
+}
+
+bool PerformanceGate::CheckMetric(FILE* f, const Result& result, const char* name, const Metric& baseline,
+                                  const Metric& current, const double tolerance, const double floor, const char* unit) const
+{
+    const double change = baseline.Median > 0.0 ? (current.Median - baseline.Median) / baseline.Median : 0.0;
+    const bool regressed = current.Median > baseline.Median * (1.0 + tolerance) &&
+                           current.Median > baseline.Median + floor &&
+                           current.Median > baseline.Median + Options.Sigmas * baseline.Deviation;
+
+    std::fprintf(f, "%-10s %-8s %14.3f %14.3f %-3s %+8.1f%%  %s\n", result.Name.c_str(), name, baseline.Median,
+                 current.Median, unit, change * 100.0, regressed ? "REGRESSION" : "ok");
+
+    return !regressed;
+}
+
+bool PerformanceGate::Check(const std::string& baselineFileName, FILE* f) const
+{
+    std::vector<Result> baseline;
+    if (!ReadBaseline(baselineFileName, &baseline))
+        return false;
+
+    bool passed = true;
+
+    std::fprintf(f, "%-10s %-8s %14s %14s %-3s %9s  %s\n", "workload", "metric", "baseline", "current", "", "change", "status");
+    for (const Result& result : Results)
+    {
+        const auto it = std::find_if(baseline.begin(), baseline.end(),
+                                     [&result](const Result& r) { return r.Name == result.Name; });
+        if (it == baseline.end())
+        {
+            std::fprintf(f, "%-10s %-8s no baseline\n", result.Name.c_str(), "");
+            continue;
+        }
+
+        const Metric time{ result.Time.Median * 1000.0, result.Time.Deviation * 1000.0 };
+        const Metric baseTime{ it->Time.Median * 1000.0, it->Time.Deviation * 1000.0 };
+        passed &= CheckMetric(f, result, "time", baseTime, time, Options.TimeTolerance, Options.TimeFloor * 1000.0, "ms");
+        passed &= CheckMetric(f, result, "rss", it->Rss, result.Rss, Options.RssTolerance, 0.0, "KB");
+
+        const Metric output{ static_cast<double>(result.OutputSize), 0.0 };
+        const Metric baseOutput{ static_cast<double>(it->OutputSize), 0.0 };
+        passed &= CheckMetric(f, result, "output", baseOutput, output, 0.0, 0.0, "B");
+    }
+
+    std::fprintf(f, "%s\n", passed ? "performance gate passed" : "performance gate failed");
+    return passed;
+}
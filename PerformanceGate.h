@@ -0,0 +1,73 @@
+#pragma once
+
+#include "WorkloadGenerator.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct GateOptions
+{
+    std::string  Compiler      = "./macro11";
+    unsigned int Repeat        = 5;
+    double       TimeTolerance = 0.15;
+    double       RssTolerance  = 0.10;
+    double       Sigmas        = 3.0;
+    double       TimeFloor     = 0.005;
+};
+
+// Compiles a fixed corpus with the built compiler and compares wall time, peak RSS and output size
+// with a stored baseline. Every run executes the compiler in a child process, so peak RSS is the one
+// of that compilation only.
+//
+// A time or RSS median regresses only when it is above the baseline median both by the relative
+// tolerance and by the given number of baseline deviations, and times also by an absolute floor
+// that hides the process start-up noise of the small workloads; the output size is deterministic and
+// must not grow at all.
+class PerformanceGate
+{
+public:
+    PerformanceGate(const GateOptions& options);
+
+    void Measure();
+
+    bool WriteBaseline(const std::string& fileName) const;
+    bool Check(const std::string& baselineFileName, FILE* f) const;
+
+private:
+    struct Metric
+    {
+        double Median;
+        double Deviation;
+    };
+
+    struct Result
+    {
+        std::string Name;
+        uint64_t    Lines;
+        Metric      Time;
+        Metric      Rss;
+        uint64_t    OutputSize;
+    };
+
+    struct Workload
+    {
+        const char*     Name;
+        const char*     Source;
+        WorkloadOptions Options;
+    };
+
+private:
+    static std::vector<Workload> GetCorpus();
+    static Metric GetMetric(std::vector<double> samples);
+    static bool ReadBaseline(const std::string& fileName, std::vector<Result>* results);
+
+    Result MeasureWorkload(const Workload& workload) const;
+    bool CheckMetric(FILE* f, const Result& result, const char* name, const Metric& baseline, const Metric& current,
+                     const double tolerance, const double floor, const char* unit) const;
+
+private:
+    GateOptions         Options;
+    std::vector<Result> Results;
+};
@@ -0,0 +1,159 @@
+#include "PicCheck.h"
+
+#include "Ast.h"
+#include "CodeGenerator.h"
+#include "SemanticAnalyzer.h"
+
+extern int yyparse(AST::AbstractSyntaxTree* ast);
+extern void yyrestart(FILE* f);
+extern int yylineno;
+
+namespace
+{
+    // calls, jumps and branches back and forth, near and far, so every long form is encoded.
+    const char* Source =
+        "START: JSR F1, R5\n"
+        " BNE START\n"
+        " BEQ FAR\n"
+        " JMP FAR\n"
+        "BACK: JSR FAR, R5\n"
+        " HALT\n"
+        "F1: INC R0\n"
+        " RTS R5\n"
+        " .BLKW 200\n"
+        "FAR: JSR F1, R5\n"
+        " BR BACK\n"
+        " BNE F1\n"
+        " JMP BACK\n"
+        " RTS R5\n";
+
+    // a second load address, away from the start of ROM.
+    const Word OtherBase = static_cast<Word>(GetROMBegining() + 010000);
+}
+
+std::vector<Word> PicCheck::Compile(const bool pic)
+{
+    FILE* in = std::tmpfile();
+    std::fputs(Source, in);
+    std::rewind(in);
+    yyrestart(in);
+    yylineno = 1;
+
+    AST::AbstractSyntaxTree ast;
+    yyparse(&ast);
+    std::fclose(in);
+
+    AST::SemanticAnalyzer sa;
+    ast.Traverse(sa);
+
+    AST::CodeGeneratorOptions options;
+    options.PositionIndependent = pic;
+    AST::CodeGenerator codeGen{ options };
+    std::vector<Word> program = codeGen.Generate(&ast);
+
+    if (sa.GetErrors().empty() == false || codeGen.GetErrors().empty() == false)
+        program.clear();
+
+    return program;
+}
+
+std::vector<PicCheck::Reference> PicCheck::Decode(const std::vector<Word>& image, const Word base, unsigned int* absolute)
+{
+    std::vector<Reference> references;
+    *absolute = 0;
+
+    const unsigned int end = static_cast<unsigned int>(image.size() * sizeof(Word));
+    const auto wordOf = [base, end](const Word address, unsigned int* word)
+    {
+        const Word offset = static_cast<Word>(address - base);
+        *word = offset / sizeof(Word);
+        return offset < end && offset % sizeof(Word) == 0;
+    };
+
+    for (unsigned int i = 0; i < image.size();)
+    {
+        const Word w = image[i];
+        unsigned int next = i + 1;
+
+        if (BranchOpcodes.count(w & 0177400))
+        {
+            const int offset = static_cast<signed char>(w & 0377);
+            references.push_back(Reference{ i, static_cast<unsigned int>(static_cast<int>(next) + offset) });
+            i = next;
+            continue;
+        }
+
+        // the operand fields in the order of their extension words.
+        std::vector<Word> fields;
+        if (DoubleOperandOpcodes.count(w & 0170000))
+            fields = { static_cast<Word>(w >> 6 & 077), static_cast<Word>(w & 077) };
+        else if (OneAndHalfOpcodes.count(w & 0177000) || SingleOperandOpcodes.count(w & 0177700))
+            fields = { static_cast<Word>(w & 077) };
+
+        for (const Word field : fields)
+        {
+            const int mode = field >> 3;
+            const int reg = field & 07;
+            const bool pcRelative = reg == RegisterNumber::PC && (mode == 6 || mode == 7);
+            const bool immediate = reg == RegisterNumber::PC && (mode == 2 || mode == 3);
+            if (mode != 6 && mode != 7 && immediate == false)
+                continue;
+
+            const unsigned int extension = next++;
+            if ((pcRelative == false && immediate == false) || extension >= image.size())
+                continue;
+
+            // X(PC) is relative to the word after its extension word.
+            const Word address = pcRelative ? static_cast<Word>(base + next * sizeof(Word) + image[extension]) : image[extension];
+
+            unsigned int target = 0;
+            if (wordOf(address, &target))
+            {
+                references.push_back(Reference{ i, target });
+                if (immediate)
+                    ++*absolute;
+            }
+        }
+
+        i = next;
+    }
+
+    return references;
+}
+
+bool PicCheck::Run(FILE* f)
+{
+    const std::vector<Word> pic = Compile(true);
+    const std::vector<Word> fixed = Compile(false);
+    if (pic.empty() || pic.size() != fixed.size())
+    {
+        std::fprintf(f, "pic: the program doesn't compile to images of the same size.\n");
+        return false;
+    }
+
+    // the image built for the start of ROM, decoded where it was built for, gives the labels.
+    unsigned int expectedAbsolute = 0;
+    const std::vector<Reference> expected = Decode(fixed, static_cast<Word>(GetROMBegining()), &expectedAbsolute);
+
+    bool passed = true;
+    for (const Word base : { static_cast<Word>(GetROMBegining()), OtherBase })
+    {
+        unsigned int absolute = 0;
+        const std::vector<Reference> references = Decode(pic, base, &absolute);
+
+        unsigned int wrong = absolute;
+        for (size_t i = 0; i < references.size() || i < expected.size(); ++i)
+        {
+            if (i >= references.size() || i >= expected.size() || references[i].From != expected[i].From || references[i].Target != expected[i].Target)
+                ++wrong;
+        }
+
+        std::fprintf(f, "pic: loaded at %06o, %zu references, %u absolute addresses, %u wrong.\n", base, references.size(), absolute, wrong);
+        passed = passed && wrong == 0;
+    }
+
+    // the same references without --pic hold addresses, which are wrong anywhere else.
+    std::fprintf(f, "pic: without --pic, %u of %zu references hold an address a loader has to fix up.\n", expectedAbsolute, expected.size());
+
+    return passed && expectedAbsolute > 0;
+}
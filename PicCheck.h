@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Macro11Common.h"
+
+#include <cstdio>
+#include <vector>
+
+// Loads the image of a program built with --pic at two addresses and decodes the jumps, calls and
+// branches of both: every one of them has to reach the same word of the image at either address,
+// the word its label is at, and no word may hold an address of the image. The same program built
+// without --pic is decoded as well, to count the words a loader would have to fix up.
+class PicCheck
+{
+public:
+    // reports every difference to f, returns whether there was none.
+    bool Run(FILE* f);
+
+private:
+    struct Reference
+    {
+        // the word that refers, and the word it refers to, from the start of the image.
+        unsigned int From;
+        unsigned int Target;
+    };
+
+    static std::vector<Word> Compile(const bool pic);
+    // the references of the image loaded at base; *absolute counts the words holding an address of it.
+    static std::vector<Reference> Decode(const std::vector<Word>& image, const Word base, unsigned int* absolute);
+};
@@ -0,0 +1,146 @@
+#include "Pipeline.h"
+
+extern int yyparse(AST::AbstractSyntaxTree* ast);
+extern void yyrestart(FILE* f);
+extern int yylineno;
+
+void SetParserPipeline(Pipeline* pipeline);
+
+namespace
+{
+    const size_t TokenBatchSize   = 1024;
+    const size_t CommandBatchSize = 256;
+    const size_t QueuedBatches    = 16;
+}
+
+Pipeline::Pipeline(AST::PassManager& passes, MacroExpander& macros)
+    : Passes(passes)
+    , Macros(macros)
+    , Stopping(false)
+    , Tokens(QueuedBatches)
+    , ParserPosition(0)
+    , Scanned(false)
+    , Commands(QueuedBatches)
+{
+}
+
+void Pipeline::Parse(FILE* f, AST::AbstractSyntaxTree* ast)
+{
+    yyrestart(f);
+    yylineno = 1;
+
+    Passes.BeginStream();
+
+    Scanner = std::thread{ &Pipeline::Scan, this };
+    Consumer = std::thread{ &Pipeline::Consume, this };
+
+    SetParserPipeline(this);
+    yyparse(ast);
+    SetParserPipeline(nullptr);
+
+    FlushCommands();
+    Join();
+}
+
+void Pipeline::Stop()
+{
+    SetParserPipeline(nullptr);
+    Stopping = true;
+
+    // the scanner may wait for room in the queue, so its batches are taken until its last one.
+    while (Scanned == false)
+    {
+        ParserTokens.clear();
+        Tokens.Pop(ParserTokens);
+
+        const int last = ParserTokens.empty() ? 0 : ParserTokens.back().Kind;
+        Scanned = last == 0 || last == SCANNER_ERROR;
+    }
+
+    // the commands not handed over yet are left to the tree.
+    ParserCommands.clear();
+    Join();
+}
+
+void Pipeline::Join()
+{
+    // an empty batch ends the stream of commands.
+    Commands.Push(ParserCommands);
+
+    Scanner.join();
+    Consumer.join();
+}
+
+void Pipeline::Scan()
+{
+    TokenBatch batch;
+    for (;;)
+    {
+        Token token{};
+        token.Kind = Stopping ? 0 : Macros.Next(&token.Value, &token.Line);
+
+        batch.push_back(token);
+
+        const bool last = token.Kind == 0 || token.Kind == SCANNER_ERROR;
+        if (last || batch.size() == TokenBatchSize)
+        {
+            Tokens.Push(batch);
+            batch.clear();
+        }
+
+        if (last)
+            break;
+    }
+}
+
+int Pipeline::NextToken(YYSTYPE* value, int* line)
+{
+    if (ParserPosition == ParserTokens.size())
+    {
+        ParserTokens.clear();
+        Tokens.Pop(ParserTokens);
+        ParserPosition = 0;
+
+        const int last = ParserTokens.back().Kind;
+        Scanned = last == 0 || last == SCANNER_ERROR;
+    }
+
+    const Token& token = ParserTokens[ParserPosition++];
+    *value = token.Value;
+    *line = token.Line;
+
+    return token.Kind;
+}
+
+void Pipeline::AddCommand(AST::CommandNode* command)
+{
+    ParserCommands.push_back(command);
+
+    if (ParserCommands.size() == CommandBatchSize)
+        FlushCommands();
+}
+
+void Pipeline::FlushCommands()
+{
+    if (ParserCommands.empty())
+        return;
+
+    Commands.Push(ParserCommands);
+    ParserCommands.clear();
+}
+
+void Pipeline::Consume()
+{
+    CommandBatch batch;
+    for (;;)
+    {
+        batch.clear();
+        Commands.Pop(batch);
+
+        if (batch.empty())
+            break;
+
+        for (AST::CommandNode* command : batch)
+            Passes.Stream(command);
+    }
+}
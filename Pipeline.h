@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Ast.h"
+#include "MacroExpander.h"
+#include "PassManager.h"
+#include "SpscRing.h"
+#include "macro11.tab.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Parses a file on three threads. The scanner and the macro expander fill batches of tokens, the
+// parser builds the tree from them, and a third thread runs the first walk of the passes over every
+// command as soon as the parser has finished it. The rest of the passes need the whole program and run once the
+// tree is complete.
+//
+// Bounded queues between the stages make a fast stage wait for a slow one instead of buffering the
+// file. Tokens, line numbers and errors reach the parser in the same order as in a serial parse,
+// so the tree and the diagnostics are the same.
+class Pipeline
+{
+public:
+    Pipeline(AST::PassManager& passes, MacroExpander& macros);
+
+    // parses the file into the tree while the first walk of the passes consumes the finished
+    // commands. PassManager::FinishStream runs the rest of the passes afterwards.
+    void Parse(FILE* f, AST::AbstractSyntaxTree* ast);
+
+    // called by the parser.
+    int NextToken(YYSTYPE* value, int* line);
+    void AddCommand(AST::CommandNode* command);
+    // stops the scanner and the passes and joins their threads, so the parser can exit on an error.
+    void Stop();
+
+private:
+    typedef std::vector<Token>             TokenBatch;
+    typedef std::vector<AST::CommandNode*> CommandBatch;
+
+    void Scan();
+    void Consume();
+    void FlushCommands();
+    void Join();
+
+private:
+    AST::PassManager&      Passes;
+    MacroExpander&         Macros;
+
+    std::thread            Scanner;
+    std::thread            Consumer;
+    std::atomic<bool>      Stopping;
+
+    SpscRing<TokenBatch>   Tokens;
+    TokenBatch             ParserTokens;
+    size_t                 ParserPosition;
+    // whether the parser has taken the last batch of the scanner.
+    bool                   Scanned;
+
+    SpscRing<CommandBatch> Commands;
+    CommandBatch           ParserCommands;
+};
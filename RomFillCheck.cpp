@@ -0,0 +1,162 @@
+#include "RomFillCheck.h"
+
+#include "Ast.h"
+#include "CodeGenerator.h"
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // every command is a JSR to a label: an opcode and the extension word of the label.
+    const unsigned int CommandWords = 2;
+
+    unsigned int GetCommandsPerSegment()
+    {
+        return static_cast<unsigned int>(GetROMSize() / sizeof(Word) / CommandWords);
+    }
+
+    // Lk: JSR Ltargets[k], R5 for every k, or BR Ltargets[k] where branches[k] is set. The branches
+    // here leave their segment, so they are long and take two words as well.
+    AST::ProgramNode* MakeProgram(const std::vector<std::string>& names, const std::vector<unsigned int>& targets, const std::vector<bool>& branches)
+    {
+        AST::CommandNode* head = nullptr;
+        AST::CommandNode* last = nullptr;
+
+        for (size_t k = 0; k < targets.size(); ++k)
+        {
+            const SourceLocation location{ 0, static_cast<unsigned int>(k + 1) };
+            AST::OperandNode* label = new AST::OperandNode(OperandType::LabelName, -1, AddressingType::Label, names[targets[k]].c_str());
+
+            AST::CommandNode* node = nullptr;
+            if (branches[k])
+                node = new AST::OneOperandCommandNode(OPCODE_BR, label, location);
+            else
+                node = new AST::DoubleOperandCommandNode(OPCODE_JSR, label, new AST::OperandNode(OperandType::Register, R5, AddressingType::Register), location);
+
+            node->Labels = new AST::LabelNode(strdup(names[k].c_str()));
+            if (last != nullptr)
+                last->Next = node;
+            else
+                head = node;
+            last = node;
+        }
+
+        return new AST::ProgramNode(head);
+    }
+
+    std::vector<std::string> MakeNames(const unsigned int count)
+    {
+        std::vector<std::string> names;
+        for (unsigned int k = 0; k < count; ++k)
+            names.push_back("L" + std::to_string(k));
+
+        return names;
+    }
+}
+
+bool RomFillCheck::Run(FILE* f)
+{
+    bool passed = true;
+    for (const unsigned int segments : { 1, 3 })
+    {
+        passed = RunCase(f, segments, false) && passed;
+        passed = RunCase(f, segments, true) && passed;
+    }
+
+    return RunCrossSegmentCase(f) && passed;
+}
+
+bool RomFillCheck::RunCase(FILE* f, const unsigned int segments, const bool pic)
+{
+    // every label refers to a random label of its own segment.
+    const unsigned int perSegment = GetCommandsPerSegment();
+    const unsigned int count = segments * perSegment;
+    const std::vector<std::string> names = MakeNames(count);
+
+    std::minstd_rand random{ count };
+    std::vector<unsigned int> targets(count);
+    for (unsigned int k = 0; k < count; ++k)
+        targets[k] = k / perSegment * perSegment + random() % perSegment;
+
+    AST::AbstractSyntaxTree ast;
+    ast.SetProgram(MakeProgram(names, targets, std::vector<bool>(count, false)));
+
+    AST::CodeGeneratorOptions options;
+    options.PositionIndependent = pic;
+    options.Overlays = segments > 1;
+    AST::CodeGenerator codeGen{ options };
+    const std::vector<Word> program = codeGen.Generate(&ast);
+
+    const char* mode = pic ? " with --pic" : "";
+    const std::vector<unsigned int>& table = codeGen.GetSegments();
+    if (codeGen.GetErrors().empty() == false || program.size() != count * CommandWords || table.size() != segments)
+    {
+        std::fprintf(f, "rom fill of %u segments%s: %zu errors, %zu words in %zu segments.\n", segments, mode,
+                     codeGen.GetErrors().size(), program.size(), table.size());
+        return false;
+    }
+
+    // a word's address is its offset in its segment, as every segment is mapped at the start of ROM.
+    const auto addressOf = [perSegment](const unsigned int word)
+    {
+        return static_cast<Word>(word % (perSegment * CommandWords) * sizeof(Word) + GetROMBegining());
+    };
+
+    // the second operand, R5, is encoded into bits 8-6.
+    const Word opcode = static_cast<Word>(OPCODE_JSR | R5 << 6 | RegisterNumber::PC | static_cast<int>(pic ? AddressingType::Index : AddressingType::AutoIncrement) << 3);
+    unsigned int wrong = 0;
+    for (unsigned int k = 0; k < count; ++k)
+    {
+        const unsigned int word = k * CommandWords;
+        Word expected = addressOf(targets[k] * CommandWords);
+        if (pic)
+            expected = static_cast<Word>(expected - (addressOf(word + 1) + sizeof(Word)));
+
+        if (program[word] != opcode || program[word + 1] != expected)
+        {
+            if (wrong++ < 10)
+                std::fprintf(f, "rom fill of %u segments%s: %s at word %u is %06o %06o, expected %06o %06o.\n", segments, mode,
+                             names[k].c_str(), word, program[word], program[word + 1], opcode, expected);
+        }
+    }
+
+    std::fprintf(f, "rom fill: %u segments%s, %u references, %u wrong.\n", segments, mode, count, wrong);
+    return wrong == 0;
+}
+
+bool RomFillCheck::RunCrossSegmentCase(FILE* f)
+{
+    // the first two commands refer to labels of the second segment, one by JSR and one by BR.
+    const unsigned int perSegment = GetCommandsPerSegment();
+    const unsigned int count = 2 * perSegment;
+    const std::vector<std::string> names = MakeNames(count);
+
+    std::vector<unsigned int> targets(count);
+    std::vector<bool> branches(count, false);
+    for (unsigned int k = 0; k < count; ++k)
+        targets[k] = k;
+    targets[0] = perSegment;
+    targets[1] = perSegment + 1;
+    branches[1] = true;
+
+    AST::AbstractSyntaxTree ast;
+    ast.SetProgram(MakeProgram(names, targets, branches));
+
+    AST::CodeGeneratorOptions options;
+    options.Overlays = true;
+    AST::CodeGenerator codeGen{ options };
+    codeGen.Generate(&ast);
+
+    unsigned int reported = 0;
+    for (const AST::Error& e : codeGen.GetErrors())
+    {
+        if (e.Id == AST::MessageId::CrossSegmentReference && e.Location.GetLine() <= 2)
+            ++reported;
+    }
+
+    std::fprintf(f, "rom fill: %u of 2 references across segments reported, %zu errors.\n", reported, codeGen.GetErrors().size());
+    return reported == 2 && codeGen.GetErrors().size() == 2;
+}
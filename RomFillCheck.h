@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdio>
+
+// Fills ROM with label references and checks the address every one of them is encoded with: a
+// program of exactly one segment, and one that --overlays splits into several, with and without
+// --pic. A reference across segments has to be reported instead of encoded.
+class RomFillCheck
+{
+public:
+    // reports every wrong reference to f, returns whether there was none.
+    bool Run(FILE* f);
+
+private:
+    bool RunCase(FILE* f, const unsigned int segments, const bool pic);
+    bool RunCrossSegmentCase(FILE* f);
+};
@@ -25,7 +25,7 @@ namespace AST
             return;
 
         default:
-            Errors.push_back(Error{ node, "wrong operands number." });
+            Errors.push_back(Error{ node->Location, MessageId::WrongOperandsNumber });
         }
     }
 
@@ -42,7 +42,7 @@ namespace AST
             return;
 
         default:
-            Errors.push_back(Error{node, "wrong operands number."});
+            Errors.push_back(Error{ node->Location, MessageId::WrongOperandsNumber });
         }
     }
 
@@ -50,20 +50,22 @@ namespace AST
     {
         const OperandNode* second = node->Second;
         if (second->OpType != OperandType::Register)
-            Errors.push_back(Error{ node, "wrong operand (second operand is expected to be a register)." });
+            Errors.push_back(Error{ node->Location, MessageId::SecondOperandNotRegister });
     }
 
     void SemanticAnalyzer::CheckBranchCommand(const OneOperandCommandNode* node)
     {
         const OperandNode* first = node->First;
         if (first->OpType != OperandType::Number && first->OpType != OperandType::LabelName)
-            Errors.push_back(Error{ node, "wrong operand(label or int is expected)." });
+            Errors.push_back(Error{ node->Location, MessageId::LabelOrNumberExpected });
+        else if (first->OpType == OperandType::LabelName && first->LabelName == nullptr)
+            Errors.push_back(Error{ node->Location, MessageId::BranchTargetNotLabel });
     }
 
     void SemanticAnalyzer::CheckOneOperandCommand(const OneOperandCommandNode* node)
     {
         const OperandNode* first = node->First;
         if ((node->Opcode == OPCODE_RTS) && (first->OpType != OperandType::Register || first->AddrType != AddressingType::Register))
-            Errors.push_back(Error{ node, "wrong operand(RTS expects only a register.)" });
+            Errors.push_back(Error{ node->Location, MessageId::RtsOperandNotRegister });
     }
 }
\ No newline at end of file
@@ -7,7 +7,7 @@
 
 namespace AST
 {
-    class SemanticAnalyzer : public AstVisitor
+    class SemanticAnalyzer final : public AstVisitor
     {
     public:
         virtual void Visit(CommandNode* node) override;
@@ -0,0 +1,138 @@
+#include "SizeReport.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace AST
+{
+    namespace
+    {
+        const char* DataSection    = "data";
+        const char* ProgramSection = "program";
+
+        double GetPercentage(const size_t bytes, const size_t segmentSize)
+        {
+            return 100.0 * bytes / segmentSize;
+        }
+    }
+
+    void SizeReporter::Write(FILE* f, const std::vector<SizeEntry>& entries, const size_t dataSize) const
+    {
+        size_t programSize = 0;
+        unsigned int instructions = 0;
+        for (const SizeEntry& e : entries)
+        {
+            programSize += e.Words * sizeof(Word);
+            instructions += e.Instructions;
+        }
+
+        std::fprintf(f, "# section\tname\tbytes\tsegment%%\tinstructions\n");
+        std::fprintf(f, "section\t%s\t%zu\t%.2f\t0\n", DataSection, dataSize, GetPercentage(dataSize, GetRAMSize()));
+        std::fprintf(f, "section\t%s\t%zu\t%.2f\t%u\n", ProgramSection, programSize, GetPercentage(programSize, GetROMSize()), instructions);
+
+        std::vector<SizeEntry> sorted = entries;
+        std::stable_sort(sorted.begin(), sorted.end(), [](const SizeEntry& a, const SizeEntry& b) { return a.Words > b.Words; });
+
+        std::fprintf(f, "# label\tname\tbytes\trom%%\tinstructions\n");
+        for (const SizeEntry& e : sorted)
+        {
+            const size_t bytes = e.Words * sizeof(Word);
+            std::fprintf(f, "label\t%s\t%zu\t%.2f\t%u\n", e.Label.c_str(), bytes, GetPercentage(bytes, GetROMSize()), e.Instructions);
+        }
+    }
+
+    void SizeReporter::Diff(FILE* f, const std::string& oldReport, const std::string& newReport) const
+    {
+        Diff(f, Read(oldReport), Read(newReport));
+    }
+
+    void SizeReporter::Diff(FILE* f, const std::string& oldReport, const std::vector<SizeEntry>& entries, const size_t dataSize) const
+    {
+        Diff(f, Read(oldReport), GetSizes(entries, dataSize));
+    }
+
+    SizeReporter::Sizes SizeReporter::Read(const std::string& path) const
+    {
+        std::ifstream in{ path };
+        if (in.is_open() == false)
+        {
+            std::fprintf(stderr, "can't open a size report %s\n", path.c_str());
+            exit(-1);
+        }
+
+        Sizes sizes;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::istringstream fields{ line };
+            std::string kind, name;
+            size_t bytes = 0;
+            if (!(fields >> kind >> name >> bytes))
+            {
+                std::fprintf(stderr, "wrong size report %s: `%s`\n", path.c_str(), line.c_str());
+                exit(-1);
+            }
+
+            // sections and labels share the table; sections can't clash with labels
+            // because a label can't contain a space.
+            sizes[kind == "section" ? "section " + name : name] = bytes;
+        }
+
+        return sizes;
+    }
+
+    SizeReporter::Sizes SizeReporter::GetSizes(const std::vector<SizeEntry>& entries, const size_t dataSize) const
+    {
+        Sizes sizes;
+        size_t programSize = 0;
+
+        for (const SizeEntry& e : entries)
+        {
+            sizes[e.Label] = e.Words * sizeof(Word);
+            programSize += e.Words * sizeof(Word);
+        }
+
+        sizes[std::string("section ") + DataSection] = dataSize;
+        sizes[std::string("section ") + ProgramSection] = programSize;
+
+        return sizes;
+    }
+
+    void SizeReporter::Diff(FILE* f, const Sizes& oldSizes, const Sizes& newSizes) const
+    {
+        struct Change
+        {
+            std::string Name;
+            long        Old;
+            long        New;
+        };
+
+        std::vector<Change> changes;
+        for (const auto& s : oldSizes)
+        {
+            auto it = newSizes.find(s.first);
+            const long newSize = it != newSizes.end() ? it->second : 0;
+            if (newSize != static_cast<long>(s.second))
+                changes.push_back(Change{ s.first, static_cast<long>(s.second), newSize });
+        }
+
+        for (const auto& s : newSizes)
+        {
+            if (oldSizes.find(s.first) == oldSizes.end() && s.second != 0)
+                changes.push_back(Change{ s.first, 0, static_cast<long>(s.second) });
+        }
+
+        std::stable_sort(changes.begin(), changes.end(), [](const Change& a, const Change& b) {
+            return std::labs(a.New - a.Old) > std::labs(b.New - b.Old);
+        });
+
+        std::fprintf(f, "# name\told\tnew\tdelta\n");
+        for (const Change& c : changes)
+            std::fprintf(f, "%s\t%ld\t%ld\t%+ld\n", c.Name.c_str(), c.Old, c.New, c.New - c.Old);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Macro11Common.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace AST
+{
+    struct SizeEntry
+    {
+        std::string  Label;
+        unsigned int Words;
+        unsigned int Instructions;
+    };
+
+    // Writes the per-label code size breakdown as tab separated text, largest contributors
+    // first, and compares two such reports to show which labels grew or shrank.
+    class SizeReporter
+    {
+    public:
+        void Write(FILE* f, const std::vector<SizeEntry>& entries, const size_t dataSize) const;
+        void Diff(FILE* f, const std::string& oldReport, const std::string& newReport) const;
+        void Diff(FILE* f, const std::string& oldReport, const std::vector<SizeEntry>& entries, const size_t dataSize) const;
+
+    private:
+        typedef std::map<std::string, size_t> Sizes;
+
+        Sizes Read(const std::string& path) const;
+        Sizes GetSizes(const std::vector<SizeEntry>& entries, const size_t dataSize) const;
+        void Diff(FILE* f, const Sizes& oldSizes, const Sizes& newSizes) const;
+    };
+}
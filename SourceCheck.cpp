@@ -0,0 +1,126 @@
+#include "SourceCheck.h"
+
+#include "Ast.h"
+#include "CodeGenerator.h"
+#include "MacroExpander.h"
+#include "SemanticAnalyzer.h"
+
+#include <string>
+
+extern int yyparse(AST::AbstractSyntaxTree* ast);
+extern void yyrestart(FILE* f);
+extern int yylineno;
+
+void SetParserMacros(MacroExpander* macros);
+
+namespace
+{
+    // the nested blocks of a false .IF are only counted, the labelled .IF of the first and the
+    // labelled .ENDC of the second included.
+    const char* LabelledConditionals =
+        " .IF NE 0\n"
+        "L1: .IF EQ 0\n"
+        " INC R1\n"
+        " .ENDC\n"
+        " INC R2\n"
+        " .ENDC\n"
+        " .IF NE 0\n"
+        " .IF EQ 0\n"
+        " INC R1\n"
+        "1$: .ENDC\n"
+        " INC R2\n"
+        " .ENDC\n"
+        " INC R3\n";
+
+    // a local label as an immediate, an absolute address, in an expression and as data. START is
+    // at 0100000, so 1$ is at 0100016.
+    const char* LocalLabelValues =
+        " MOV R0, #1$\n"
+        " MOV R1, @#1$\n"
+        " MOV R2, #1$+2\n"
+        "1$: .WORD 1$, 1$+4\n";
+
+    // the command only an immediate local label refers to is kept by --strip-unreachable.
+    const char* LocalLabelRoot =
+        " MOV R0, #1$\n"
+        " HALT\n"
+        "1$: INC R1\n";
+}
+
+bool SourceCheck::Run(FILE* f)
+{
+    const std::vector<Case> cases =
+    {
+        { "labelled conditionals in a false block", LabelledConditionals, true, false, { 005203 } },
+        { "local labels in expressions", LocalLabelValues, false, false, { 012700, 0100016, 013701, 0100016, 012702, 0100020, 0100016, 0100022 } },
+        { "local label used as data", LocalLabelRoot, false, true, { 012700, 0100010, 0, 005201 } },
+    };
+
+    bool passed = true;
+    for (const Case& c : cases)
+    {
+        passed = RunCase(f, c, false) && passed;
+        if (c.InMacro)
+            passed = RunCase(f, c, true) && passed;
+    }
+
+    return passed;
+}
+
+bool SourceCheck::RunCase(FILE* f, const Case& c, const bool inMacro)
+{
+    // the program starts with a NOP and ends with a HALT, around the source of the case.
+    std::string source = "START: NOP\n";
+    if (inMacro)
+        source = std::string(" .MACRO BODY\n") + c.Source + " .ENDM\n" + source + " BODY\n";
+    else
+        source += c.Source;
+    source += " HALT\n";
+
+    size_t errors = 0;
+    const std::vector<Word> program = Compile(source, c.StripUnreachable, &errors);
+
+    std::vector<Word> expected{ 0240 };
+    expected.insert(expected.end(), c.Expected.begin(), c.Expected.end());
+    expected.push_back(0);
+
+    const char* where = inMacro ? "in a macro" : "in the file";
+    if (errors != 0 || program != expected)
+    {
+        std::fprintf(f, "sources: %s %s: %zu errors, %zu words:", c.Name, where, errors, program.size());
+        for (const Word w : program)
+            std::fprintf(f, " %06o", w);
+        std::fprintf(f, "\n");
+        return false;
+    }
+
+    std::fprintf(f, "sources: %s %s, %zu words, ok.\n", c.Name, where, program.size());
+    return true;
+}
+
+std::vector<Word> SourceCheck::Compile(const std::string& source, const bool strip, size_t* errors)
+{
+    FILE* in = std::tmpfile();
+    std::fputs(source.c_str(), in);
+    std::rewind(in);
+    yyrestart(in);
+    yylineno = 1;
+
+    AST::AbstractSyntaxTree ast;
+    MacroExpander macros;
+    SetParserMacros(&macros);
+    yyparse(&ast);
+    SetParserMacros(nullptr);
+    std::fclose(in);
+
+    AST::SemanticAnalyzer sa;
+    ast.Traverse(sa);
+
+    AST::CodeGeneratorOptions options;
+    options.StripUnreachable = strip;
+    AST::CodeGenerator codeGen{ options };
+    const std::vector<Word> program = codeGen.Generate(&ast);
+    *errors = sa.GetErrors().size() + codeGen.GetErrors().size();
+
+    return program;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Macro11Common.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Compiles small programs through the macro expander, as the compiler does, and compares the words
+// of each with the words it has to assemble to. Programs that test the expander are compiled
+// once from the file and once from the body of a macro, so both ways of skipping and expanding
+// are checked against the same words.
+class SourceCheck
+{
+public:
+    // reports every program that assembles differently to f, returns whether there was none.
+    bool Run(FILE* f);
+
+private:
+    struct Case
+    {
+        const char*       Name;
+        const char*       Source;
+        bool              InMacro;
+        bool              StripUnreachable;
+        // the words between the NOP and the HALT the source is put between.
+        std::vector<Word> Expected;
+    };
+
+    bool RunCase(FILE* f, const Case& c, const bool inMacro);
+    static std::vector<Word> Compile(const std::string& source, const bool strip, size_t* errors);
+};
@@ -0,0 +1,31 @@
+#include "SourceLocation.h"
+
+#include <algorithm>
+
+SourceLocation::SourceLocation()
+    : Packed(0)
+{
+}
+
+SourceLocation::SourceLocation(const unsigned int file, const unsigned int line)
+    : Packed((file & ((1u << FileBits) - 1)) << LineBits | std::min(line, (1u << LineBits) - 1))
+{
+}
+
+unsigned int SourceFiles::Add(const std::string& path)
+{
+    const unsigned int file = Next;
+    Next = (Next + 1) & ((1u << SourceLocation::FileBits) - 1);
+
+    if (file < Paths.size())
+        Paths[file] = path;
+    else
+        Paths.push_back(path);
+
+    return file;
+}
+
+const std::string& SourceFiles::GetPath(const unsigned int file) const
+{
+    return Paths[file];
+}
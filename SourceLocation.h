@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A line of a compiled file packed into 32 bits: the file in the top FileBits, the line below.
+// Tokens of macro expansions and included files are located at the line that uses them, so every
+// command is on a line of the file being compiled.
+class SourceLocation
+{
+public:
+    static const unsigned int FileBits = 8;
+    static const unsigned int LineBits = 32 - FileBits;
+
+    SourceLocation();
+    // a line that doesn't fit is kept as the last one that does.
+    SourceLocation(const unsigned int file, const unsigned int line);
+
+    inline unsigned int GetFile() const;
+    inline unsigned int GetLine() const;
+
+private:
+    uint32_t Packed;
+};
+
+// The paths of the files a run compiles, so a location only keeps the id of its file.
+class SourceFiles
+{
+public:
+    // the diagnostics of a file are printed before the next file is compiled, so after 1 << FileBits
+    // files the ids of the first ones are given out again.
+    unsigned int Add(const std::string& path);
+    const std::string& GetPath(const unsigned int file) const;
+
+private:
+    std::vector<std::string> Paths;
+    unsigned int             Next = 0;
+};
+
+unsigned int SourceLocation::GetFile() const
+{
+    return Packed >> LineBits;
+}
+
+unsigned int SourceLocation::GetLine() const
+{
+    return Packed & ((1u << LineBits) - 1);
+}
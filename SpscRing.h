@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread.
+//
+// Values are swapped in and out of the slots instead of copied, so a queue of vectors recycles
+// their buffers: the producer gets back the emptied vector the consumer left in the slot. A full
+// queue makes the producer wait, which bounds the memory held between two pipeline stages.
+template <typename T>
+class SpscRing
+{
+public:
+    // the capacity is rounded up to a power of two.
+    explicit SpscRing(const size_t capacity);
+
+    void Push(T& value);
+    void Pop(T& value);
+
+private:
+    static void Wait(unsigned int* spins);
+
+private:
+    std::vector<T> Slots;
+    size_t         Mask;
+
+    alignas(64) std::atomic<size_t> Head;
+    alignas(64) std::atomic<size_t> Tail;
+};
+
+template <typename T>
+SpscRing<T>::SpscRing(const size_t capacity)
+    : Head(0)
+    , Tail(0)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    Slots.resize(size);
+    Mask = size - 1;
+}
+
+template <typename T>
+void SpscRing<T>::Wait(unsigned int* spins)
+{
+    // the other side is usually just a few instructions behind, so spin briefly before yielding.
+    if (++*spins > 64)
+        std::this_thread::yield();
+}
+
+template <typename T>
+void SpscRing<T>::Push(T& value)
+{
+    const size_t tail = Tail.load(std::memory_order_relaxed);
+
+    unsigned int spins = 0;
+    while (tail - Head.load(std::memory_order_acquire) == Slots.size())
+        Wait(&spins);
+
+    std::swap(Slots[tail & Mask], value);
+    Tail.store(tail + 1, std::memory_order_release);
+}
+
+template <typename T>
+void SpscRing<T>::Pop(T& value)
+{
+    const size_t head = Head.load(std::memory_order_relaxed);
+
+    unsigned int spins = 0;
+    while (Tail.load(std::memory_order_acquire) == head)
+        Wait(&spins);
+
+    std::swap(Slots[head & Mask], value);
+    Head.store(head + 1, std::memory_order_release);
+}
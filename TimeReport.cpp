@@ -0,0 +1,171 @@
+#include "TimeReport.h"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char* CounterNames[] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+    double ToSeconds(const std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+    }
+}
+
+TimeReport::TimeReport()
+    : Files(0)
+{
+    for (PhaseStats& stats : Phases)
+        stats = PhaseStats();
+
+    for (int& fd : CounterFds)
+        fd = -1;
+
+    OpenCounters();
+}
+
+TimeReport::~TimeReport()
+{
+#ifdef __linux__
+    for (const int fd : CounterFds)
+    {
+        if (fd != -1)
+            close(fd);
+    }
+#endif
+}
+
+void TimeReport::OpenCounters()
+{
+#ifdef __linux__
+    static const uint64_t configs[] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    for (int i = 0; i < static_cast<int>(HardwareCounter::Count); ++i)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // counters that the kernel or the hypervisor doesn't provide are reported as missing.
+        CounterFds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+}
+
+void TimeReport::ReadCounters(uint64_t* values) const
+{
+    for (int i = 0; i < static_cast<int>(HardwareCounter::Count); ++i)
+    {
+        values[i] = 0;
+#ifdef __linux__
+        if (CounterFds[i] != -1 && read(CounterFds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+            values[i] = 0;
+#endif
+    }
+}
+
+bool TimeReport::HasCounter(const int counter) const
+{
+    return CounterFds[counter] != -1;
+}
+
+void TimeReport::Begin(const CompilePhase phase)
+{
+    PhaseStats& stats = Phases[static_cast<int>(phase)];
+    ReadCounters(stats.StartCounters);
+    stats.Start = Clock::now();
+}
+
+void TimeReport::End(const CompilePhase phase)
+{
+    const Clock::time_point now = Clock::now();
+    uint64_t counters[static_cast<int>(HardwareCounter::Count)];
+    ReadCounters(counters);
+
+    PhaseStats& stats = Phases[static_cast<int>(phase)];
+    stats.Calls += 1;
+    stats.Time += now - stats.Start;
+
+    for (int i = 0; i < static_cast<int>(HardwareCounter::Count); ++i)
+        stats.Counters[i] += counters[i] - stats.StartCounters[i];
+}
+
+void TimeReport::AddFile()
+{
+    ++Files;
+}
+
+double TimeReport::GetSeconds(const CompilePhase phase) const
+{
+    return ToSeconds(Phases[static_cast<int>(phase)].Time);
+}
+
+void TimeReport::Print(FILE* f) const
+{
+    Clock::duration total = Clock::duration::zero();
+    for (const PhaseStats& stats : Phases)
+        total += stats.Time;
+
+    std::fprintf(f, "%-18s %6s %12s %7s", "phase", "calls", "seconds", "%");
+    for (int i = 0; i < static_cast<int>(HardwareCounter::Count); ++i)
+        std::fprintf(f, " %15s", CounterNames[i]);
+    std::fprintf(f, "\n");
+
+    for (int p = 0; p < static_cast<int>(CompilePhase::Count); ++p)
+    {
+        const PhaseStats& stats = Phases[p];
+        const double share = total.count() != 0 ? 100.0 * stats.Time.count() / total.count() : 0.0;
+
+        std::fprintf(f, "%-18s %6u %12.6f %7.2f", GetPhaseName(static_cast<CompilePhase>(p)), stats.Calls, ToSeconds(stats.Time), share);
+        for (int i = 0; i < static_cast<int>(HardwareCounter::Count); ++i)
+        {
+            if (HasCounter(i))
+                std::fprintf(f, " %15llu", static_cast<unsigned long long>(stats.Counters[i]));
+            else
+                std::fprintf(f, " %15s", "n/a");
+        }
+        std::fprintf(f, "\n");
+    }
+
+    std::fprintf(f, "%-18s %6u %12.6f\n", "total", Files, ToSeconds(total));
+}
+
+void TimeReport::WriteJson(FILE* f) const
+{
+    Clock::duration total = Clock::duration::zero();
+    for (const PhaseStats& stats : Phases)
+        total += stats.Time;
+
+    std::fprintf(f, "{\n  \"files\": %u,\n  \"seconds\": %.9f,\n  \"phases\": [", Files, ToSeconds(total));
+    for (int p = 0; p < static_cast<int>(CompilePhase::Count); ++p)
+    {
+        const PhaseStats& stats = Phases[p];
+        std::fprintf(f, "%s\n    { \"name\": \"%s\", \"calls\": %u, \"seconds\": %.9f",
+                     p == 0 ? "" : ",", GetPhaseName(static_cast<CompilePhase>(p)), stats.Calls, ToSeconds(stats.Time));
+
+        for (int i = 0; i < static_cast<int>(HardwareCounter::Count); ++i)
+        {
+            if (HasCounter(i))
+                std::fprintf(f, ", \"%s\": %llu", CounterNames[i], static_cast<unsigned long long>(stats.Counters[i]));
+            else
+                std::fprintf(f, ", \"%s\": null", CounterNames[i]);
+        }
+        std::fprintf(f, " }");
+    }
+    std::fprintf(f, "\n  ]\n}\n");
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Instrumentation.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+enum class HardwareCounter : unsigned char
+{
+    Cycles       = 0,
+    Instructions = 1,
+    CacheMisses  = 2,
+    BranchMisses = 3,
+    Count
+};
+
+// Accumulates wall time and, where perf_event_open is available, hardware counters for
+// every compile phase. Several compiles in one run add up into the same report.
+class TimeReport
+{
+public:
+    TimeReport();
+    ~TimeReport();
+
+    void Begin(const CompilePhase phase);
+    void End(const CompilePhase phase);
+    void AddFile();
+
+    double GetSeconds(const CompilePhase phase) const;
+
+    void Print(FILE* f) const;
+    void WriteJson(FILE* f) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct PhaseStats
+    {
+        unsigned int      Calls;
+        Clock::duration   Time;
+        uint64_t          Counters[static_cast<int>(HardwareCounter::Count)];
+        Clock::time_point Start;
+        uint64_t          StartCounters[static_cast<int>(HardwareCounter::Count)];
+    };
+
+    void OpenCounters();
+    void ReadCounters(uint64_t* values) const;
+    bool HasCounter(const int counter) const;
+
+private:
+    PhaseStats   Phases[static_cast<int>(CompilePhase::Count)];
+    int          CounterFds[static_cast<int>(HardwareCounter::Count)];
+    unsigned int Files;
+};
@@ -0,0 +1,73 @@
+#include "Trace.h"
+
+#include <unistd.h>
+
+Trace::Trace()
+    : Start(Clock::now())
+{
+}
+
+long long Trace::GetMicroseconds(const Clock::time_point time) const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - Start).count();
+}
+
+unsigned int Trace::GetThreadId()
+{
+    // small sequential ids read better in the trace viewer than native thread ids.
+    // Called with the mutex held.
+    auto it = ThreadIds.find(std::this_thread::get_id());
+    if (it != ThreadIds.end())
+        return it->second;
+
+    const unsigned int id = ThreadIds.size() + 1;
+    ThreadIds[std::this_thread::get_id()] = id;
+
+    return id;
+}
+
+void Trace::AddSpan(const char* name, const std::string& file, const Clock::time_point begin, const Clock::time_point end)
+{
+    std::lock_guard<std::mutex> lock{ Mutex };
+    Events.push_back(Event{ name, file, 'X', GetMicroseconds(begin), GetMicroseconds(end) - GetMicroseconds(begin), 0, GetThreadId() });
+}
+
+void Trace::AddCounter(const char* name, const uint64_t value, const Clock::time_point time)
+{
+    std::lock_guard<std::mutex> lock{ Mutex };
+    Events.push_back(Event{ name, std::string(), 'C', GetMicroseconds(time), 0, value, GetThreadId() });
+}
+
+void Trace::Write(FILE* f) const
+{
+    std::lock_guard<std::mutex> lock{ Mutex };
+    const int pid = getpid();
+
+    std::fprintf(f, "{\"traceEvents\":[\n");
+    std::fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"macro11\"}}", pid);
+
+    for (const Event& e : Events)
+    {
+        if (e.Phase == 'X')
+        {
+            std::fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"compile\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%u,\"args\":{\"file\":\"",
+                         e.Name, e.Timestamp, e.Duration, pid, e.Thread);
+
+            for (const char c : e.File)
+            {
+                if (c == '"' || c == '\\')
+                    std::fputc('\\', f);
+                std::fputc(c, f);
+            }
+
+            std::fprintf(f, "\"}}");
+        }
+        else
+        {
+            std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%lld,\"pid\":%d,\"tid\":%u,\"args\":{\"value\":%llu}}",
+                         e.Name, e.Timestamp, pid, e.Thread, static_cast<unsigned long long>(e.Value));
+        }
+    }
+
+    std::fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Collects spans and counters from any number of compile threads and writes them in the
+// Chrome trace event format, which chrome://tracing and Perfetto load directly.
+class Trace
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    Trace();
+
+    void AddSpan(const char* name, const std::string& file, const Clock::time_point begin, const Clock::time_point end);
+    void AddCounter(const char* name, const uint64_t value, const Clock::time_point time);
+
+    void Write(FILE* f) const;
+
+private:
+    struct Event
+    {
+        const char*  Name;
+        std::string  File;
+        char         Phase;
+        long long    Timestamp;
+        long long    Duration;
+        uint64_t     Value;
+        unsigned int Thread;
+    };
+
+    long long GetMicroseconds(const Clock::time_point time) const;
+    unsigned int GetThreadId();
+
+private:
+    const Clock::time_point                  Start;
+    mutable std::mutex                       Mutex;
+    std::vector<Event>                       Events;
+    std::map<std::thread::id, unsigned int>  ThreadIds;
+};
@@ -0,0 +1,224 @@
+#include "UnreachableCodeEliminator.h"
+#include "LocalLabels.h"
+#include "Utils.h"
+
+namespace AST
+{
+    UnreachableCodeEliminator::UnreachableCodeEliminator(const std::vector<std::string>& exportedLabels)
+        : Program(nullptr)
+        , Roots(exportedLabels)
+    {
+    }
+
+    void UnreachableCodeEliminator::Visit(ProgramNode* node)
+    {
+        Program = node;
+    }
+
+    void UnreachableCodeEliminator::Visit(CommandNode* node)
+    {
+        AddCommand(node, 1, nullptr);
+    }
+
+    void UnreachableCodeEliminator::Visit(OneOperandCommandNode* node)
+    {
+        const InstructionGroup g = GetInstructionGroup(node->Opcode);
+        const unsigned int size = 1 + GetOperandSize(node->First, g);
+
+        if (g == InstructionGroup::Branch || node->Opcode == OPCODE_JMP)
+        {
+            AddCommand(node, size, node->First);
+        }
+        else
+        {
+            AddCommand(node, size, nullptr);
+            AddReference(node->First);
+        }
+    }
+
+    void UnreachableCodeEliminator::Visit(DoubleOperandCommandNode* node)
+    {
+        const InstructionGroup g = GetInstructionGroup(node->Opcode);
+        const unsigned int size = 1 + GetOperandSize(node->First, g) + GetOperandSize(node->Second, g);
+
+        if (node->Opcode == OPCODE_JSR)
+        {
+            AddCommand(node, size, node->First);
+        }
+        else
+        {
+            AddCommand(node, size, nullptr);
+            AddReference(node->First);
+        }
+
+        AddReference(node->Second);
+    }
+
+    void UnreachableCodeEliminator::Visit(DataNode* node)
+    {
+        // data is reached through addresses the eliminator can't follow, so it is always kept.
+        Data.push_back(Commands.size());
+        AddCommand(node, node->GetWords(), nullptr);
+    }
+
+    void UnreachableCodeEliminator::AddCommand(CommandNode* node, const unsigned int size, const OperandNode* target)
+    {
+        for (LabelNode* l = node->Labels; l != nullptr; l = l->Next)
+            LabelsTable[l->Name] = Commands.size();
+
+        Commands.push_back(node);
+        CommandSizes.push_back(size);
+        Targets.push_back(target != nullptr && target->AddrType == AddressingType::Label && target->LabelName != nullptr ? target : nullptr);
+    }
+
+    void UnreachableCodeEliminator::AddReference(const OperandNode* node)
+    {
+        // a label used as data (an address loaded into a register, stored in a table, ...) may be
+        // jumped to indirectly later, so the labelled code is conservatively kept.
+        if (node->AddrType == AddressingType::Label && node->LabelName != nullptr)
+        {
+            if (LocalLabels::IsLocal(node->LabelName))
+                LocalRoots.push_back(node);
+            else
+                AddRoot(node->LabelName);
+        }
+    }
+
+    void UnreachableCodeEliminator::AddRoot(const std::string& labelName)
+    {
+        Roots.push_back(labelName);
+    }
+
+    void UnreachableCodeEliminator::MarkReachable()
+    {
+        Reachable.assign(Commands.size(), false);
+
+        // a label in an expression is used as data as well; the expressions are only complete once
+        // the whole program is parsed.
+        if (Program != nullptr)
+        {
+            for (const std::string& symbol : Program->Expressions.GetReferencedSymbols())
+                AddRoot(symbol);
+
+            // other modules may jump to the labels the program exports.
+            for (const std::string& global : Program->Globals)
+                AddRoot(global);
+        }
+
+        std::vector<size_t> pending{ Data };
+        if (Commands.empty() == false)
+            pending.push_back(0);
+
+        // only the commands that local labels label are looked up by node.
+        for (const OperandNode* target : Targets)
+        {
+            if (target != nullptr && target->Target != nullptr)
+                LocalTargets.emplace(target->Target, 0);
+        }
+
+        for (const OperandNode* root : LocalRoots)
+            LocalTargets.emplace(root->Target, 0);
+
+        // local labels in expressions are used as data, like the labels of LocalRoots.
+        std::vector<const CommandNode*> localCommands;
+        if (Program != nullptr)
+            localCommands = Program->Expressions.GetReferencedCommands();
+
+        for (const CommandNode* command : localCommands)
+            LocalTargets.emplace(command, 0);
+
+        for (size_t i = 0; i < Commands.size() && LocalTargets.empty() == false; ++i)
+        {
+            auto it = LocalTargets.find(Commands[i]);
+            if (it != LocalTargets.end())
+                it->second = i;
+        }
+
+        for (const std::string& root : Roots)
+        {
+            auto it = LabelsTable.find(root);
+            if (it != LabelsTable.end())
+                pending.push_back(it->second);
+        }
+
+        for (const OperandNode* root : LocalRoots)
+        {
+            size_t command = 0;
+            if (FindTarget(root, &command))
+                pending.push_back(command);
+        }
+
+        for (const CommandNode* command : localCommands)
+            pending.push_back(LocalTargets[command]);
+
+        while (pending.empty() == false)
+        {
+            const size_t i = pending.back();
+            pending.pop_back();
+
+            if (i >= Commands.size() || Reachable[i])
+                continue;
+
+            Reachable[i] = true;
+            if (IsUnconditionalTransfer(Commands[i]->Opcode) == false)
+                pending.push_back(i + 1);
+
+            size_t target = 0;
+            if (Targets[i] != nullptr && FindTarget(Targets[i], &target))
+                pending.push_back(target);
+        }
+    }
+
+    bool UnreachableCodeEliminator::FindTarget(const OperandNode* node, size_t* command) const
+    {
+        if (node->Target != nullptr)
+        {
+            auto it = LocalTargets.find(node->Target);
+            if (it == LocalTargets.end())
+                return false;
+
+            *command = it->second;
+            return true;
+        }
+
+        auto it = LabelsTable.find(node->LabelName);
+        if (it == LabelsTable.end())
+            return false;
+
+        *command = it->second;
+        return true;
+    }
+
+    void UnreachableCodeEliminator::Eliminate()
+    {
+        MarkReachable();
+
+        CommandNode* head = nullptr;
+        CommandNode* tail = nullptr;
+
+        for (size_t i = 0; i < Commands.size(); ++i)
+        {
+            CommandNode* node = Commands[i];
+            node->Next = nullptr;
+
+            if (Reachable[i])
+            {
+                if (tail != nullptr)
+                    tail->Next = node;
+                else
+                    head = node;
+
+                tail = node;
+            }
+            else
+            {
+                ++Stats.RemovedCommands;
+                Stats.ReclaimedBytes += CommandSizes[i] * sizeof(Word);
+                delete node;
+            }
+        }
+
+        if (Program != nullptr)
+            Program->Commands = head;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Ast.h"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace AST
+{
+    struct EliminationStats
+    {
+        unsigned int RemovedCommands = 0;
+        unsigned int ReclaimedBytes  = 0;
+    };
+
+    class UnreachableCodeEliminator final : public AstVisitor
+    {
+    public:
+        UnreachableCodeEliminator(const std::vector<std::string>& exportedLabels);
+
+        virtual void Visit(ProgramNode* node) override;
+        virtual void Visit(CommandNode* node) override;
+        virtual void Visit(OneOperandCommandNode* node) override;
+        virtual void Visit(DoubleOperandCommandNode* node) override;
+        virtual void Visit(DataNode* node) override;
+
+        void Eliminate();
+
+        inline const EliminationStats& GetStats() const;
+
+    private:
+        void AddCommand(CommandNode* node, const unsigned int size, const OperandNode* target);
+        void AddReference(const OperandNode* node);
+        void AddRoot(const std::string& labelName);
+        void MarkReachable();
+        bool FindTarget(const OperandNode* node, size_t* command) const;
+
+    private:
+        ProgramNode*                  Program;
+        std::vector<CommandNode*>     Commands;
+        std::vector<unsigned int>     CommandSizes;
+        std::vector<const OperandNode*> Targets;
+        std::vector<std::string>      Roots;
+        // operands that use a local label as data; the parser resolves them once their scope ends.
+        std::vector<const OperandNode*> LocalRoots;
+        std::vector<size_t>           Data;
+        std::map<std::string, size_t> LabelsTable;
+        std::unordered_map<const CommandNode*, size_t> LocalTargets;
+        std::vector<bool>             Reachable;
+        EliminationStats              Stats;
+    };
+
+    const EliminationStats& UnreachableCodeEliminator::GetStats() const
+    {
+        return Stats;
+    }
+}
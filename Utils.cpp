@@ -18,4 +18,50 @@ namespace AST
 
         return InstructionGroup::Unknown;
     }
+
+    int GetInvertedBranchOpcode(const int opcode)
+    {
+        // conditional branches come in pairs that differ only in bit 8 (BNE/BEQ, BGE/BLT, ...).
+        // BR has no inverse.
+        if (opcode == OPCODE_BR)
+            return opcode;
+
+        return opcode ^ 0400;
+    }
+
+    bool IsUnconditionalTransfer(const int opcode)
+    {
+        switch (opcode)
+        {
+        case OPCODE_BR:
+        case OPCODE_JMP:
+        case OPCODE_RTS:
+        case OPCODE_RTI:
+        case OPCODE_RETURN:
+        case OPCODE_HALT:
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    bool TransfersToOperand(const int opcode)
+    {
+        return opcode == OPCODE_JMP || opcode == OPCODE_JSR;
+    }
+
+    unsigned int GetOperandSize(const OperandNode* node, const InstructionGroup g)
+    {
+        if (   node->OpType   == OperandType::Number
+            || node->AddrType == AddressingType::Index
+            || node->AddrType == AddressingType::IndexDeferred
+            || (node->AddrType == AddressingType::Label && g != InstructionGroup::Branch)
+           )
+        {
+            return 1;
+        }
+
+        return 0;
+    }
 }
\ No newline at end of file
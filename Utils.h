@@ -1,8 +1,14 @@
 #pragma once
 
 #include "Macro11Common.h"
+#include "Ast.h"
 
 namespace AST
 {
     InstructionGroup GetInstructionGroup(const int opcode);
+    int GetInvertedBranchOpcode(const int opcode);
+    bool IsUnconditionalTransfer(const int opcode);
+    // JMP and JSR go to the address of their operand instead of reading the word at it.
+    bool TransfersToOperand(const int opcode);
+    unsigned int GetOperandSize(const OperandNode* node, const InstructionGroup g);
 }
\ No newline at end of file
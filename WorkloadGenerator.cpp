@@ -0,0 +1,184 @@
+#include "WorkloadGenerator.h"
+
+#include <cmath>
+
+namespace
+{
+    const char* BranchOpcodes[]   = { "BR", "BNE", "BEQ", "BPL", "BMI", "BCC", "BCS", "BGE", "BLT", "JMP" };
+    const char* SingleOpcodes[]   = { "CLR", "INC", "DEC", "NEG", "COM", "ASL", "ASR", "INCB", "COMB" };
+    const char* DoubleOpcodes[]   = { "MOV", "ADD", "SUB", "CMP", "BIT", "BIS", "BIC", "MOVB" };
+    const char* CommentWords[]    = { "load", "the", "next", "value", "into", "register", "and", "loop", "until", "done" };
+
+    template <typename T, size_t N>
+    size_t Count(const T (&)[N])
+    {
+        return N;
+    }
+}
+
+WorkloadGenerator::WorkloadGenerator(const WorkloadOptions& options)
+    : Options(options)
+    , ModeWeightsSum(0)
+{
+    for (const unsigned int w : Options.ModeWeights)
+        ModeWeightsSum += w;
+
+    if (ModeWeightsSum == 0)
+    {
+        Options.ModeWeights[static_cast<int>(OperandMode::Register)] = 1;
+        ModeWeightsSum = 1;
+    }
+}
+
+uint64_t WorkloadGenerator::Hash(const uint64_t line, const uint64_t salt) const
+{
+    // splitmix64 finalizer
+    uint64_t x = Options.Seed * 0x9E3779B97F4A7C15ull + line * 0xBF58476D1CE4E5B9ull + salt * 0x94D049BB133111EBull;
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+double WorkloadGenerator::GetUnit(const uint64_t line, const uint64_t salt) const
+{
+    return (Hash(line, salt) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool WorkloadGenerator::IsComment(const uint64_t line) const
+{
+    return GetUnit(line, SaltComment) < Options.CommentRatio;
+}
+
+bool WorkloadGenerator::HasLabel(const uint64_t line) const
+{
+    return line == 0 || (IsComment(line) == false && GetUnit(line, SaltLabel) < Options.LabelDensity);
+}
+
+bool WorkloadGenerator::FindLabel(const uint64_t line, const uint64_t salt, uint64_t* label) const
+{
+    const bool forward = GetUnit(line, salt * 16 + SaltDirection) < Options.ForwardRatio;
+    const double u = GetUnit(line, salt * 16 + SaltDistance);
+
+    uint64_t distance = 1;
+    if (Options.Distribution == BranchDistribution::Uniform)
+        distance += static_cast<uint64_t>(u * 2 * Options.BranchDistance);
+    else
+        distance += static_cast<uint64_t>(-std::log(1.0 - u) * Options.BranchDistance);
+
+    // the label closest to the chosen distance in the chosen direction, falling back to the
+    // other direction near the ends of the program.
+    const uint64_t limit = static_cast<uint64_t>(16 / (Options.LabelDensity > 0 ? Options.LabelDensity : 1)) + 16;
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        const bool up = attempt == 0 ? forward : !forward;
+        if (up == false && distance > line)
+            distance = line;
+
+        int64_t target = up ? line + distance : line - distance;
+        for (uint64_t step = 0; step < limit && target >= 0 && static_cast<uint64_t>(target) < Options.Lines; ++step)
+        {
+            if (HasLabel(target))
+            {
+                *label = target;
+                return true;
+            }
+
+            target += up ? 1 : -1;
+        }
+    }
+
+    return false;
+}
+
+OperandMode WorkloadGenerator::GetMode(const uint64_t line, const uint64_t salt, const bool isDestination) const
+{
+    unsigned int pick = Hash(line, salt) % ModeWeightsSum;
+
+    OperandMode mode = OperandMode::Register;
+    for (int m = 0; m < static_cast<int>(OperandMode::Count); ++m)
+    {
+        if (pick < Options.ModeWeights[m])
+        {
+            mode = static_cast<OperandMode>(m);
+            break;
+        }
+
+        pick -= Options.ModeWeights[m];
+    }
+
+    if (isDestination && mode == OperandMode::Immediate)
+        mode = OperandMode::Register;
+
+    return mode;
+}
+
+std::string WorkloadGenerator::GetOperand(const uint64_t line, const uint64_t salt, const bool isDestination) const
+{
+    const uint64_t h = Hash(line, salt * 16 + SaltValue);
+    const int reg = h % 6;
+    const int value = (h >> 8) % 512;
+    char operand[32];
+
+    switch (GetMode(line, salt, isDestination))
+    {
+    case OperandMode::Register:      std::snprintf(operand, sizeof(operand), "R%d", reg);                  break;
+    case OperandMode::Deferred:      std::snprintf(operand, sizeof(operand), "(R%d)", reg);                break;
+    case OperandMode::AutoIncrement: std::snprintf(operand, sizeof(operand), "(R%d)+", reg);               break;
+    case OperandMode::AutoDecrement: std::snprintf(operand, sizeof(operand), "-(R%d)", reg);               break;
+    case OperandMode::Index:         std::snprintf(operand, sizeof(operand), "%d(R%d)", value, reg);       break;
+    case OperandMode::Immediate:     std::snprintf(operand, sizeof(operand), "#%d", value);                break;
+    case OperandMode::Absolute:      std::snprintf(operand, sizeof(operand), "@#%d", value);               break;
+    default:
+        {
+            uint64_t label = 0;
+            if (FindLabel(line, salt, &label))
+                std::snprintf(operand, sizeof(operand), "L%llu", static_cast<unsigned long long>(label));
+            else
+                std::snprintf(operand, sizeof(operand), "R%d", reg);
+        }
+        break;
+    }
+
+    return operand;
+}
+
+void WorkloadGenerator::Generate(FILE* f) const
+{
+    for (uint64_t line = 0; line < Options.Lines; ++line)
+    {
+        if (line != 0 && IsComment(line))
+        {
+            const uint64_t h = Hash(line, SaltKind);
+            std::fprintf(f, ";");
+            for (uint64_t w = 0; w < 3 + h % 8; ++w)
+                std::fprintf(f, " %s", CommentWords[(h >> (w * 4)) % Count(CommentWords)]);
+            std::fprintf(f, "\n");
+            continue;
+        }
+
+        if (HasLabel(line))
+            std::fprintf(f, "L%llu:", static_cast<unsigned long long>(line));
+
+        const double kind = GetUnit(line, SaltKind);
+        const uint64_t opcode = Hash(line, SaltOpcode);
+        uint64_t target = 0;
+
+        if (kind < Options.BranchRatio && FindLabel(line, SaltKind, &target))
+        {
+            std::fprintf(f, "\t%s L%llu\n", BranchOpcodes[opcode % Count(BranchOpcodes)], static_cast<unsigned long long>(target));
+        }
+        else if (kind < Options.BranchRatio + (1.0 - Options.BranchRatio) / 3)
+        {
+            std::fprintf(f, "\t%s %s\n", SingleOpcodes[opcode % Count(SingleOpcodes)], GetOperand(line, SaltFirst, true).c_str());
+        }
+        else
+        {
+            std::fprintf(f, "\t%s %s, %s\n", DoubleOpcodes[opcode % Count(DoubleOpcodes)],
+                         GetOperand(line, SaltFirst, false).c_str(), GetOperand(line, SaltSecond, true).c_str());
+        }
+    }
+}
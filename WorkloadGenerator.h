@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+enum class OperandMode : unsigned char
+{
+    Register      = 0,
+    Deferred      = 1,
+    AutoIncrement = 2,
+    AutoDecrement = 3,
+    Index         = 4,
+    Immediate     = 5,
+    Absolute      = 6,
+    Label         = 7,
+    Count
+};
+
+enum class BranchDistribution : unsigned char
+{
+    Uniform   = 0,
+    Geometric = 1,
+};
+
+struct WorkloadOptions
+{
+    uint64_t           Lines          = 1000;
+    double             LabelDensity   = 0.1;
+    double             ForwardRatio   = 0.5;
+    double             CommentRatio   = 0.1;
+    double             BranchRatio    = 0.15;
+    unsigned int       BranchDistance = 16;
+    BranchDistribution Distribution   = BranchDistribution::Geometric;
+    unsigned int       ModeWeights[static_cast<int>(OperandMode::Count)] = { 8, 2, 2, 2, 2, 3, 1, 1 };
+    uint64_t           Seed           = 1;
+};
+
+// Writes a syntactically valid MACRO-11 program of the requested shape. Every decision is
+// a hash of the seed and the line number, so the same options always give the same text and
+// no per-line state is kept, whatever the program size.
+class WorkloadGenerator
+{
+public:
+    WorkloadGenerator(const WorkloadOptions& options);
+
+    void Generate(FILE* f) const;
+
+private:
+    enum Salt : uint64_t
+    {
+        SaltComment = 1,
+        SaltLabel,
+        SaltKind,
+        SaltOpcode,
+        SaltDirection,
+        SaltDistance,
+        SaltFirst,
+        SaltSecond,
+        SaltValue,
+    };
+
+    uint64_t Hash(const uint64_t line, const uint64_t salt) const;
+    double GetUnit(const uint64_t line, const uint64_t salt) const;
+
+    bool IsComment(const uint64_t line) const;
+    bool HasLabel(const uint64_t line) const;
+    bool FindLabel(const uint64_t line, const uint64_t salt, uint64_t* label) const;
+
+    std::string GetOperand(const uint64_t line, const uint64_t salt, const bool isDestination) const;
+    OperandMode GetMode(const uint64_t line, const uint64_t salt, const bool isDestination) const;
+
+private:
+    WorkloadOptions Options;
+    unsigned int    ModeWeightsSum;
+};
@@ -1,6 +1,10 @@
 %{
   #include "ast.h"
+  #include "LocalLabels.h"
+  #include "MacroExpander.h"
+  #include "Pipeline.h"
   #include <cstdio>
+  #include <string>
 
   // Declare stuff from Flex that Bison needs to know about:
   extern int yylex();
@@ -9,6 +13,28 @@
   extern int yylineno;
  
   void yyerror(AST::AbstractSyntaxTree* ast, const char *s);
+  AST::CommandNode* ReverseCommands(AST::CommandNode* commands);
+  AST::OperandNode* AddressOperand(AST::AbstractSyntaxTree* ast, const AST::Expression& e);
+  AST::OperandNode* NumberOperand(AST::AbstractSyntaxTree* ast, const AST::Expression& e, const AddressingType addrType);
+  AST::OperandNode* IndexOperand(AST::AbstractSyntaxTree* ast, const AST::Expression& e, const int reg, const AddressingType addrType);
+  void AddDataWord(AST::AbstractSyntaxTree* ast, AST::DataNode* data, const AST::Expression& e);
+  void AddDataByte(AST::AbstractSyntaxTree* ast, AST::DataNode* data, const AST::Expression& e);
+  unsigned int GetDataCount(AST::AbstractSyntaxTree* ast, const AST::Expression& e, const char* directive);
+  AST::LabelNode* AddLabel(AST::AbstractSyntaxTree* ast, char* name);
+  void SetLabels(AST::CommandNode* command, AST::LabelNode* labels);
+  void EndLocalScope(AST::AbstractSyntaxTree* ast);
+
+  // the node the directives of a data run are added to.
+  static AST::DataNode* ActiveData = nullptr;
+  // the local labels since the last label that isn't local.
+  static LocalLabels ActiveLocals;
+
+  // the parser reads tokens and reports commands through these, so a pipeline can sit in between.
+  int ParserLex();
+  int ParserLine();
+  SourceLocation ParserLocation();
+  void ParserCommand(AST::CommandNode* command);
+  #define yylex ParserLex
 %}
 
 %debug
@@ -23,6 +49,8 @@
   char* sval;
   AST::LabelNode*   label;
   AST::OperandNode* operand;
+  AST::Expression   expression;
+  AST::DataNode*    data;
   AST::CommandNode* command_line;
   AST::CommandNode* command_list;
   AST::ProgramNode* program;
@@ -34,11 +62,17 @@
 %token <ival>        COMMAND
 %token <ival>        REGISTER
 %token <sval>        LABEL
+%token <sval>        SYMBOL
+%token <sval>        TEXT
 
 %type <label>        LABEL_LIST
 %type <operand>      OPERAND
+%type <expression>   EXPRESSION
+%type <expression>   TERM
 %type <command_line> COMMAND_LINE
 %type <command_list> COMMAND_LIST
+%type <data>         DATA
+%type <data>         DATA_BEGIN
 %type <program>      PROGRAM
 
 %token TOKEN_DIRECT_ASSIGN  "=" //=
@@ -54,52 +88,308 @@
 %token TOKEN_DIV            "/" // /
 %token TOKEN_LOGIC_AND      "&" //&
 %token TOKEN_LOGIC_OR       "!" //!
+%token TOKEN_LEFT_ANGLE     "<" //<
+%token TOKEN_RIGHT_ANGLE    ">" //>
 %token DOLLAR "$"
+%token SCANNER_ERROR
+
+// expanded before the parser sees the tokens.
+%token MACRO_DIRECTIVE      ".MACRO"
+%token ENDM_DIRECTIVE       ".ENDM"
+%token REPT_DIRECTIVE       ".REPT"
+%token ENDR_DIRECTIVE       ".ENDR"
+%token IRP_DIRECTIVE        ".IRP"
+%token INCLUDE_DIRECTIVE    ".INCLUDE"
+%token IF_DIRECTIVE         ".IF"
+%token IFF_DIRECTIVE        ".IFF"
+%token IFT_DIRECTIVE        ".IFT"
+%token IFTF_DIRECTIVE       ".IFTF"
+%token ENDC_DIRECTIVE       ".ENDC"
+%token IIF_DIRECTIVE        ".IIF"
+
+%token WORD_DIRECTIVE       ".WORD"
+%token BYTE_DIRECTIVE       ".BYTE"
+%token ASCII_DIRECTIVE      ".ASCII"
+%token ASCIZ_DIRECTIVE      ".ASCIZ"
+%token BLKW_DIRECTIVE       ".BLKW"
+%token BLKB_DIRECTIVE       ".BLKB"
+%token EVEN_DIRECTIVE       ".EVEN"
+%token GLOBL_DIRECTIVE      ".GLOBL"
+
+// a data run goes on with the next directive instead of ending before it.
+%nonassoc DATA_END
+%nonassoc ".WORD" ".BYTE" ".ASCII" ".ASCIZ" ".BLKW" ".BLKB" ".EVEN"
 
 %%
 
 PROGRAM
-  : COMMAND_LIST                           { $$ = new AST::ProgramNode($1); Ast->SetProgram($$);}
+  : COMMAND_LIST                           { EndLocalScope(Ast); $$ = new AST::ProgramNode(ReverseCommands($1), std::move(Ast->GetExpressions())); $$->Globals = std::move(Ast->GetGlobals()); Ast->SetProgram($$);}
   ;
 
+// left recursive so the parser stack doesn't grow with the program; the list is built backwards.
+// An assignment or a .GLOBL adds no command.
 COMMAND_LIST
-  : COMMAND_LINE COMMAND_LIST              { $$ = $1; $$->Next = $2;}
-  | COMMAND_LINE                           { $$ = $1;}
+  : COMMAND_LIST COMMAND_LINE              { $$ = $2; $$->Next = $1; ParserCommand($2);}
+  | COMMAND_LIST ASSIGNMENT                { $$ = $1;}
+  | COMMAND_LIST GLOBAL                    { $$ = $1;}
+  | COMMAND_LINE                           { $$ = $1; ParserCommand($1);}
+  | ASSIGNMENT                             { $$ = nullptr;}
+  | GLOBAL                                 { $$ = nullptr;}
   ;
 
 COMMAND_LINE
-  : COMMAND OPERAND "," OPERAND            { $$ = new AST::DoubleOperandCommandNode($1, $2, $4, yylineno);}
-  | COMMAND OPERAND                        { $$ = new AST::OneOperandCommandNode($1, $2, yylineno);}
-  | COMMAND                                { $$ = new AST::CommandNode($1, yylineno); }
-  | LABEL_LIST COMMAND OPERAND "," OPERAND { $$ = new AST::DoubleOperandCommandNode($2, $3, $5, yylineno); $$->Labels = $1;}
-  | LABEL_LIST COMMAND OPERAND             { $$ = new AST::OneOperandCommandNode($2, $3, yylineno); $$->Labels = $1;}
-  | LABEL_LIST COMMAND                     { $$ = new AST::CommandNode($2, yylineno); $$->Labels = $1; }
+  : COMMAND OPERAND "," OPERAND            { $$ = new AST::DoubleOperandCommandNode($1, $2, $4, ParserLocation());}
+  | COMMAND OPERAND                        { $$ = new AST::OneOperandCommandNode($1, $2, ParserLocation());}
+  | COMMAND                                { $$ = new AST::CommandNode($1, ParserLocation()); }
+  | LABEL_LIST COMMAND OPERAND "," OPERAND { $$ = new AST::DoubleOperandCommandNode($2, $3, $5, ParserLocation()); SetLabels($$, $1);}
+  | LABEL_LIST COMMAND OPERAND             { $$ = new AST::OneOperandCommandNode($2, $3, ParserLocation()); SetLabels($$, $1);}
+  | LABEL_LIST COMMAND                     { $$ = new AST::CommandNode($2, ParserLocation()); SetLabels($$, $1);}
+  | DATA %prec DATA_END                    { $$ = $1;}
+  | LABEL_LIST DATA %prec DATA_END         { $$ = $2; SetLabels($$, $1);}
   ;  
+
+// directives without a label between them build one node, so a table is emitted in one copy.
+DATA
+  : DATA_BEGIN DATA_DIRECTIVE              { $$ = $1;}
+  | DATA DATA_DIRECTIVE                    { $$ = $1;}
+  ;
+
+DATA_BEGIN
+  : /* empty */                            { $$ = new AST::DataNode(ParserLocation()); ActiveData = $$;}
+  ;
+
+DATA_DIRECTIVE
+  : ".WORD" WORD_LIST
+  | ".BYTE" BYTE_LIST
+  | ".ASCII" TEXT                          { ActiveData->AddText($2, false);}
+  | ".ASCIZ" TEXT                          { ActiveData->AddText($2, true);}
+  | ".BLKW" EXPRESSION                     { ActiveData->Align(); ActiveData->Reserve(GetDataCount(Ast, $2, ".BLKW") * sizeof(Word));}
+  | ".BLKB" EXPRESSION                     { ActiveData->Reserve(GetDataCount(Ast, $2, ".BLKB"));}
+  | ".EVEN"                                { ActiveData->Align();}
+  ;
+
+WORD_LIST
+  : EXPRESSION                             { AddDataWord(Ast, ActiveData, $1);}
+  | WORD_LIST "," EXPRESSION               { AddDataWord(Ast, ActiveData, $3);}
+  ;
+
+BYTE_LIST
+  : EXPRESSION                             { AddDataByte(Ast, ActiveData, $1);}
+  | BYTE_LIST "," EXPRESSION               { AddDataByte(Ast, ActiveData, $3);}
+  ;
+
+ASSIGNMENT
+  : SYMBOL "=" EXPRESSION                  { Ast->GetExpressions().Assign($1, $3);}
+  ;
+
+GLOBAL
+  : ".GLOBL" STRING                        { Ast->GetGlobals().push_back($2); free($2);}
+  | GLOBAL "," STRING                      { Ast->GetGlobals().push_back($3); free($3);}
+  ;
   
 OPERAND
   : REGISTER                               { $$ = new AST::OperandNode(OperandType::Register,  $1, AddressingType::Register);}
   | "(" REGISTER ")" "+"                   { $$ = new AST::OperandNode(OperandType::Register,  $2, AddressingType::AutoIncrement);}
   | "-" "(" REGISTER ")"                   { $$ = new AST::OperandNode(OperandType::Register,  $3, AddressingType::AutoDecrement);}
-  | INT "(" REGISTER ")"                   { $$ = new AST::OperandNode(OperandType::Register,  $3, AddressingType::Index, nullptr, $1);}
+  | EXPRESSION "(" REGISTER ")"            { $$ = IndexOperand(Ast, $1, $3, AddressingType::Index);}
   | "(" REGISTER ")"                       { $$ = new AST::OperandNode(OperandType::Register,  $2, AddressingType::RegisterDeferred);}
   | "@" REGISTER                           { $$ = new AST::OperandNode(OperandType::Register,  $2, AddressingType::RegisterDeferred);}
   | "@" "(" REGISTER ")" "+"               { $$ = new AST::OperandNode(OperandType::Register,  $3, AddressingType::AutoIncrementDeferred);}
   | "@" "-" "(" REGISTER ")"               { $$ = new AST::OperandNode(OperandType::Register,  $4, AddressingType::AutoDecrementDeferred);}
-  | "@" INT "(" REGISTER ")"               { $$ = new AST::OperandNode(OperandType::Register,  $4, AddressingType::IndexDeferred, nullptr, $2);}
-  | "#" INT                                { $$ = new AST::OperandNode(OperandType::Number,    $2, AddressingType::AutoIncrement); }
-  | "@" "#" INT                            { $$ = new AST::OperandNode(OperandType::Number,    $3, AddressingType::AutoIncrementDeferred);}
-  | INT                                    { $$ = new AST::OperandNode(OperandType::Number,    $1, AddressingType::Index, nullptr, $1);}
-  | "@" INT                                { $$ = new AST::OperandNode(OperandType::Number,    $2, AddressingType::IndexDeferred, nullptr, $2);}
-  | STRING                                 { $$ = new AST::OperandNode(OperandType::LabelName, -1, AddressingType::Label, $1);}
+  | "@" EXPRESSION "(" REGISTER ")"        { $$ = IndexOperand(Ast, $2, $4, AddressingType::IndexDeferred);}
+  | "#" EXPRESSION                         { $$ = NumberOperand(Ast, $2, AddressingType::AutoIncrement);}
+  | "@" "#" EXPRESSION                     { $$ = NumberOperand(Ast, $3, AddressingType::AutoIncrementDeferred);}
+  | EXPRESSION                             { $$ = AddressOperand(Ast, $1);}
+  | "@" EXPRESSION                         { $$ = NumberOperand(Ast, $2, AddressingType::IndexDeferred);}
+  ;
+
+// as in MACRO-11, binary operators have no precedence and apply from left to right; <> groups.
+EXPRESSION
+  : TERM                                   { $$ = $1;}
+  | EXPRESSION "+" TERM                    { $$ = Ast->GetExpressions().MakeBinary(AST::ExpressionOp::Add,      $1, $3);}
+  | EXPRESSION "-" TERM                    { $$ = Ast->GetExpressions().MakeBinary(AST::ExpressionOp::Subtract, $1, $3);}
+  | EXPRESSION "*" TERM                    { $$ = Ast->GetExpressions().MakeBinary(AST::ExpressionOp::Multiply, $1, $3);}
+  | EXPRESSION "/" TERM                    { $$ = Ast->GetExpressions().MakeBinary(AST::ExpressionOp::Divide,   $1, $3);}
+  | EXPRESSION "&" TERM                    { $$ = Ast->GetExpressions().MakeBinary(AST::ExpressionOp::And,      $1, $3);}
+  | EXPRESSION "!" TERM                    { $$ = Ast->GetExpressions().MakeBinary(AST::ExpressionOp::Or,       $1, $3);}
+  ;
+
+TERM
+  : INT                                    { $$ = Ast->GetExpressions().MakeConstant($1);}
+  | STRING                                 { $$ = Ast->GetExpressions().MakeReference($1);}
+  | "-" TERM                               { $$ = Ast->GetExpressions().MakeUnary(AST::ExpressionOp::Negate, $2);}
+  | "+" TERM                               { $$ = $2;}
+  | "<" EXPRESSION ">"                     { $$ = $2;}
   ;
   
 LABEL_LIST
-  : LABEL                       { $$ = new AST::LabelNode($1); }
+  : LABEL                                  { $$ = AddLabel(Ast, $1);}
   ;
   
 %%
 
+#undef yylex
+
+extern YYSTYPE ScannerValue;
+
+namespace
+{
+  Pipeline*      ActivePipeline = nullptr;
+  MacroExpander* ActiveMacros   = nullptr;
+  int            TokenLine      = 1;
+  unsigned int   ParserFile     = 0;
+
+  thread_local std::string* DeferredScannerError = nullptr;
+}
+
+void SetParserPipeline(Pipeline* pipeline) {
+  ActivePipeline = pipeline;
+  TokenLine = 1;
+}
+
+// the file the locations of the commands refer to.
+void SetParserFile(const unsigned int file) {
+  ParserFile = file;
+}
+
+void SetParserMacros(MacroExpander* macros) {
+  ActiveMacros = macros;
+  TokenLine = 1;
+}
+
+void DeferScannerErrors(std::string* message) {
+  DeferredScannerError = message;
+}
+
+void ScannerError(const char* msg) {
+  // a scanner on its own thread hands the error to the parser, which reports it in token order.
+  if (DeferredScannerError) {
+    DeferredScannerError->assign(msg);
+    return;
+  }
+
+  yyerror(nullptr, msg);
+}
+
+int ParserLex() {
+  if (!ActivePipeline && !ActiveMacros) {
+    const int token = yylex();
+    yylval = ScannerValue;
+    return token;
+  }
+
+  const int token = ActivePipeline ? ActivePipeline->NextToken(&yylval, &TokenLine) : ActiveMacros->Next(&yylval, &TokenLine);
+  if (token == SCANNER_ERROR)
+    yyerror(nullptr, yylval.sval);
+
+  return token;
+}
+
+int ParserLine() {
+  return ActivePipeline || ActiveMacros ? TokenLine : yylineno;
+}
+
+SourceLocation ParserLocation() {
+  return SourceLocation(ParserFile, ParserLine());
+}
+
+void ParserCommand(AST::CommandNode* command) {
+  if (ActivePipeline)
+    ActivePipeline->AddCommand(command);
+}
+
+AST::CommandNode* ReverseCommands(AST::CommandNode* commands) {
+  AST::CommandNode* reversed = nullptr;
+  while (commands) {
+    AST::CommandNode* next = commands->Next;
+    commands->Next = reversed;
+    reversed = commands;
+    commands = next;
+  }
+  return reversed;
+}
+
+AST::OperandNode* AddressOperand(AST::AbstractSyntaxTree* ast, const AST::Expression& e) {
+  // a bare label keeps the label operand, so jumps to it can be relaxed.
+  if (const char* label = ast->GetExpressions().TakeLabel(e)) {
+    AST::OperandNode* operand = new AST::OperandNode(OperandType::LabelName, -1, AddressingType::Label, label);
+    if (LocalLabels::IsLocal(label))
+      ActiveLocals.Refer(operand, ParserLine());
+
+    return operand;
+  }
+
+  const int fixup = ast->GetExpressions().AddFixup(e);
+  if (fixup >= 0)
+    return new AST::OperandNode(OperandType::LabelName, -1, AddressingType::Label, nullptr, 0, fixup);
+
+  return new AST::OperandNode(OperandType::Number, e.Value, AddressingType::Index, nullptr, e.Value);
+}
+
+AST::OperandNode* NumberOperand(AST::AbstractSyntaxTree* ast, const AST::Expression& e, const AddressingType addrType) {
+  const int fixup = ast->GetExpressions().AddFixup(e);
+  const int value = fixup >= 0 ? 0 : e.Value;
+
+  return new AST::OperandNode(OperandType::Number, value, addrType, nullptr, addrType == AddressingType::IndexDeferred ? value : 0, fixup);
+}
+
+AST::OperandNode* IndexOperand(AST::AbstractSyntaxTree* ast, const AST::Expression& e, const int reg, const AddressingType addrType) {
+  const int fixup = ast->GetExpressions().AddFixup(e);
+  return new AST::OperandNode(OperandType::Register, reg, addrType, nullptr, fixup >= 0 ? 0 : e.Value, fixup);
+}
+
+void AddDataWord(AST::AbstractSyntaxTree* ast, AST::DataNode* data, const AST::Expression& e) {
+  const int fixup = ast->GetExpressions().AddFixup(e);
+  data->AddWord(fixup >= 0 ? 0 : e.Value, fixup);
+}
+
+void AddDataByte(AST::AbstractSyntaxTree* ast, AST::DataNode* data, const AST::Expression& e) {
+  const int fixup = ast->GetExpressions().AddFixup(e);
+  data->AddByte(fixup >= 0 ? 0 : e.Value, fixup);
+}
+
+unsigned int GetDataCount(AST::AbstractSyntaxTree* ast, const AST::Expression& e, const char* directive) {
+  // the layout depends on the count, so it must be known when the directive is parsed.
+  if (ast->GetExpressions().AddFixup(e) >= 0 || e.Value < 0) {
+    const std::string message = std::string("`") + directive + "` needs a constant count";
+    yyerror(ast, message.c_str());
+  }
+
+  return static_cast<unsigned int>(e.Value);
+}
+
+AST::LabelNode* AddLabel(AST::AbstractSyntaxTree* ast, char* name) {
+  // a local label only labels the command for the operands of its scope, which the scope resolves.
+  std::string error;
+  if (LocalLabels::IsLocal(name)) {
+    if (ActiveLocals.Define(name, &error) == false)
+      yyerror(ast, error.c_str());
+
+    free(name);
+    return nullptr;
+  }
+
+  EndLocalScope(ast);
+  return new AST::LabelNode(name);
+}
+
+void SetLabels(AST::CommandNode* command, AST::LabelNode* labels) {
+  command->Labels = labels;
+  ActiveLocals.Bind(command);
+}
+
+void EndLocalScope(AST::AbstractSyntaxTree* ast) {
+  std::string error;
+  if (ActiveLocals.End(ast->GetExpressions(), &error) == false)
+    yyerror(ast, error.c_str());
+}
+
 void yyerror(AST::AbstractSyntaxTree* ast, const char* msg) {
-  fprintf(stderr, "line %d: %s\n", yylineno, msg);
+  fprintf(stderr, "line %d: %s\n", ParserLine(), msg);
+
+  // the scanner and the passes of a pipeline still run on their threads and are joined first.
+  if (ActivePipeline)
+    ActivePipeline->Stop();
+
   exit(-1);
 }
\ No newline at end of file